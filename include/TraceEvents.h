@@ -0,0 +1,37 @@
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+
+// Trace events (see lib/TraceLog). The firmware only uses the IDs, the format strings
+// are compiled into the host decoder (sim/trace). Arguments are integers, at most 3.
+// IDs are the position in the list: add new events at the end, never reuse one
+#define TRACE_EVENTS(X) \
+    X(TRACE_BOOT,           "boot, wake mode %c, radio %d, config cached %d") \
+    X(TRACE_SENSORS,        "sensor search, %d found") \
+    X(TRACE_READING,        "reading, %d sensors answered, waited %d ms, first %d (1/100 C)") \
+    X(TRACE_NO_SENSOR,      "no sensor answered") \
+    X(TRACE_SPILL,          "%d readings moved to the offline queue, %d queued") \
+    X(TRACE_WIFI,           "WiFi connected in %d ms, fast connect %d, channel %d") \
+    X(TRACE_WIFI_FAST_FAIL, "fast connect failed, full scan") \
+    X(TRACE_WIFI_FAIL,      "WiFi not connected after %d ms, status %d") \
+    X(TRACE_MQTT,           "MQTT connected in %d ms, TLS handshakes resumed/full %d/%d") \
+    X(TRACE_MQTT_FAIL,      "MQTT connect failed in %d ms, state %d") \
+    X(TRACE_PUBLISH,        "published %d bytes in %d ms") \
+    X(TRACE_PUBLISH_FAIL,   "publish of %d bytes failed in %d ms, state %d") \
+    X(TRACE_TOO_BIG,        "message does not fit, not sent") \
+    X(TRACE_REPLAY,         "offline queue, %d readings sent, %d left") \
+    X(TRACE_SHADOW_SENT,    "shadow update sent, full %d") \
+    X(TRACE_CLOCK,          "clock sync, off by %d s, sleep skew %d") \
+    X(TRACE_CLOCK_FAIL,     "clock sync, no time from the broker") \
+    X(TRACE_BUDGET,         "wake budget %d exceeded (0 total, 1 wifi, 2 connect, 3 publish)") \
+    X(TRACE_UPLOAD,         "upload done %d, failures in a row %d, next attempt held for %d wakes") \
+    X(TRACE_FW_CHECK,       "FW update check") \
+    X(TRACE_HEAP,           "free heap %d") \
+    X(TRACE_SLEEP,          "sleep %d ms, next wake mode %c") \
+    X(TRACE_DELTA,          "shadow delta, IAS fields set %d, FW update requested %d") \
+    X(TRACE_STREAM,         "streamed %d s, %d readings, %d publishes") \
+    X(TRACE_PUBACK,         "QoS1, %d acknowledged, %d given up, waited %d ms")
+
+#define TRACE_EVENT_ID(id, format)      id,
+enum { TRACE_EVENTS(TRACE_EVENT_ID) TRACE_EVENT_COUNT };
+
+#endif
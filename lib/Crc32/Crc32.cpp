@@ -0,0 +1,15 @@
+#include "Crc32.h"
+
+// bitwise implementation - no table, so nothing is taken from RAM or flash
+// the structures we protect are a few hundred bytes at most
+uint32_t crc32(const void* data, size_t length, uint32_t crc) {
+    const uint8_t* p = (const uint8_t*)data;
+
+    crc = ~crc;
+    while (length--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
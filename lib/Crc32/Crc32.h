@@ -0,0 +1,11 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC-32 (IEEE 802.3, reflected, poly 0xEDB88320)
+// used to validate structures kept in RTC memory across deep sleep
+uint32_t crc32(const void* data, size_t length, uint32_t crc = 0);
+
+#endif
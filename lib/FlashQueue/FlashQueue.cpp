@@ -0,0 +1,230 @@
+#include "FlashQueue.h"
+#include <string.h>
+#include <Crc32.h>
+
+#define ENTRY_PENDING       0x80        // cleared on the last replayed entry
+#define ENTRY_CHECK         0x7F
+#define SCAN_CHUNK          32          // entries read at once
+
+static uint32_t flashQueueCrc(const flashQueueDef* queue) {
+    return crc32((const uint8_t*)queue + sizeof(queue->crc), sizeof(flashQueueDef) - sizeof(queue->crc));
+}
+
+bool flashQueueValid(const flashQueueDef* queue) {
+    if (queue->headIndex > FLASH_QUEUE_ENTRIES || queue->tailIndex > FLASH_QUEUE_ENTRIES)
+        return false;
+    return queue->crc == flashQueueCrc(queue);
+}
+
+void flashQueueSeal(flashQueueDef* queue) {
+    queue->crc = flashQueueCrc(queue);
+}
+
+static uint32_t segmentOffset(const flashQueueIoDef* io, uint32_t seq) {
+    return io->begin + (seq % io->segments) * FLASH_QUEUE_SEGMENT_SIZE;
+}
+
+static uint32_t entryOffset(const flashQueueIoDef* io, uint32_t seq, uint16_t index) {
+    return segmentOffset(io, seq) + sizeof(flashQueueSegmentDef) + index * sizeof(sampleDef);
+}
+
+static uint8_t entryCheck(const sampleDef* sample) {
+    return crc32(sample, offsetof(sampleDef, spare)) & ENTRY_CHECK;
+}
+
+static bool entryFree(const sampleDef* sample) {
+    return sample->time == 0xFFFFFFFFUL && sample->temp == -1 && sample->sensor == 0xFF && sample->spare == 0xFF;
+}
+
+static bool entryValid(const sampleDef* sample) {
+    return !entryFree(sample) && (sample->spare & ENTRY_CHECK) == entryCheck(sample);
+}
+
+// empty log, next append opens segment 1
+static void flashQueueEmpty(flashQueueDef* queue) {
+    memset(queue, 0, sizeof(flashQueueDef));
+    queue->headIndex = FLASH_QUEUE_ENTRIES;
+    queue->tailSeq = 1;
+}
+
+static bool segmentSeq(const flashQueueIoDef* io, uint16_t segment, uint32_t* seq) {
+    flashQueueSegmentDef header;
+    if (!io->read(io->begin + segment * FLASH_QUEUE_SEGMENT_SIZE, &header, sizeof(header)))
+        return false;
+    *seq = header.seq;
+    return header.magic == FLASH_QUEUE_MAGIC && header.seq % io->segments == segment;
+}
+
+void flashQueueMount(flashQueueDef* queue, const flashQueueIoDef* io) {
+    flashQueueEmpty(queue);
+
+    //newest segment
+    bool found = false;
+    uint32_t seq;
+    for (uint16_t i = 0; i < io->segments; i++)
+        if (segmentSeq(io, i, &seq) && (!found || seq > queue->headSeq)) {
+            queue->headSeq = seq;
+            found = true;
+        }
+    if (!found)
+        return;
+
+    //oldest segment of the unbroken sequence ending at the newest one
+    uint32_t oldest = queue->headSeq;
+    while (oldest > 1 && queue->headSeq - (oldest - 1) < io->segments 
+            && segmentSeq(io, (oldest - 1) % io->segments, &seq) && seq == oldest - 1)
+        oldest--;
+
+    //first free entry of the newest segment, the last replayed one anywhere
+    sampleDef chunk[SCAN_CHUNK];
+    bool head = false, tail = false;
+    for (uint32_t s = queue->headSeq; s >= oldest && !tail; s--) {
+        for (int16_t i = 0; i < (int16_t)FLASH_QUEUE_ENTRIES; i += SCAN_CHUNK) {
+            uint16_t n = FLASH_QUEUE_ENTRIES - i < SCAN_CHUNK ? FLASH_QUEUE_ENTRIES - i : SCAN_CHUNK;
+            if (!io->read(entryOffset(io, s, i), chunk, n * sizeof(sampleDef)))
+                break;
+            for (uint16_t j = 0; j < n; j++) {
+                if (entryFree(&chunk[j])) {
+                    if (s == queue->headSeq && !head) {
+                        queue->headIndex = i + j;
+                        head = true;
+                    }
+                    continue;
+                }
+                if (!(chunk[j].spare & ENTRY_PENDING) && entryValid(&chunk[j])) {
+                    queue->tailSeq = s;
+                    queue->tailIndex = i + j + 1;
+                    tail = true;
+                }
+            }
+        }
+        if (s == queue->headSeq && !head)
+            queue->headIndex = FLASH_QUEUE_ENTRIES;
+        if (s == 0)
+            break;
+    }
+    if (!tail) {
+        queue->tailSeq = oldest;
+        queue->tailIndex = 0;
+    }
+    queue->count = (queue->headSeq - queue->tailSeq) * FLASH_QUEUE_ENTRIES + queue->headIndex - queue->tailIndex;
+}
+
+bool flashQueueAppend(flashQueueDef* queue, const flashQueueIoDef* io, const sampleDef* samples, uint16_t n) {
+    sampleDef chunk[SCAN_CHUNK];
+
+    while (n > 0) {
+        if (queue->headIndex >= FLASH_QUEUE_ENTRIES) {
+            uint32_t seq = queue->headSeq + 1;
+            //log full - recycle the oldest segment
+            if (queue->count > 0 && seq - queue->tailSeq >= io->segments) {
+                uint16_t lost = FLASH_QUEUE_ENTRIES - queue->tailIndex;
+                queue->count -= lost;
+                queue->dropped += lost;
+                queue->tailSeq++;
+                queue->tailIndex = 0;
+            }
+            flashQueueSegmentDef header = { FLASH_QUEUE_MAGIC, seq };
+            if (!io->erase(segmentOffset(io, seq)) || !io->write(segmentOffset(io, seq), &header, sizeof(header)))
+                return false;
+            queue->headSeq = seq;
+            queue->headIndex = 0;
+            if (queue->count == 0) {
+                queue->tailSeq = seq;
+                queue->tailIndex = 0;
+            }
+        }
+
+        uint16_t k = FLASH_QUEUE_ENTRIES - queue->headIndex;
+        if (k > n)
+            k = n;
+        if (k > SCAN_CHUNK)
+            k = SCAN_CHUNK;
+        for (uint16_t i = 0; i < k; i++) {
+            chunk[i] = samples[i];
+            chunk[i].spare = ENTRY_PENDING | entryCheck(&samples[i]);
+        }
+        if (!io->write(entryOffset(io, queue->headSeq, queue->headIndex), chunk, k * sizeof(sampleDef)))
+            return false;
+        queue->headIndex += k;
+        queue->count += k;
+        samples += k;
+        n -= k;
+    }
+    return true;
+}
+
+uint16_t flashQueuePeek(const flashQueueDef* queue, const flashQueueIoDef* io, uint32_t skip, sampleDef* samples, uint16_t max, uint16_t* span) {
+    uint16_t n = 0;
+    *span = 0;
+    if (skip >= queue->count)
+        return 0;
+    uint32_t seq = queue->tailSeq + (queue->tailIndex + skip) / FLASH_QUEUE_ENTRIES;
+    uint16_t index = (queue->tailIndex + skip) % FLASH_QUEUE_ENTRIES;
+    uint32_t count = queue->count - skip;
+
+    while (n < max && *span < count) {
+        if (index >= FLASH_QUEUE_ENTRIES) {
+            seq++;
+            index = 0;
+        }
+        uint16_t k = max - n;
+        if (k > FLASH_QUEUE_ENTRIES - index)
+            k = FLASH_QUEUE_ENTRIES - index;
+        if (k > count - *span)
+            k = count - *span;
+        if (!io->read(entryOffset(io, seq, index), samples + n, k * sizeof(sampleDef)))
+            break;
+        index += k;
+        *span += k;
+        //drop entries that did not make it to flash intact
+        uint16_t first = n;
+        for (uint16_t i = 0; i < k; i++)
+            if (entryValid(&samples[first + i])) {
+                samples[n] = samples[first + i];
+                samples[n].spare = 0;
+                n++;
+            }
+    }
+    return n;
+}
+
+bool flashQueueConsume(flashQueueDef* queue, const flashQueueIoDef* io, uint16_t span) {
+    if (span == 0)
+        return true;
+    if (span > queue->count)
+        span = queue->count;
+
+    uint32_t seq = queue->tailSeq;
+    uint32_t index = queue->tailIndex + span - 1;
+    seq += index / FLASH_QUEUE_ENTRIES;
+    index %= FLASH_QUEUE_ENTRIES;
+
+    //mark the last delivered entry, pending bit (top bit of the word, little endian) 
+    //goes from 1 to 0
+    uint32_t word;
+    uint32_t offset = entryOffset(io, seq, index) + offsetof(sampleDef, temp);
+    bool ok = io->read(offset, &word, sizeof(word));
+    if (ok) {
+        word &= ~((uint32_t)ENTRY_PENDING << 24);
+        ok = io->write(offset, &word, sizeof(word));
+    }
+
+    queue->tailSeq = seq;
+    queue->tailIndex = index + 1;
+    queue->count -= span;
+    if (queue->count == 0) {
+        queue->tailSeq = queue->headSeq;
+        queue->tailIndex = queue->headIndex;
+    }
+    return ok;
+}
+
+uint32_t flashQueueNewest(const flashQueueDef* queue, const flashQueueIoDef* io) {
+    sampleDef sample;
+    if (queue->count == 0 || queue->headIndex == 0)
+        return 0;
+    if (!io->read(entryOffset(io, queue->headSeq, queue->headIndex - 1), &sample, sizeof(sample)) || !entryValid(&sample))
+        return 0;
+    return sample.time;
+}
@@ -0,0 +1,63 @@
+#ifndef FLASH_QUEUE_H
+#define FLASH_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <SampleRing.h>
+
+// Append-only log of samples kept in a ring of flash sectors (segments).
+// Every segment starts with a header carrying its sequence number, so the order
+// survives power loss. Replayed entries are marked by clearing the pending bit of
+// the last one, no erase needed. When the log is full the oldest segment is
+// recycled and the entries still in it are counted as dropped.
+// Cursors are a plain struct protected by a CRC so they can be kept in RTC memory,
+// flashQueueMount() rebuilds them from flash. Flash access goes through
+// flashQueueIoDef, so the log does not depend on the SDK.
+
+#define FLASH_QUEUE_SEGMENT_SIZE        4096
+#define FLASH_QUEUE_MAGIC               0x33534D54UL        // "TMS3", sampleDef with sensor index and table
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} flashQueueSegmentDef;
+
+// entries are sampleDef, spare holds the pending bit (bit 7) and a 7 bit check
+#define FLASH_QUEUE_ENTRIES             ((FLASH_QUEUE_SEGMENT_SIZE - sizeof(flashQueueSegmentDef)) / sizeof(sampleDef))
+
+typedef struct {
+    // offsets and sizes are multiples of 4
+    bool (*read)(uint32_t offset, void* data, size_t size);
+    bool (*write)(uint32_t offset, const void* data, size_t size);
+    bool (*erase)(uint32_t offset);
+    uint32_t begin;             // flash offset of the first segment
+    uint16_t segments;          // at least 2
+} flashQueueIoDef;
+
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below
+    uint32_t headSeq;           // segment being written
+    uint32_t tailSeq;           // segment with the oldest entry not replayed yet
+    uint16_t headIndex;         // next free entry in the head segment
+    uint16_t tailIndex;         // next entry to replay in the tail segment
+    uint32_t count;             // entries not replayed yet
+    uint32_t dropped;           // entries lost to recycling, cleared by the caller
+} flashQueueDef __attribute__ ((aligned(4)));
+
+bool flashQueueValid(const flashQueueDef* queue);
+// recalculate CRC. Call before writing the cursors back to RTC memory
+void flashQueueSeal(flashQueueDef* queue);
+
+// rebuild cursors by scanning the segments (e.g. after power loss)
+void flashQueueMount(flashQueueDef* queue, const flashQueueIoDef* io);
+bool flashQueueAppend(flashQueueDef* queue, const flashQueueIoDef* io, const sampleDef* samples, uint16_t n);
+// copy up to max oldest entries, starting skip log positions after the oldest one (i.e.
+// behind batches still in flight). *span is the number of log positions covered,
+// entries that fail the check are skipped. Pass *span to flashQueueConsume()
+// once the entries have been delivered
+uint16_t flashQueuePeek(const flashQueueDef* queue, const flashQueueIoDef* io, uint32_t skip, sampleDef* samples, uint16_t max, uint16_t* span);
+bool flashQueueConsume(flashQueueDef* queue, const flashQueueIoDef* io, uint16_t span);
+// device clock of the newest entry, 0 if the log is empty
+uint32_t flashQueueNewest(const flashQueueDef* queue, const flashQueueIoDef* io);
+
+#endif
@@ -0,0 +1,106 @@
+#include "JsonScan.h"
+#include <string.h>
+
+static size_t skipSpace(const char* p, size_t pos, size_t end) {
+    while (pos < end && (p[pos] == ' ' || p[pos] == '\t' || p[pos] == '\r' || p[pos] == '\n'))
+        pos++;
+    return pos;
+}
+
+// pos is at the opening quote. Returns the position after the closing one, end if
+// the string is not closed
+static size_t skipString(const char* p, size_t pos, size_t end) {
+    for (pos++; pos < end; pos++) {
+        if (p[pos] == '\\')
+            pos++;
+        else if (p[pos] == '"')
+            return pos + 1;
+    }
+    return end;
+}
+
+// position after the value starting at pos, end if it is cut short
+static size_t skipValue(const char* p, size_t pos, size_t end) {
+    if (pos >= end)
+        return end;
+    if (p[pos] == '"')
+        return skipString(p, pos, end);
+    if (p[pos] == '{' || p[pos] == '[') {
+        int depth = 0;
+        while (pos < end) {
+            char c = p[pos];
+            if (c == '"') {
+                pos = skipString(p, pos, end);
+                continue;
+            }
+            if (c == '{' || c == '[')
+                depth++;
+            else if ((c == '}' || c == ']') && --depth == 0)
+                return pos + 1;
+            pos++;
+        }
+        return end;
+    }
+    //number or literal
+    while (pos < end && p[pos] != ',' && p[pos] != '}' && p[pos] != ']' && p[pos] != ' '
+            && p[pos] != '\t' && p[pos] != '\r' && p[pos] != '\n')
+        pos++;
+    return pos;
+}
+
+bool jsonMember(jsonSpanDef object, const char* key, jsonSpanDef* value) {
+    const char* p = object.data;
+    size_t end = object.length;
+    size_t keyLength = strlen(key);
+    size_t pos = skipSpace(p, 0, end);
+    if (pos >= end || p[pos] != '{')
+        return false;
+    pos++;
+
+    while (true) {
+        pos = skipSpace(p, pos, end);
+        if (pos >= end || p[pos] != '"')
+            return false;
+        size_t keyStart = pos + 1;
+        pos = skipString(p, pos, end);
+        if (pos >= end)
+            return false;
+        bool match = pos - 1 - keyStart == keyLength && memcmp(p + keyStart, key, keyLength) == 0;
+
+        pos = skipSpace(p, pos, end);
+        if (pos >= end || p[pos] != ':')
+            return false;
+        size_t valueStart = skipSpace(p, pos + 1, end);
+        pos = skipValue(p, valueStart, end);
+        if (pos >= end)
+            return false;
+        if (match) {
+            value->data = p + valueStart;
+            value->length = pos - valueStart;
+            return true;
+        }
+
+        pos = skipSpace(p, pos, end);
+        if (pos >= end || p[pos] != ',')
+            return false;
+        pos++;
+    }
+}
+
+bool jsonText(jsonSpanDef value, char* text, size_t size) {
+    const char* p = value.data;
+    size_t n = value.length;
+    if (n == 0 || p[0] == '{' || p[0] == '[')
+        return false;
+    if (p[0] == '"') {
+        if (n < 2 || p[n - 1] != '"')
+            return false;
+        p++;
+        n -= 2;
+    }
+    if (n + 1 > size)
+        return false;
+    memcpy(text, p, n);
+    text[n] = 0;
+    return true;
+}
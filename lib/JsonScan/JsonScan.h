@@ -0,0 +1,28 @@
+#ifndef JSON_SCAN_H
+#define JSON_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Reads JSON in place: no copy, no heap. Meant for the small documents the broker
+// sends (shadow delta). A value is found by key one object level at a time, other
+// members are skipped without being looked at.
+//
+//   jsonSpanDef doc = { (const char*)payload, length }, state, value;
+//   char version[16];
+//   if (jsonMember(doc, "state", &state) && jsonMember(state, "Version", &value)
+//           && jsonText(value, version, sizeof(version))) ...
+
+typedef struct {
+    const char* data;
+    size_t length;
+} jsonSpanDef;
+
+// value of a member of the object in span. false if span is not an object, has no
+// such member or is cut short before it
+bool jsonMember(jsonSpanDef object, const char* key, jsonSpanDef* value);
+// string (quotes removed, escapes kept as they are), number or literal as text.
+// false for objects and arrays and if the text does not fit in size
+bool jsonText(jsonSpanDef value, char* text, size_t size);
+
+#endif
@@ -0,0 +1,183 @@
+#include "JsonWriter.h"
+
+JsonWriter::JsonWriter(char* buffer, size_t size) : _buffer(buffer), _size(size) {
+    reset();
+}
+
+void JsonWriter::reset() {
+    _length = 0;
+    _overflow = _size == 0;
+    _depth = 0;
+    _inArray = 0;
+    _notEmpty = 0;
+    if (_size)
+        _buffer[0] = '\0';
+}
+
+// one byte is always kept for the terminating zero
+void JsonWriter::put(char c) {
+    if (_overflow)
+        return;
+    if (_length + 1 >= _size) {
+        _overflow = true;
+        return;
+    }
+    _buffer[_length++] = c;
+    _buffer[_length] = '\0';
+}
+
+void JsonWriter::putString(const char* s) {
+    static const char hex[] = "0123456789abcdef";
+
+    put('"');
+    for (; s && *s; s++) {
+        char c = *s;
+        if (c == '"' || c == '\\') {
+            put('\\');
+            put(c);
+        }
+        else if ((uint8_t)c < 0x20) {
+            put('\\');
+            put('u');
+            put('0');
+            put('0');
+            put(hex[c >> 4]);
+            put(hex[c & 0x0F]);
+        }
+        else
+            put(c);
+    }
+    put('"');
+}
+
+void JsonWriter::putUnsigned(unsigned long value) {
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n)
+        put(digits[--n]);
+}
+
+void JsonWriter::putFixed(long value, uint8_t decimals) {
+    unsigned long scale = 1;
+    for (uint8_t i = 0; i < decimals; i++)
+        scale *= 10;
+
+    unsigned long abs = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    if (value < 0)
+        put('-');
+    putUnsigned(abs / scale);
+
+    unsigned long frac = abs % scale;
+    if (frac == 0)
+        return;
+    //drop trailing zeros
+    while (frac % 10 == 0) {
+        frac /= 10;
+        scale /= 10;
+    }
+    put('.');
+    //leading zeros of the fraction
+    for (unsigned long p = scale / 10; p > frac; p /= 10)
+        put('0');
+    putUnsigned(frac);
+}
+
+void JsonWriter::separator() {
+    if (_depth == 0)
+        return;
+    uint32_t bit = 1UL << (_depth - 1);
+    if (_notEmpty & bit)
+        put(',');
+    _notEmpty |= bit;
+}
+
+void JsonWriter::key(const char* key) {
+    separator();
+    if (_depth && !(_inArray & (1UL << (_depth - 1)))) {
+        putString(key);
+        put(':');
+    }
+}
+
+void JsonWriter::beginObject(const char* name) {
+    key(name);
+    put('{');
+    if (_depth == JSON_WRITER_MAX_DEPTH) {
+        _overflow = true;
+        return;
+    }
+    _inArray &= ~(1UL << _depth);
+    _notEmpty &= ~(1UL << _depth);
+    _depth++;
+}
+
+void JsonWriter::endObject() {
+    put('}');
+    if (_depth)
+        _depth--;
+}
+
+void JsonWriter::beginArray(const char* name) {
+    key(name);
+    put('[');
+    if (_depth == JSON_WRITER_MAX_DEPTH) {
+        _overflow = true;
+        return;
+    }
+    _inArray |= 1UL << _depth;
+    _notEmpty &= ~(1UL << _depth);
+    _depth++;
+}
+
+void JsonWriter::endArray() {
+    put(']');
+    if (_depth)
+        _depth--;
+}
+
+void JsonWriter::add(const char* name, const char* value) {
+    key(name);
+    putString(value);
+}
+
+void JsonWriter::add(const char* name, bool value) {
+    key(name);
+    for (const char* s = value ? "true" : "false"; *s; s++)
+        put(*s);
+}
+
+void JsonWriter::add(const char* name, long value) {
+    key(name);
+    putFixed(value, 0);
+}
+
+void JsonWriter::add(const char* name, unsigned long value) {
+    key(name);
+    putUnsigned(value);
+}
+
+void JsonWriter::addFixed(const char* name, long value, uint8_t decimals) {
+    key(name);
+    putFixed(value, decimals);
+}
+
+void JsonWriter::item(const char* value) {
+    add(NULL, value);
+}
+
+void JsonWriter::item(long value) {
+    add(NULL, value);
+}
+
+void JsonWriter::item(unsigned long value) {
+    add(NULL, value);
+}
+
+void JsonWriter::itemFixed(long value, uint8_t decimals) {
+    addFixed(NULL, value, decimals);
+}
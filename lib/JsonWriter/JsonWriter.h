@@ -0,0 +1,73 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Minimal JSON serializer writing straight into a fixed buffer. No heap, no floats.
+// If the buffer turns out to be too small, everything after that point is dropped 
+// and ok() returns false - a truncated document is never mistaken for a valid one.
+//
+//   JsonWriter json(buf, sizeof(buf));
+//   json.beginObject();
+//   json.add("sensor", name);
+//   json.beginArray("temperature");
+//   json.itemFixed(2150, 2);          // 21.5
+//   json.endArray();
+//   json.endObject();
+//   if (json.ok()) publish(json.c_str(), json.length());
+
+#define JSON_WRITER_MAX_DEPTH   16
+
+class JsonWriter {
+    public:
+        JsonWriter(char* buffer, size_t size);
+        void reset();
+
+        // containers. key is used inside objects and ignored inside arrays
+        void beginObject(const char* key = NULL);
+        void endObject();
+        void beginArray(const char* key = NULL);
+        void endArray();
+
+        // object members
+        void add(const char* key, const char* value);
+        void add(const char* key, bool value);
+        void add(const char* key, int value) { add(key, (long)value); }
+        void add(const char* key, unsigned int value) { add(key, (unsigned long)value); }
+        void add(const char* key, long value);
+        void add(const char* key, unsigned long value);
+        // fixed point: value / 10^decimals, trailing zeros are dropped
+        void addFixed(const char* key, long value, uint8_t decimals);
+
+        // array items
+        void item(const char* value);
+        void item(int value) { item((long)value); }
+        void item(unsigned int value) { item((unsigned long)value); }
+        void item(long value);
+        void item(unsigned long value);
+        void itemFixed(long value, uint8_t decimals);
+
+        // true if everything fit into the buffer and all containers are closed
+        bool ok() const { return !_overflow && _depth == 0; }
+        const char* c_str() const { return _buffer; }
+        size_t length() const { return _length; }
+
+    private:
+        void separator();
+        void key(const char* key);
+        void put(char c);
+        void putString(const char* s);
+        void putUnsigned(unsigned long value);
+        void putFixed(long value, uint8_t decimals);
+
+        char* _buffer;
+        size_t _size;
+        size_t _length;
+        bool _overflow;
+        uint8_t _depth;
+        uint32_t _inArray;          // bit per level: container is an array
+        uint32_t _notEmpty;         // bit per level: container has members already
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "MqttWindow.h"
+#include <string.h>
+
+#define MQTT_PUBLISH_QOS1       0x32
+#define MQTT_PUBACK             0x40
+#define SCAN_LENGTH_DONE        0xFF
+
+void mqttWindowReset(mqttWindowDef* window, uint8_t size) {
+    uint16_t lastId = window->lastId;
+    memset(window, 0, sizeof(mqttWindowDef));
+    window->size = size > MQTT_WINDOW_MAX ? MQTT_WINDOW_MAX : size;
+    //IDs go on across connections, a late PUBACK does not match a new message
+    window->lastId = lastId;
+    window->scanShift = SCAN_LENGTH_DONE;
+}
+
+uint8_t mqttWindowCount(const mqttWindowDef* window) {
+    return window->count;
+}
+
+uint16_t mqttWindowOpen(mqttWindowDef* window, uint8_t kind, uint16_t count, uint32_t extra) {
+    if (window->count >= window->size)
+        return 0;
+    if (++window->lastId == 0)
+        window->lastId = 1;
+    mqttInFlightDef* entry = &window->entries[(window->head + window->count) % MQTT_WINDOW_MAX];
+    entry->id = window->lastId;
+    entry->acked = false;
+    entry->kind = kind;
+    entry->count = count;
+    entry->extra = extra;
+    window->count++;
+    return entry->id;
+}
+
+void mqttWindowSet(mqttWindowDef* window, uint8_t kind, uint16_t count, uint32_t extra) {
+    if (!window->count)
+        return;
+    mqttInFlightDef* entry = &window->entries[(window->head + window->count - 1) % MQTT_WINDOW_MAX];
+    entry->kind = kind;
+    entry->count = count;
+    entry->extra = extra;
+}
+
+size_t mqttPublishHeader(uint8_t* out, size_t size, const char* topic, size_t length, uint16_t id) {
+    size_t topicLength = strlen(topic);
+    uint32_t remaining = 2 + topicLength + 2 + length;
+    if (topicLength > 0xFFFF || remaining > 0x0FFFFFFF)
+        return 0;
+    uint8_t head[5];
+    size_t n = 0;
+    head[n++] = MQTT_PUBLISH_QOS1;
+    do {
+        head[n] = remaining & 0x7F;
+        remaining >>= 7;
+        if (remaining)
+            head[n] |= 0x80;
+        n++;
+    } while (remaining);
+    if (n + 2 + topicLength + 2 > size)
+        return 0;
+    memcpy(out, head, n);
+    out[n++] = topicLength >> 8;
+    out[n++] = topicLength & 0xFF;
+    memcpy(out + n, topic, topicLength);
+    n += topicLength;
+    out[n++] = id >> 8;
+    out[n++] = id & 0xFF;
+    return n;
+}
+
+static void acknowledge(mqttWindowDef* window, uint16_t id) {
+    for (uint8_t i = 0; i < window->count; i++) {
+        mqttInFlightDef* entry = &window->entries[(window->head + i) % MQTT_WINDOW_MAX];
+        if (entry->id == id) {
+            entry->acked = true;
+            return;
+        }
+    }
+}
+
+void mqttWindowScan(mqttWindowDef* window, const uint8_t* data, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        uint8_t b = data[i];
+        if (window->scanShift == SCAN_LENGTH_DONE && window->scanLeft == 0) {
+            //fixed header of the next packet
+            window->scanType = b;
+            window->scanShift = 0;
+            window->scanLength = 0;
+            continue;
+        }
+        if (window->scanShift != SCAN_LENGTH_DONE) {
+            window->scanLength |= (uint32_t)(b & 0x7F) << window->scanShift;
+            window->scanShift += 7;
+            if (b & 0x80 && window->scanShift < 28)
+                continue;
+            window->scanShift = SCAN_LENGTH_DONE;
+            window->scanLeft = window->scanLength;
+            window->scanId = 0;
+        }
+        else {
+            //packet ID is the first 2 bytes of a PUBACK
+            uint32_t pos = window->scanLength - window->scanLeft;
+            if (pos < 2)
+                window->scanId = (window->scanId << 8) | b;
+            window->scanLeft--;
+        }
+        if (window->scanLeft == 0 && (window->scanType & 0xF0) == MQTT_PUBACK && window->scanLength == 2)
+            acknowledge(window, window->scanId);
+    }
+}
+
+bool mqttWindowPop(mqttWindowDef* window, mqttInFlightDef* done) {
+    if (!window->count || !window->entries[window->head].acked)
+        return false;
+    *done = window->entries[window->head];
+    window->head = (window->head + 1) % MQTT_WINDOW_MAX;
+    window->count--;
+    return true;
+}
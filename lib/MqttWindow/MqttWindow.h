@@ -0,0 +1,62 @@
+#ifndef MQTT_WINDOW_H
+#define MQTT_WINDOW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// QoS1 publishes in flight. Up to size messages are sent before the first PUBACK has
+// to come back, each one carries a packet ID and what the caller needs to settle once
+// it is acknowledged (kind, count, extra). PUBACKs are picked out of the bytes the MQTT
+// client reads (mqttWindowScan), acknowledged messages are handed back oldest first.
+// Nothing is kept across connections: what was not acknowledged is sent again.
+//
+//   uint8_t header[MQTT_PUBLISH_HEADER_MAX];
+//   uint16_t id = mqttWindowOpen(&window, kind, n, 0);
+//   write(header, mqttPublishHeader(header, sizeof(header), topic, length, id)); write(payload, length);
+//   ...
+//   mqttInFlightDef done;
+//   while (mqttWindowPop(&window, &done)) ...
+
+#define MQTT_WINDOW_MAX                 8
+// fixed header, remaining length, topic length and packet ID
+#define MQTT_PUBLISH_HEADER_MAX         (1 + 4 + 2 + 2)
+
+typedef struct {
+    uint16_t id;                // packet ID
+    uint8_t kind;               // caller's, e.g. where the payload came from
+    bool acked;
+    uint16_t count;             // caller's, e.g. readings to drop once acknowledged
+    uint32_t extra;
+} mqttInFlightDef;
+
+typedef struct {
+    uint8_t size;               // max messages in flight, 0 - QoS0
+    uint8_t head;               // oldest message
+    uint8_t count;
+    uint16_t lastId;
+    mqttInFlightDef entries[MQTT_WINDOW_MAX];
+    // PUBACK scanner, follows the packets in the stream read from the broker
+    uint8_t scanType;           // fixed header of the packet being read
+    uint8_t scanShift;          // remaining length: next 7 bits go here, 0xFF - read
+    uint32_t scanLeft;          // bytes of the packet still to come
+    uint32_t scanLength;
+    uint16_t scanId;
+} mqttWindowDef;
+
+// new connection, messages in flight are forgotten. size is capped at MQTT_WINDOW_MAX
+void mqttWindowReset(mqttWindowDef* window, uint8_t size);
+// messages not handed back by mqttWindowPop() yet
+uint8_t mqttWindowCount(const mqttWindowDef* window);
+// next message goes into the window, returns its packet ID. 0 - the window is full
+uint16_t mqttWindowOpen(mqttWindowDef* window, uint8_t kind, uint16_t count, uint32_t extra);
+// what the newest message carries, once it is known
+void mqttWindowSet(mqttWindowDef* window, uint8_t kind, uint16_t count, uint32_t extra);
+// PUBLISH with QoS1, everything up to the payload. Returns the size, 0 if it does not fit
+size_t mqttPublishHeader(uint8_t* out, size_t size, const char* topic, size_t length, uint16_t id);
+// bytes read from the broker, in order. A PUBACK marks its message acknowledged
+void mqttWindowScan(mqttWindowDef* window, const uint8_t* data, size_t n);
+// oldest message if it is acknowledged, taken out of the window. A message acknowledged
+// out of order waits for the ones before it
+bool mqttWindowPop(mqttWindowDef* window, mqttInFlightDef* done);
+
+#endif
@@ -0,0 +1,237 @@
+#include "PackedPayload.h"
+#include <string.h>
+
+PackedWriter::PackedWriter(uint8_t* buffer, size_t size) : _buffer(buffer), _size(size) {
+    reset();
+}
+
+void PackedWriter::reset() {
+    _length = 0;
+    _overflow = false;
+}
+
+void PackedWriter::put(uint8_t value) {
+    if (_length >= _size) {
+        _overflow = true;
+        return;
+    }
+    _buffer[_length++] = value;
+}
+
+void PackedWriter::putBytes(const void* data, size_t size) {
+    if (_length + size > _size) {
+        _overflow = true;
+        return;
+    }
+    memcpy(_buffer + _length, data, size);
+    _length += size;
+}
+
+void PackedWriter::putVarint(uint32_t value) {
+    while (value >= 0x80) {
+        put((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    put(value);
+}
+
+void PackedWriter::putSigned(int32_t value) {
+    putVarint(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+void PackedWriter::putString(const char* s) {
+    size_t n = strlen(s);
+    if (n > PACKED_NAME_MAX)
+        n = PACKED_NAME_MAX;
+    put(n);
+    putBytes(s, n);
+}
+
+static void packedHeader(PackedWriter& msg, uint8_t type, const char* name, const uint8_t (*roms)[PACKED_ROM_SIZE], uint8_t sensors) {
+    msg.put(PACKED_MAGIC);
+    msg.put(type);
+    msg.putString(name);
+    msg.put(sensors);
+    if (sensors > 1)
+        msg.putBytes(roms, sensors * PACKED_ROM_SIZE);
+}
+
+void packedReadings(PackedWriter& msg, const char* name, const uint8_t (*roms)[PACKED_ROM_SIZE], uint8_t sensors,
+    const sampleDef* samples, uint16_t n, uint32_t now, uint32_t dropped) {
+    //a single sensor device has no table, all its readings go in one group
+    uint8_t groups = sensors > 1 ? (sensors < PACKED_SENSORS_MAX ? sensors : PACKED_SENSORS_MAX) : 1;
+    uint16_t count[PACKED_SENSORS_MAX] = {0};
+    uint8_t used = 0;
+    for (uint16_t i = 0; i < n; i++) {
+        uint8_t g = sensors > 1 ? samples[i].sensor : 0;
+        if (g >= groups)
+            continue;
+        if (count[g]++ == 0)
+            used++;
+    }
+
+    packedHeader(msg, PACKED_READINGS, name, roms, sensors);
+    msg.putVarint(dropped);
+    msg.put(used);
+    for (uint8_t g = 0; g < groups; g++) {
+        if (count[g] == 0)
+            continue;
+        if (sensors > 1)
+            msg.put(g);
+        msg.putVarint(count[g]);
+
+        bool first = true;
+        uint32_t lastAge = 0;
+        int32_t lastStep = 0;
+        int16_t lastTemp = 0;
+        for (uint16_t i = 0; i < n; i++) {
+            if ((sensors > 1 ? samples[i].sensor : 0) != g)
+                continue;
+            uint32_t age = now > samples[i].time ? now - samples[i].time : 0;
+            if (first) {
+                msg.putVarint(age);
+                msg.putSigned(samples[i].temp);
+                first = false;
+            }
+            else {
+                int32_t step = (int32_t)(lastAge - age);
+                msg.putSigned(step - lastStep);
+                msg.putSigned(samples[i].temp - lastTemp);
+                lastStep = step;
+            }
+            lastAge = age;
+            lastTemp = samples[i].temp;
+        }
+    }
+}
+
+void packedWindow(PackedWriter& msg, const char* name, const uint8_t (*roms)[PACKED_ROM_SIZE], uint8_t sensors,
+    const windowDef* window, uint32_t period) {
+    uint8_t groups = sensors > 1 ? (sensors < WINDOW_SERIES ? sensors : WINDOW_SERIES) : 1;
+    uint8_t used = 0;
+    for (uint8_t g = 0; g < groups; g++)
+        if (window->count[g])
+            used++;
+
+    packedHeader(msg, PACKED_WINDOW, name, roms, sensors);
+    msg.putVarint(period);
+    msg.put(used);
+    for (uint8_t g = 0; g < groups; g++) {
+        if (window->count[g] == 0)
+            continue;
+        int16_t mean = windowMean(window, g);
+        if (sensors > 1)
+            msg.put(g);
+        msg.putVarint(window->count[g]);
+        msg.putSigned(mean);
+        msg.putVarint(mean - window->stat[g].min);
+        msg.putVarint(window->stat[g].max - mean);
+        msg.putVarint(windowStddev(window, g));
+    }
+}
+
+// reader over the received bytes, fails for good once it runs past the end
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+    size_t pos;
+    bool ok;
+} packedReaderDef;
+
+static uint8_t getByte(packedReaderDef* in) {
+    if (in->pos >= in->length) {
+        in->ok = false;
+        return 0;
+    }
+    return in->data[in->pos++];
+}
+
+static uint32_t getVarint(packedReaderDef* in) {
+    uint32_t value = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+        uint8_t b = getByte(in);
+        value |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return value;
+    }
+    in->ok = false;
+    return 0;
+}
+
+static int32_t getSigned(packedReaderDef* in) {
+    uint32_t v = getVarint(in);
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint8_t getSensor(packedReaderDef* in, const packedMessageDef* msg) {
+    uint8_t sensor = msg->sensors > 1 ? getByte(in) : 0;
+    if (msg->sensors > 1 && sensor >= msg->sensors)
+        in->ok = false;
+    return sensor;
+}
+
+bool packedDecode(const uint8_t* data, size_t length, packedMessageDef* msg) {
+    packedReaderDef in = {data, length, 0, true};
+    memset(msg, 0, sizeof(packedMessageDef));
+
+    if (getByte(&in) != PACKED_MAGIC)
+        return false;
+    msg->type = getByte(&in);
+    if (msg->type != PACKED_READINGS && msg->type != PACKED_WINDOW)
+        return false;
+    uint8_t n = getByte(&in);
+    if (in.pos + n > length)
+        return false;
+    memcpy(msg->name, data + in.pos, n);
+    msg->name[n] = 0;
+    in.pos += n;
+    msg->sensors = getByte(&in);
+    if (msg->sensors > PACKED_SENSORS_MAX)
+        return false;
+    if (msg->sensors > 1) {
+        if (in.pos + msg->sensors * PACKED_ROM_SIZE > length)
+            return false;
+        memcpy(msg->rom, data + in.pos, msg->sensors * PACKED_ROM_SIZE);
+        in.pos += msg->sensors * PACKED_ROM_SIZE;
+    }
+    if (msg->type == PACKED_READINGS)
+        msg->dropped = getVarint(&in);
+    else
+        msg->period = getVarint(&in);
+
+    uint8_t groups = getByte(&in);
+    for (uint8_t g = 0; g < groups && in.ok; g++) {
+        uint8_t sensor = getSensor(&in, msg);
+        if (msg->type == PACKED_WINDOW) {
+            if (msg->count >= PACKED_SENSORS_MAX)
+                return false;
+            packedStatDef* stat = &msg->stats[msg->count++];
+            stat->sensor = sensor;
+            stat->n = getVarint(&in);
+            stat->mean = getSigned(&in);
+            stat->min = stat->mean - (int32_t)getVarint(&in);
+            stat->max = stat->mean + (int32_t)getVarint(&in);
+            stat->sd = getVarint(&in);
+            continue;
+        }
+
+        uint32_t k = getVarint(&in);
+        if (k == 0 || msg->count + k > PACKED_READINGS_MAX)
+            return false;
+        uint32_t age = getVarint(&in);
+        int32_t temp = getSigned(&in);
+        int32_t step = 0;
+        for (uint32_t i = 0; i < k && in.ok; i++) {
+            if (i > 0) {
+                step += getSigned(&in);
+                age -= step;
+                temp += getSigned(&in);
+            }
+            packedReadingDef* reading = &msg->readings[msg->count++];
+            reading->sensor = sensor;
+            reading->age = age;
+            reading->temp = temp;
+        }
+    }
+    return in.ok && in.pos == length;
+}
@@ -0,0 +1,117 @@
+#ifndef PACKED_PAYLOAD_H
+#define PACKED_PAYLOAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <SampleRing.h>
+#include <WindowStats.h>
+
+// Compact binary content messages, the alternative to JSON. Encoder and decoder
+// share this file, so the layout is defined in one place. No Arduino dependencies,
+// the decoder is meant for the host side.
+//
+// Varints are LEB128 (7 bits per byte, low bits first), signed values are zigzag
+// encoded before (0, -1, 1, -2 ... -> 0, 1, 2, 3 ...). Temperatures in 1/100 deg C.
+//
+//   u8      PACKED_MAGIC, format version
+//   u8      PACKED_READINGS or PACKED_WINDOW
+//   u8      length of the thing name, followed by the name (no terminator)
+//   u8      sensor count s, followed by s ROM IDs of 8 bytes if s > 1
+//   varint  readings: readings dropped before upload. window: seconds between readings
+//   u8      groups, one per sensor that has data
+//
+// readings group, readings oldest first:
+//   u8      sensor index (only if s > 1)
+//   varint  k, readings in the group
+//   varint  age of the first reading, seconds before the upload
+//   svarint temperature of the first reading
+//   k - 1 times:
+//     svarint age step: age difference to the reading before, the first one as is,
+//             then the change of that difference (0 on a regular schedule)
+//     svarint temperature difference to the reading before
+//
+// window group:
+//   u8      sensor index (only if s > 1)
+//   varint  n, readings in the window
+//   svarint mean
+//   varint  mean - min
+//   varint  max - mean
+//   varint  standard deviation
+
+#define PACKED_MAGIC            0xB1
+#define PACKED_READINGS         1
+#define PACKED_WINDOW           2
+
+#define PACKED_ROM_SIZE         8
+#define PACKED_NAME_MAX         255
+#define PACKED_SENSORS_MAX      16
+
+// serializer writing straight into a fixed buffer. Like JsonWriter, anything that
+// does not fit is dropped and ok() returns false
+class PackedWriter {
+    public:
+        PackedWriter(uint8_t* buffer, size_t size);
+        void reset();
+
+        void put(uint8_t value);
+        void putBytes(const void* data, size_t size);
+        void putVarint(uint32_t value);
+        void putSigned(int32_t value);
+        // u8 length and the characters, cut at PACKED_NAME_MAX
+        void putString(const char* s);
+
+        bool ok() const { return !_overflow; }
+        const uint8_t* data() const { return _buffer; }
+        size_t length() const { return _length; }
+
+    private:
+        uint8_t* _buffer;
+        size_t _size;
+        size_t _length;
+        bool _overflow;
+};
+
+// n readings, oldest first. now is the device clock at upload. roms holds sensors
+// ROM IDs, not used for a single sensor
+void packedReadings(PackedWriter& msg, const char* name, const uint8_t (*roms)[PACKED_ROM_SIZE], uint8_t sensors,
+    const sampleDef* samples, uint16_t n, uint32_t now, uint32_t dropped);
+// statistics of all sensors that have readings in the window
+void packedWindow(PackedWriter& msg, const char* name, const uint8_t (*roms)[PACKED_ROM_SIZE], uint8_t sensors,
+    const windowDef* window, uint32_t period);
+
+// decoder, host side
+
+#define PACKED_READINGS_MAX     1024
+
+typedef struct {
+    uint8_t sensor;
+    uint32_t age;               // seconds before the upload
+    int16_t temp;
+} packedReadingDef;
+
+typedef struct {
+    uint8_t sensor;
+    uint16_t n;
+    int16_t mean;
+    int16_t min;
+    int16_t max;
+    uint16_t sd;
+} packedStatDef;
+
+typedef struct {
+    uint8_t type;
+    char name[PACKED_NAME_MAX + 1];
+    uint8_t sensors;
+    uint8_t rom[PACKED_SENSORS_MAX][PACKED_ROM_SIZE];
+    uint32_t dropped;           // readings
+    uint32_t period;            // window
+    uint16_t count;             // entries in readings[] or stats[]
+    packedReadingDef readings[PACKED_READINGS_MAX];
+    packedStatDef stats[PACKED_SENSORS_MAX];
+} packedMessageDef;
+
+// false if the message is not a packed content message, is cut short or does not fit
+// in packedMessageDef
+bool packedDecode(const uint8_t* data, size_t length, packedMessageDef* msg);
+
+#endif
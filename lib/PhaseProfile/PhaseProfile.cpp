@@ -0,0 +1,47 @@
+#include "PhaseProfile.h"
+#include <string.h>
+#include <Crc32.h>
+
+const char* const phaseNames[PHASE_COUNT] = {
+    "boot", "config", "spiffs", "cert", "sensor", "wifi", "mqtt", "publish", "awake"
+};
+
+static uint32_t phaseProfileCrc(const phaseProfileDef* profile) {
+    return crc32((const uint8_t*)profile + sizeof(profile->crc), sizeof(phaseProfileDef) - sizeof(profile->crc));
+}
+
+void phaseProfileReset(phaseProfileDef* profile) {
+    memset(profile, 0, sizeof(phaseProfileDef));
+    phaseProfileSeal(profile);
+}
+
+bool phaseProfileValid(const phaseProfileDef* profile) {
+    return profile->crc == phaseProfileCrc(profile);
+}
+
+void phaseProfileSeal(phaseProfileDef* profile) {
+    profile->crc = phaseProfileCrc(profile);
+}
+
+void phaseProfileAdd(phaseProfileDef* profile, uint8_t phase, uint32_t ms) {
+    if (phase >= PHASE_COUNT || profile->stat[phase].count == UINT16_MAX)
+        return;
+
+    phaseStatDef* stat = &profile->stat[phase];
+    uint16_t t = ms > UINT16_MAX ? UINT16_MAX : ms;
+
+    if (stat->count == 0 || t < stat->min)
+        stat->min = t;
+    if (stat->count == 0 || t > stat->max)
+        stat->max = t;
+    stat->count++;
+    //mean += (t - mean) / count, rounded
+    int32_t delta = (int32_t)t - stat->mean;
+    stat->mean += (delta >= 0 ? delta + stat->count / 2 : delta - stat->count / 2) / stat->count;
+}
+
+uint16_t phaseProfileMean(const phaseProfileDef* profile, uint8_t phase) {
+    if (phase >= PHASE_COUNT)
+        return 0;
+    return profile->stat[phase].mean;
+}
@@ -0,0 +1,45 @@
+#ifndef PHASE_PROFILE_H
+#define PHASE_PROFILE_H
+
+#include <stdint.h>
+
+// Wake cycle phase statistics (min/mean/max in ms) over the cycles since the 
+// last reset. Plain struct protected by a CRC so it can be kept in RTC memory.
+
+typedef enum {
+    PHASE_BOOT = 0,             // reset until setup() is entered
+    PHASE_CONFIG,               // IAS fields or config cache
+    PHASE_SPIFFS,               // SPIFFS mount
+    PHASE_CERT,                 // certificate and private key load
+    PHASE_SENSOR,               // waiting for the temperature reading
+    PHASE_WIFI,                 // WiFi association and IP
+    PHASE_MQTT,                 // TLS handshake and MQTT connect
+    PHASE_PUBLISH,              // all publishes and disconnect
+    PHASE_AWAKE,                // total awake time
+    PHASE_COUNT
+} phaseDef;
+
+// short names, used as JSON keys
+extern const char* const phaseNames[PHASE_COUNT];
+
+typedef struct {
+    uint16_t count;             // cycles in which the phase was recorded
+    uint16_t min;
+    uint16_t max;
+    uint16_t mean;              // running mean, no sum to overflow
+} phaseStatDef;
+
+typedef struct {
+    uint32_t crc;                       // CRC32 over everything below
+    phaseStatDef stat[PHASE_COUNT];
+} phaseProfileDef __attribute__ ((aligned(4)));
+
+void phaseProfileReset(phaseProfileDef* profile);
+bool phaseProfileValid(const phaseProfileDef* profile);
+// recalculate CRC. Call before writing the profile back to RTC memory
+void phaseProfileSeal(phaseProfileDef* profile);
+
+void phaseProfileAdd(phaseProfileDef* profile, uint8_t phase, uint32_t ms);
+uint16_t phaseProfileMean(const phaseProfileDef* profile, uint8_t phase);
+
+#endif
@@ -0,0 +1,53 @@
+#include "SampleRing.h"
+#include <string.h>
+#include <stddef.h>
+#include <Crc32.h>
+
+static uint32_t sampleRingCrc(const sampleRingDef* ring) {
+    return crc32((const uint8_t*)ring + sizeof(ring->crc), sizeof(sampleRingDef) - sizeof(ring->crc));
+}
+
+void sampleRingReset(sampleRingDef* ring) {
+    memset(ring, 0, sizeof(sampleRingDef));
+    sampleRingSeal(ring);
+}
+
+bool sampleRingValid(const sampleRingDef* ring) {
+    if (ring->head >= SAMPLE_RING_CAPACITY || ring->count > SAMPLE_RING_CAPACITY)
+        return false;
+    return ring->crc == sampleRingCrc(ring);
+}
+
+void sampleRingSeal(sampleRingDef* ring) {
+    ring->crc = sampleRingCrc(ring);
+}
+
+void sampleRingPush(sampleRingDef* ring, uint32_t time, int16_t temp, uint8_t sensor) {
+    uint8_t tail = (ring->head + ring->count) % SAMPLE_RING_CAPACITY;
+
+    ring->samples[tail].time = time;
+    ring->samples[tail].temp = temp;
+    ring->samples[tail].sensor = sensor;
+    ring->samples[tail].spare = 0;
+
+    if (ring->count < SAMPLE_RING_CAPACITY)
+        ring->count++;
+    else {
+        //full - oldest sample is lost
+        ring->head = (ring->head + 1) % SAMPLE_RING_CAPACITY;
+        ring->dropped++;
+    }
+}
+
+const sampleDef* sampleRingAt(const sampleRingDef* ring, uint8_t i) {
+    if (i >= ring->count)
+        return NULL;
+    return &ring->samples[(ring->head + i) % SAMPLE_RING_CAPACITY];
+}
+
+void sampleRingDrop(sampleRingDef* ring, uint8_t n) {
+    if (n > ring->count)
+        n = ring->count;
+    ring->head = (ring->head + n) % SAMPLE_RING_CAPACITY;
+    ring->count -= n;
+}
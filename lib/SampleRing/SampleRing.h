@@ -0,0 +1,40 @@
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdint.h>
+
+// Ring buffer of timestamped temperature samples.
+// Designed to live in RTC memory, so it is a plain struct protected by a CRC.
+// When the ring is full the oldest sample is overwritten.
+
+#define SAMPLE_RING_CAPACITY    12
+
+typedef struct {
+    uint32_t time;              // device clock (seconds) when the sample was taken
+    int16_t temp;               // temperature in 1/100 deg C
+    uint8_t sensor;             // index in the sensor table of the device
+    uint8_t spare;
+} sampleDef;
+
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below
+    uint32_t clock;             // device clock in seconds, advanced on every deep sleep
+    uint8_t head;               // index of the oldest sample
+    uint8_t count;              // number of samples stored
+    uint16_t dropped;           // samples overwritten before they were uploaded
+    sampleDef samples[SAMPLE_RING_CAPACITY];
+} sampleRingDef __attribute__ ((aligned(4)));
+
+void sampleRingReset(sampleRingDef* ring);
+// true if CRC matches and indexes are in range
+bool sampleRingValid(const sampleRingDef* ring);
+// recalculate CRC. Call before writing the ring back to RTC memory
+void sampleRingSeal(sampleRingDef* ring);
+
+void sampleRingPush(sampleRingDef* ring, uint32_t time, int16_t temp, uint8_t sensor);
+// i = 0 is the oldest sample
+const sampleDef* sampleRingAt(const sampleRingDef* ring, uint8_t i);
+// remove n oldest samples (i.e. after they were uploaded)
+void sampleRingDrop(sampleRingDef* ring, uint8_t n);
+
+#endif
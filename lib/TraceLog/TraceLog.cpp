@@ -0,0 +1,243 @@
+#include "TraceLog.h"
+#include <string.h>
+#include <Crc32.h>
+
+#define BLOCK_FREE          0xFFFF
+#define EVENT_MASK          0x3F
+#define ARGC_SHIFT          6
+
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t blockSize(uint16_t length) {
+    return sizeof(traceBlockDef) + ((length + 3) & ~3);
+}
+
+static uint32_t blockCrc(const uint8_t* block, uint16_t length) {
+    return crc32(block + sizeof(uint32_t), sizeof(traceBlockDef) - sizeof(uint32_t) + length);
+}
+
+static size_t putVarint(uint8_t* out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = value;
+    return n;
+}
+
+void traceReset(traceBufferDef* trace) {
+    memset(trace, 0, sizeof(traceBufferDef));
+}
+
+void traceAdd(traceBufferDef* trace, uint8_t event, uint32_t ms, uint8_t argc, const int32_t* args) {
+    uint8_t record[1 + 5 + 5 * TRACE_ARGS_MAX];
+    if (argc > TRACE_ARGS_MAX)
+        argc = TRACE_ARGS_MAX;
+    size_t n = 0;
+    record[n++] = (argc << ARGC_SHIFT) | (event & EVENT_MASK);
+    n += putVarint(record + n, ms - trace->lastMs);
+    for (uint8_t i = 0; i < argc; i++)
+        n += putVarint(record + n, ((uint32_t)args[i] << 1) ^ (uint32_t)(args[i] >> 31));
+
+    if (trace->header.length + n > TRACE_BUFFER_SIZE) {
+        if (trace->header.lost < UINT8_MAX)
+            trace->header.lost++;
+        return;
+    }
+    memcpy(trace->records + trace->header.length, record, n);
+    trace->header.length += n;
+    trace->lastMs = ms;
+}
+
+static uint32_t segmentOffset(const traceIoDef* io, uint32_t seq) {
+    return io->begin + (seq % io->segments) * TRACE_SEGMENT_SIZE;
+}
+
+static bool segmentSeq(const traceIoDef* io, uint16_t segment, uint32_t* seq) {
+    traceSegmentDef header;
+    if (!io->read(io->begin + segment * TRACE_SEGMENT_SIZE, &header, sizeof(header)))
+        return false;
+    *seq = header.seq;
+    return header.magic == TRACE_MAGIC && header.seq % io->segments == segment;
+}
+
+// newest and oldest segment of the unbroken sequence ending at the newest one
+static bool traceSegments(const traceIoDef* io, uint32_t* newest, uint32_t* oldest) {
+    bool found = false;
+    uint32_t seq;
+    for (uint16_t i = 0; i < io->segments; i++)
+        if (segmentSeq(io, i, &seq) && (!found || seq > *newest)) {
+            *newest = seq;
+            found = true;
+        }
+    if (!found)
+        return false;
+    *oldest = *newest;
+    while (*oldest > 1 && *newest - (*oldest - 1) < io->segments
+            && segmentSeq(io, (*oldest - 1) % io->segments, &seq) && seq == *oldest - 1)
+        (*oldest)--;
+    return true;
+}
+
+// offset of the first free header in a segment. Headers are followed from block to
+// block, one that makes no sense closes the segment
+static uint16_t segmentEnd(const traceIoDef* io, uint32_t seq) {
+    uint32_t offset = sizeof(traceSegmentDef);
+    while (offset + sizeof(traceBlockDef) <= TRACE_SEGMENT_SIZE) {
+        traceBlockDef header;
+        if (!io->read(segmentOffset(io, seq) + offset, &header, sizeof(header)))
+            return TRACE_SEGMENT_SIZE;
+        if (header.length == BLOCK_FREE)
+            break;
+        if (header.length > TRACE_BUFFER_SIZE || offset + blockSize(header.length) > TRACE_SEGMENT_SIZE)
+            return TRACE_SEGMENT_SIZE;
+        offset += blockSize(header.length);
+    }
+    return offset;
+}
+
+static bool segmentOpen(const traceIoDef* io, uint32_t seq) {
+    traceSegmentDef header = { TRACE_MAGIC, seq };
+    return io->erase(segmentOffset(io, seq)) && io->write(segmentOffset(io, seq), &header, sizeof(header));
+}
+
+bool traceWrite(traceBufferDef* trace, const traceIoDef* io, uint32_t clock, uint8_t flags) {
+    uint16_t length = trace->header.length;
+    size_t size = blockSize(length);
+    memset(trace->records + length, 0, size - sizeof(traceBlockDef) - length);
+    trace->header.clock = clock;
+    trace->header.flags = flags;
+    trace->header.crc = blockCrc((const uint8_t*)&trace->header, length);
+
+    uint32_t seq, oldest;
+    uint32_t offset = TRACE_SEGMENT_SIZE;
+    if (traceSegments(io, &seq, &oldest))
+        offset = segmentEnd(io, seq);
+    else
+        seq = 0;
+    bool ok = true;
+    if (offset + size > TRACE_SEGMENT_SIZE) {
+        seq++;
+        offset = sizeof(traceSegmentDef);
+        ok = segmentOpen(io, seq);
+    }
+    ok = ok && io->write(segmentOffset(io, seq) + offset, &trace->header, size);
+    traceReset(trace);
+    return ok;
+}
+
+bool traceFirst(traceCursorDef* cursor, const traceIoDef* io) {
+    memset(cursor, 0, sizeof(traceCursorDef));
+    if (!traceSegments(io, &cursor->newest, &cursor->seq))
+        return false;
+    cursor->offset = sizeof(traceSegmentDef);
+    return true;
+}
+
+size_t traceNext(traceCursorDef* cursor, const traceIoDef* io, uint8_t* block) {
+    traceBlockDef* header = (traceBlockDef*)block;
+    while (cursor->seq && cursor->seq <= cursor->newest) {
+        uint32_t offset = cursor->offset;
+        if (offset + sizeof(traceBlockDef) > TRACE_SEGMENT_SIZE
+                || !io->read(segmentOffset(io, cursor->seq) + offset, header, sizeof(traceBlockDef))
+                || header->length > TRACE_BUFFER_SIZE || offset + blockSize(header->length) > TRACE_SEGMENT_SIZE) {
+            cursor->seq++;
+            cursor->offset = sizeof(traceSegmentDef);
+            continue;
+        }
+        size_t size = blockSize(header->length);
+        cursor->offset += size;
+        //records cut short by a reset are skipped
+        if (io->read(segmentOffset(io, cursor->seq) + offset + sizeof(traceBlockDef), block + sizeof(traceBlockDef),
+                size - sizeof(traceBlockDef)) && header->crc == blockCrc(block, header->length))
+            return size;
+    }
+    return 0;
+}
+
+size_t traceBase64(const uint8_t* data, size_t length, char* text, size_t size) {
+    size_t n = (length + 2) / 3 * 4;
+    if (n + 1 > size)
+        return 0;
+    char* out = text;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < length)
+            v |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < length)
+            v |= data[i + 2];
+        *out++ = base64Chars[(v >> 18) & 0x3F];
+        *out++ = base64Chars[(v >> 12) & 0x3F];
+        *out++ = i + 1 < length ? base64Chars[(v >> 6) & 0x3F] : '=';
+        *out++ = i + 2 < length ? base64Chars[v & 0x3F] : '=';
+    }
+    *out = 0;
+    return n;
+}
+
+size_t traceBlockSize(const uint8_t* data, size_t length) {
+    traceBlockDef header;
+    if (length < sizeof(header))
+        return 0;
+    memcpy(&header, data, sizeof(header));
+    if (header.length > TRACE_BUFFER_SIZE || blockSize(header.length) > length
+            || header.crc != blockCrc(data, header.length))
+        return 0;
+    return blockSize(header.length);
+}
+
+static bool getVarint(const uint8_t* data, size_t end, size_t* pos, uint32_t* value) {
+    *value = 0;
+    for (uint8_t shift = 0; shift < 35 && *pos < end; shift += 7) {
+        uint8_t b = data[(*pos)++];
+        *value |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool traceRecord(const uint8_t* block, size_t* pos, traceRecordDef* record) {
+    traceBlockDef header;
+    memcpy(&header, block, sizeof(header));
+    size_t end = sizeof(header) + header.length;
+    if (*pos < sizeof(header))
+        *pos = sizeof(header);
+    if (*pos >= end)
+        return false;
+
+    uint8_t b = block[(*pos)++];
+    record->event = b & EVENT_MASK;
+    record->argc = b >> ARGC_SHIFT;
+    uint32_t v;
+    if (!getVarint(block, end, pos, &v))
+        return false;
+    record->ms += v;
+    for (uint8_t i = 0; i < record->argc; i++) {
+        if (!getVarint(block, end, pos, &v))
+            return false;
+        record->args[i] = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+    }
+    return true;
+}
+
+size_t traceUnbase64(const char* text, uint8_t* data, size_t size) {
+    size_t n = 0;
+    uint32_t v = 0;
+    uint8_t bits = 0;
+    for (; *text; text++) {
+        const char* c = strchr(base64Chars, *text);
+        if (!c)
+            break;
+        v = (v << 6) | (c - base64Chars);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (n >= size)
+                break;
+            data[n++] = v >> bits;
+        }
+    }
+    return n;
+}
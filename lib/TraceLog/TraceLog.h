@@ -0,0 +1,102 @@
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary event trace. Records are collected in a RAM buffer during the wake and
+// appended to a ring of flash sectors as one block before going to sleep, so the
+// cost of an event is a few bytes of encoding. Events are IDs into a table of
+// format strings the device never has to store, the host decoder prints them.
+// Flash access goes through traceIoDef, so the log does not depend on the SDK.
+//
+// Varints are LEB128, signed values zigzag encoded (see PackedPayload.h).
+//
+//   segment: traceSegmentDef, then blocks until the first free (0xFF) header
+//   block:   traceBlockDef, then length bytes of records, padded to 4 bytes
+//   record:  u8      argument count (bits 6..7) and event ID (bits 0..5)
+//            varint  ms since the record before, the first one since boot
+//            svarint arguments
+
+#define TRACE_SEGMENT_SIZE      4096
+#define TRACE_MAGIC             0x31544D54UL        // "TMT1"
+#define TRACE_BUFFER_SIZE       240                 // record bytes per wake
+#define TRACE_EVENTS_MAX        64
+#define TRACE_ARGS_MAX          3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} traceSegmentDef;
+
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below and the records
+    uint32_t clock;             // device clock of the wake, seconds
+    uint16_t length;            // record bytes. 0xFFFF - free, end of the segment
+    uint8_t lost;               // records that did not fit in the buffer
+    uint8_t flags;              // caller's, e.g. reset reason
+} traceBlockDef;
+
+// largest block, header included
+#define TRACE_BLOCK_MAX         (sizeof(traceBlockDef) + TRACE_BUFFER_SIZE)
+
+typedef struct {
+    // offsets and sizes are multiples of 4
+    bool (*read)(uint32_t offset, void* data, size_t size);
+    bool (*write)(uint32_t offset, const void* data, size_t size);
+    bool (*erase)(uint32_t offset);
+    uint32_t begin;             // flash offset of the first segment
+    uint16_t segments;          // at least 2
+} traceIoDef;
+
+// block in the making. Records follow the header, so it is written in one go
+typedef struct {
+    traceBlockDef header;
+    uint8_t records[TRACE_BUFFER_SIZE];
+    uint32_t lastMs;
+} traceBufferDef __attribute__ ((aligned(4)));
+
+// a zeroed buffer is empty as well
+void traceReset(traceBufferDef* trace);
+// ms is the time since boot. A record that does not fit is counted as lost
+void traceAdd(traceBufferDef* trace, uint8_t event, uint32_t ms, uint8_t argc, const int32_t* args);
+// append the buffer as a block. When the newest segment is full the oldest one is
+// erased and reused. The buffer is reset
+bool traceWrite(traceBufferDef* trace, const traceIoDef* io, uint32_t clock, uint8_t flags);
+
+// blocks in flash, oldest first
+typedef struct {
+    uint32_t seq;               // segment
+    uint32_t newest;
+    uint16_t offset;            // next block in the segment
+} traceCursorDef;
+
+// false - nothing has been written yet
+bool traceFirst(traceCursorDef* cursor, const traceIoDef* io);
+// copy the next valid block to block (TRACE_BLOCK_MAX bytes). Returns its size,
+// 0 at the end of the log
+size_t traceNext(traceCursorDef* cursor, const traceIoDef* io, uint8_t* block);
+
+// base64 for the shadow document. Returns the length without the terminator, 0 if
+// the text does not fit in size
+size_t traceBase64(const uint8_t* data, size_t length, char* text, size_t size);
+
+// decoder, host side
+
+typedef struct {
+    uint8_t event;
+    uint8_t argc;
+    uint32_t ms;                // since boot
+    int32_t args[TRACE_ARGS_MAX];
+} traceRecordDef;
+
+// size of the block at data (header, records and padding), 0 if it is cut short
+// or fails the CRC
+size_t traceBlockSize(const uint8_t* data, size_t length);
+// record at *pos of a valid block, *pos is moved past it. record->ms carries on
+// from the record before, zero it before the first one
+bool traceRecord(const uint8_t* block, size_t* pos, traceRecordDef* record);
+// bytes decoded, stops at the first character that is not base64
+size_t traceUnbase64(const char* text, uint8_t* data, size_t size);
+
+#endif
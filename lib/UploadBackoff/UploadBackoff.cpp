@@ -0,0 +1,61 @@
+#include "UploadBackoff.h"
+#include <string.h>
+#include <Crc32.h>
+
+static uint32_t backoffCrc(const backoffDef* backoff) {
+    return crc32((const uint8_t*)backoff + sizeof(backoff->crc), sizeof(backoffDef) - sizeof(backoff->crc));
+}
+
+void backoffReset(backoffDef* backoff) {
+    memset(backoff, 0, sizeof(backoffDef));
+    backoffSeal(backoff);
+}
+
+bool backoffValid(const backoffDef* backoff) {
+    return backoff->crc == backoffCrc(backoff);
+}
+
+void backoffSeal(backoffDef* backoff) {
+    backoff->crc = backoffCrc(backoff);
+}
+
+void backoffUpdate(backoffDef* backoff, bool success, int8_t rssi, int8_t weakRssi, uint16_t maxHold) {
+    if (rssi != 0) {
+        memmove(backoff->rssi + 1, backoff->rssi, sizeof(backoff->rssi) - 1);
+        backoff->rssi[0] = rssi;
+    }
+
+    if (success) {
+        backoff->failures = 0;
+        backoff->hold = 0;
+        return;
+    }
+
+    if (backoff->failures < UINT16_MAX)
+        backoff->failures++;
+    //first failure is retried right away, then 1, 3, 7, ... wakes are skipped
+    int steps = backoff->failures - 1;
+    int8_t mean = backoffRssi(backoff);
+    if (mean != 0 && mean < weakRssi)
+        steps++;
+    uint32_t hold = steps < 16 ? (1UL << steps) - 1 : UINT16_MAX;
+    backoff->hold = hold < maxHold ? hold : maxHold;
+}
+
+bool backoffHold(backoffDef* backoff) {
+    if (backoff->hold == 0)
+        return false;
+    backoff->hold--;
+    return true;
+}
+
+int8_t backoffRssi(const backoffDef* backoff) {
+    int sum = 0, n = 0;
+    for (int i = 0; i < BACKOFF_RSSI_HISTORY; i++) {
+        if (backoff->rssi[i] != 0) {
+            sum += backoff->rssi[i];
+            n++;
+        }
+    }
+    return n ? sum / n : 0;
+}
@@ -0,0 +1,35 @@
+#ifndef UPLOAD_BACKOFF_H
+#define UPLOAD_BACKOFF_H
+
+#include <stdint.h>
+
+// Upload attempt scheduler. Consecutive failed uploads hold off the next attempt
+// for an exponentially growing number of wakes (readings are still taken), a
+// success snaps back to normal. On a weak link the hold grows one step faster.
+// Plain struct protected by a CRC so it can be kept in RTC memory. No Arduino
+// dependencies, the logic runs on the host as is.
+
+#define BACKOFF_RSSI_HISTORY    8
+
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below
+    uint16_t failures;          // consecutive failed upload attempts
+    uint16_t hold;              // wakes left before the next upload attempt
+    int8_t rssi[BACKOFF_RSSI_HISTORY];  // dBm of the last connects, newest first. 0 - no value
+} backoffDef __attribute__ ((aligned(4)));
+
+void backoffReset(backoffDef* backoff);
+bool backoffValid(const backoffDef* backoff);
+// recalculate CRC. Call before writing the state back to RTC memory
+void backoffSeal(backoffDef* backoff);
+
+// result of an upload attempt. rssi in dBm, 0 if the AP was not reached
+// holds are capped at maxHold wakes. A mean RSSI below weakRssi counts as weak link
+void backoffUpdate(backoffDef* backoff, bool success, int8_t rssi, int8_t weakRssi, uint16_t maxHold);
+// call once per wake before scheduling the next one. True while the next wake 
+// should not attempt an upload
+bool backoffHold(backoffDef* backoff);
+// mean RSSI over the history, 0 if there is none
+int8_t backoffRssi(const backoffDef* backoff);
+
+#endif
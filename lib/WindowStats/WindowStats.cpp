@@ -0,0 +1,96 @@
+#include "WindowStats.h"
+#include <string.h>
+#include <Crc32.h>
+
+static uint32_t windowCrc(const windowDef* window) {
+    return crc32((const uint8_t*)window + sizeof(window->crc), sizeof(windowDef) - sizeof(window->crc));
+}
+
+// a / b rounded to nearest, halves away from zero
+static int32_t divRound(int32_t a, int32_t b) {
+    return (a >= 0 ? a + b / 2 : a - b / 2) / b;
+}
+
+void windowReset(windowDef* window) {
+    memset(window, 0, sizeof(windowDef));
+    windowSeal(window);
+}
+
+bool windowValid(const windowDef* window) {
+    return window->crc == windowCrc(window);
+}
+
+void windowSeal(windowDef* window) {
+    window->crc = windowCrc(window);
+}
+
+// Welford: mean += (x - mean) / n, m2 += (x - old mean) * (x - new mean)
+// both factors have the same sign, the product never goes negative
+void windowAdd(windowDef* window, uint8_t series, int16_t x) {
+    if (series >= WINDOW_SERIES || window->count[series] == UINT16_MAX)
+        return;
+
+    windowStatDef* stat = &window->stat[series];
+    int32_t xq = (int32_t)x << WINDOW_MEAN_SHIFT;
+    uint16_t n = ++window->count[series];
+    if (n == 1) {
+        stat->mean = xq;
+        stat->m2 = 0;
+        stat->min = x;
+        stat->max = x;
+        return;
+    }
+    if (x < stat->min)
+        stat->min = x;
+    if (x > stat->max)
+        stat->max = x;
+
+    int32_t delta = xq - stat->mean;
+    stat->mean += divRound(delta, n);
+    uint64_t m2 = stat->m2 + (((uint64_t)((int64_t)delta * (xq - stat->mean)) + (1 << (2 * WINDOW_MEAN_SHIFT - 1))) >> (2 * WINDOW_MEAN_SHIFT));
+    stat->m2 = m2 > UINT32_MAX ? UINT32_MAX : m2;
+}
+
+uint16_t windowSamples(const windowDef* window) {
+    uint16_t n = 0;
+    for (uint8_t i = 0; i < WINDOW_SERIES; i++)
+        if (window->count[i] > n)
+            n = window->count[i];
+    return n;
+}
+
+int16_t windowMean(const windowDef* window, uint8_t series) {
+    if (series >= WINDOW_SERIES || window->count[series] == 0)
+        return 0;
+    return divRound(window->stat[series].mean, 1 << WINDOW_MEAN_SHIFT);
+}
+
+uint32_t windowVariance(const windowDef* window, uint8_t series) {
+    if (series >= WINDOW_SERIES || window->count[series] < 2)
+        return 0;
+    uint32_t n = window->count[series] - 1;
+    //m2 may be saturated, the rounding must not wrap it around
+    return ((uint64_t)window->stat[series].m2 + n / 2) / n;
+}
+
+uint16_t windowStddev(const windowDef* window, uint8_t series) {
+    uint32_t v = windowVariance(window, series);
+    //integer square root, bit by bit
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > v)
+        bit >>= 2;
+    while (bit) {
+        if (v >= root + bit) {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+            root >>= 1;
+        bit >>= 2;
+    }
+    //v is now the remainder, round to nearest
+    if (v > root)
+        root++;
+    return root;
+}
@@ -0,0 +1,43 @@
+#ifndef WINDOW_STATS_H
+#define WINDOW_STATS_H
+
+#include <stdint.h>
+
+// Running min/max/mean/variance of the samples of an aggregation window, one set
+// per series (sensor). Welford's update in fixed point: the mean keeps 8 fraction
+// bits, the sum of squared deviations is in sample units squared. Plain struct
+// protected by a CRC so it can be kept in RTC memory. No Arduino dependencies,
+// the maths runs on the host as is.
+
+#define WINDOW_SERIES           4
+#define WINDOW_MEAN_SHIFT       8       // fraction bits of the running mean
+
+typedef struct {
+    int32_t mean;               // running mean, sample units << WINDOW_MEAN_SHIFT
+    uint32_t m2;                // sum of squared deviations from the mean, saturated
+    int16_t min;
+    int16_t max;
+} windowStatDef;
+
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below
+    uint16_t count[WINDOW_SERIES];      // samples in the window, per series
+    windowStatDef stat[WINDOW_SERIES];
+} windowDef __attribute__ ((aligned(4)));
+
+void windowReset(windowDef* window);
+bool windowValid(const windowDef* window);
+// recalculate CRC. Call before writing the window back to RTC memory
+void windowSeal(windowDef* window);
+
+void windowAdd(windowDef* window, uint8_t series, int16_t x);
+// most samples over all series, 0 - window is empty
+uint16_t windowSamples(const windowDef* window);
+// in sample units, rounded. 0 if the series has no samples
+int16_t windowMean(const windowDef* window, uint8_t series);
+// sample variance (n - 1) in sample units squared, 0 below two samples
+uint32_t windowVariance(const windowDef* window, uint8_t series);
+// square root of the variance in sample units, rounded
+uint16_t windowStddev(const windowDef* window, uint8_t series);
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+// Arduino / ESP8266 core stand-in for the native simulation
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "pgmspace.h"
+#include "WString.h"
+#include "Sim.h"
+
+using std::min;
+using std::max;
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x00
+#define OUTPUT 0x01
+
+#define DEC 10
+#define HEX 16
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+#define ADC_VCC 0
+#define ADC_MODE(mode)
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+class Stream {
+    public:
+        virtual ~Stream() {}
+        virtual int available() = 0;
+        virtual int read() = 0;
+};
+
+class HardwareSerial {
+    public:
+        void begin(unsigned long baud) {}
+        void setDebugOutput(bool en) {}
+        size_t print(const char* s);
+        size_t print(const String& s) { return print(s.c_str()); }
+        size_t print(int n, int base = DEC);
+        size_t println(const char* s = "");
+        size_t println(const String& s) { return println(s.c_str()); }
+        size_t printf(const char* fmt, ...) __attribute__ ((format (printf, 2, 3)));
+        size_t printf_P(PGM_P fmt, ...);
+        size_t write(const uint8_t* buf, size_t size);
+        size_t write(uint8_t c) { return write(&c, 1); }
+        void flush() {}
+};
+extern HardwareSerial Serial;
+
+struct rst_info {
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t epc2;
+    uint32_t epc3;
+    uint32_t excvaddr;
+    uint32_t depc;
+};
+
+enum rst_reason {
+    REASON_DEFAULT_RST = 0,
+    REASON_WDT_RST = 1,
+    REASON_EXCEPTION_RST = 2,
+    REASON_SOFT_WDT_RST = 3,
+    REASON_SOFT_RESTART = 4,
+    REASON_DEEP_SLEEP_AWAKE = 5,
+    REASON_EXT_SYS_RST = 6
+};
+
+enum RFMode {
+    RF_DEFAULT = 0,
+    RF_CAL = 1,
+    RF_NO_CAL = 2,
+    RF_DISABLED = 4
+};
+#define WAKE_RF_DEFAULT  RF_DEFAULT
+#define WAKE_RFCAL       RF_CAL
+#define WAKE_NO_RFCAL    RF_NO_CAL
+#define WAKE_RF_DISABLED RF_DISABLED
+
+class EspClass {
+    public:
+        rst_info* getResetInfoPtr();
+        uint32_t getChipId();
+        uint32_t getFlashChipRealSize() { return SIM_FLASH_SIZE; }
+        uint32_t getFlashChipSize() { return SIM_FLASH_SIZE; }
+        bool flashEraseSector(uint32_t sector);
+        bool flashWrite(uint32_t offset, uint32_t* data, size_t size);
+        bool flashRead(uint32_t offset, uint32_t* data, size_t size);
+        uint16_t getVcc();
+        uint32_t getFreeHeap();
+        uint32_t getCycleCount();
+        void deepSleep(uint64_t time_us, RFMode mode = RF_DEFAULT);
+        uint64_t deepSleepMax();
+        void restart();
+};
+extern EspClass ESP;
+
+#endif
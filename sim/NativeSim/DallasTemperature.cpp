@@ -0,0 +1,97 @@
+#include <DallasTemperature.h>
+
+static uint8_t sensorCount() {
+    return (uint8_t)simConfig.sensors;
+}
+
+static void sensorRom(uint8_t index, uint8_t* rom) {
+    const uint8_t serial[7] = { 0x28, 0xFF, 0x4C, 0x6A, 0x70, 0x16, (uint8_t)(0x30 + index) };
+    memcpy(rom, serial, sizeof(serial));
+    rom[7] = OneWire::crc8(rom, 7);
+}
+
+// index of the sensor answering to this ROM, -1 if none does
+static int sensorIndex(const uint8_t* deviceAddress) {
+    for (uint8_t i = 0; i < sensorCount(); i++) {
+        uint8_t rom[8];
+        sensorRom(i, rom);
+        if (memcmp(rom, deviceAddress, sizeof(rom)) == 0)
+            return i;
+    }
+    return -1;
+}
+
+//full search, one pass per device
+void DallasTemperature::begin() {
+    simAdvance(simConfig.sensorSearchMs * (sensorCount() ? sensorCount() : 1));
+}
+
+uint8_t DallasTemperature::getDeviceCount() {
+    return sensorCount();
+}
+
+bool DallasTemperature::getAddress(uint8_t* deviceAddress, uint8_t index) {
+    //ROM search restarts from the beginning of the bus
+    simAdvance(simConfig.sensorSearchMs * (index + 1));
+    if (index >= sensorCount())
+        return false;
+    sensorRom(index, deviceAddress);
+    return true;
+}
+
+bool DallasTemperature::setResolution(const uint8_t* deviceAddress, uint8_t newResolution, bool skipGlobalBitResolutionCalculation) {
+    //scratchpad is copied to sensor EEPROM
+    simAdvance(simConfig.sensorEepromMs);
+    _resolution = newResolution;
+    return true;
+}
+
+int16_t DallasTemperature::millisToWaitForConversion(uint8_t bitResolution) {
+    switch (bitResolution) {
+        case 9: return 94;
+        case 10: return 188;
+        case 11: return 375;
+        default: return 750;
+    }
+}
+
+void DallasTemperature::requestTemperatures() {
+    simAdvance(1);
+    _conversionStartUs = sim->nowUs;
+    if (_wait)
+        delay(millisToWaitForConversion(_resolution));
+
+    //the room follows a random walk from wake to wake, a streaming wake takes one step
+    static bool stepped;
+    if (stepped)
+        return;
+    stepped = true;
+    double u = simUniform() + simUniform() + simUniform() - 1.5;
+    sim->temperature += 2 * u * simConfig.tempDrift;
+}
+
+bool DallasTemperature::requestTemperaturesByAddress(const uint8_t* deviceAddress) {
+    requestTemperatures();
+    return true;
+}
+
+bool DallasTemperature::isConversionComplete() {
+    return sim->nowUs - _conversionStartUs >= (uint64_t)millisToWaitForConversion(_resolution) * 1000;
+}
+
+float DallasTemperature::getTempC(const uint8_t* deviceAddress) {
+    simAdvance(simConfig.sensorReadMs);
+    int index = sensorIndex(deviceAddress);
+    if (index < 0)
+        return DEVICE_DISCONNECTED_C;
+    //quantized to sensor resolution
+    float step = 1.0 / (1 << (_resolution - 8));
+    return round((sim->temperature + index) / step) * step;
+}
+
+float DallasTemperature::getTempCByIndex(uint8_t index) {
+    DeviceAddress deviceAddress;
+    if (!getAddress(deviceAddress, index))
+        return DEVICE_DISCONNECTED_C;
+    return getTempC(deviceAddress);
+}
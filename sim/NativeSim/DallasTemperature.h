@@ -0,0 +1,36 @@
+#ifndef SIM_DALLASTEMPERATURE_H
+#define SIM_DALLASTEMPERATURE_H
+
+#include <OneWire.h>
+
+// DallasTemperature 3.7 stand-in: simConfig.sensors DS18B20 on the bus. Temperature
+// follows a random walk kept in the simulation state, sensor i reads i deg C higher
+
+typedef uint8_t DeviceAddress[8];
+
+#define DEVICE_DISCONNECTED_C -127
+
+class DallasTemperature {
+    public:
+        DallasTemperature(OneWire* wire) {}
+        void begin();
+        uint8_t getDeviceCount();
+        bool getAddress(uint8_t* deviceAddress, uint8_t index);
+        uint8_t getResolution() { return _resolution; }
+        void setResolution(uint8_t newResolution) { _resolution = newResolution; }
+        bool setResolution(const uint8_t* deviceAddress, uint8_t newResolution, bool skipGlobalBitResolutionCalculation = false);
+        void setWaitForConversion(bool wait) { _wait = wait; }
+        bool getWaitForConversion() { return _wait; }
+        void requestTemperatures();
+        bool requestTemperaturesByAddress(const uint8_t* deviceAddress);
+        bool isConversionComplete();
+        int16_t millisToWaitForConversion(uint8_t bitResolution);
+        float getTempC(const uint8_t* deviceAddress);
+        float getTempCByIndex(uint8_t index);
+    private:
+        uint8_t _resolution = 9;
+        bool _wait = true;
+        uint64_t _conversionStartUs = 0;
+};
+
+#endif
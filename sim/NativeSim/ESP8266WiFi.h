@@ -0,0 +1,143 @@
+#ifndef SIM_ESP8266WIFI_H
+#define SIM_ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <functional>
+#include <memory>
+
+// WiFi station and TLS client stand-ins. Association and handshakes only 
+// advance the virtual clock; outcomes are drawn from the simulation config
+
+class IPAddress {
+    public:
+        IPAddress() : _a(0) {}
+        IPAddress(uint32_t a) : _a(a) {}
+        IPAddress(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) : _a(b0 | b1 << 8 | b2 << 16 | (uint32_t)b3 << 24) {}
+        operator uint32_t() const { return _a; }
+    private:
+        uint32_t _a;
+};
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2,
+    WIFI_AP_STA = 3
+} WiFiMode_t;
+
+typedef enum {
+    WIFI_NONE_SLEEP = 0,
+    WIFI_LIGHT_SLEEP = 1,
+    WIFI_MODEM_SLEEP = 2
+} WiFiSleepType_t;
+
+struct WiFiEventStationModeGotIP {
+    IPAddress ip;
+    IPAddress mask;
+    IPAddress gw;
+};
+
+struct WiFiEventHandlerOpaque {
+    std::function<void(const WiFiEventStationModeGotIP&)> onGotIP;
+};
+typedef std::shared_ptr<WiFiEventHandlerOpaque> WiFiEventHandler;
+
+class ESP8266WiFiClass {
+    public:
+        wl_status_t begin();
+        wl_status_t begin(const char* ssid, const char* passphrase = NULL, int32_t channel = 0, const uint8_t* bssid = NULL, bool connect = true);
+        bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1 = (uint32_t)0, IPAddress dns2 = (uint32_t)0);
+        bool disconnect(bool wifioff = false);
+        bool isConnected();
+        wl_status_t status();
+        int32_t RSSI();
+        String SSID() const { return String("TempMonSim"); }
+        String psk() const { return String("secret"); }
+        uint8_t* BSSID();
+        int32_t channel();
+        IPAddress localIP();
+        IPAddress gatewayIP();
+        IPAddress subnetMask();
+        IPAddress dnsIP(uint8_t dns_no = 0);
+        bool mode(WiFiMode_t m) { return true; }
+        void persistent(bool persistent) {}
+        bool setAutoConnect(bool autoConnect) { return true; }
+        bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0);
+        bool forceSleepBegin(uint32_t sleepUs = 0) { return true; }
+        bool forceSleepWake() { return true; }
+        WiFiEventHandler onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)> f);
+};
+extern ESP8266WiFiClass WiFi;
+
+class Client : public Stream {
+    public:
+        virtual int connect(IPAddress ip, uint16_t port) = 0;
+        virtual int connect(const char* host, uint16_t port) = 0;
+        virtual size_t write(uint8_t b) = 0;
+        virtual size_t write(const uint8_t* buf, size_t size) = 0;
+        virtual int read(uint8_t* buf, size_t size) = 0;
+        virtual int read() = 0;
+        virtual int available() = 0;
+        virtual int peek() = 0;
+        virtual void flush() {}
+        virtual void stop() = 0;
+        virtual uint8_t connected() = 0;
+        virtual operator bool() = 0;
+};
+
+namespace BearSSL {
+
+// same layout as br_ssl_session_parameters, so RTC memory layout matches the device
+class Session {
+    public:
+        Session() { memset(this, 0, sizeof(*this)); }
+    private:
+        friend class WiFiClientSecure;
+        uint8_t _session_id[32];
+        uint8_t _session_id_len;
+        uint16_t _version;
+        uint16_t _cipher_suite;
+        uint8_t _master_secret[48];
+};
+
+// bytes written go to the broker stand-in (simSocketWrite), its answers are read back
+// once the virtual clock has reached their arrival
+class WiFiClientSecure : public Client {
+    public:
+        int connect(IPAddress ip, uint16_t port) override { return connect("", port); }
+        int connect(const char* host, uint16_t port) override;
+        size_t write(uint8_t b) override { return write(&b, 1); }
+        size_t write(const uint8_t* buf, size_t size) override;
+        int read(uint8_t* buf, size_t size) override;
+        int read() override;
+        int available() override;
+        int peek() override;
+        void stop() override;
+        uint8_t connected() override { return _connected; }
+        operator bool() override { return _connected; }
+        void setInsecure() {}
+        void setSession(Session* session) { _session = session; }
+        void setBufferSizes(int recv, int xmit) {}
+        bool setCertificate(const uint8_t* cert, size_t size) { simAdvance(simConfig.certMs); return true; }
+        bool setPrivateKey(const uint8_t* key, size_t size) { simAdvance(simConfig.certMs); return true; }
+        bool setCertificate_P(PGM_VOID_P cert, size_t size) { return setCertificate((const uint8_t*)cert, size); }
+        bool setPrivateKey_P(PGM_VOID_P key, size_t size) { return setPrivateKey((const uint8_t*)key, size); }
+        bool loadCertificate(File& file) { simAdvance(simConfig.certMs); return file.size() > 0; }
+        bool loadPrivateKey(File& file) { simAdvance(simConfig.certMs); return file.size() > 0; }
+    private:
+        Session* _session = NULL;
+        bool _connected = false;
+};
+
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <Ticker.h>
+extern "C" {
+    #include <user_interface.h>
+    #include <spi_flash.h>
+}
+
+// virtual clock, core functions and SDK RTC memory
+
+HardwareSerial Serial;
+EspClass ESP;
+
+unsigned long millis() {
+    return sim->nowUs / 1000;
+}
+
+unsigned long micros() {
+    return sim->nowUs;
+}
+
+void delay(unsigned long ms) {
+    if (sim->lightSleep)
+        sim->lightSleepUs += (uint64_t)ms * 1000;
+    simClockAdvance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    simClockAdvance(us);
+}
+
+//a busy loop around yield() still takes time
+void yield() {
+    simClockAdvance(1000);
+}
+
+static uint8_t pins[17];
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin < sizeof(pins))
+        pins[pin] = val;
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < sizeof(pins) ? pins[pin] : LOW;
+}
+
+size_t HardwareSerial::print(const char* s) {
+    if (simVerbose)
+        fputs(s, stdout);
+    return strlen(s);
+}
+
+size_t HardwareSerial::print(int n, int base) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), base == HEX ? "%X" : "%d", n);
+    return print(buf);
+}
+
+size_t HardwareSerial::println(const char* s) {
+    size_t n = print(s);
+    return n + print("\n");
+}
+
+size_t HardwareSerial::printf(const char* fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    return print(buf);
+}
+
+size_t HardwareSerial::printf_P(PGM_P fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    return print(buf);
+}
+
+size_t HardwareSerial::write(const uint8_t* buf, size_t size) {
+    if (simVerbose)
+        fwrite(buf, 1, size, stdout);
+    return size;
+}
+
+rst_info* EspClass::getResetInfoPtr() {
+    static rst_info info;
+    info.reason = sim->resetReason;
+    return &info;
+}
+
+uint32_t EspClass::getChipId() {
+    return sim->chipId;
+}
+
+uint16_t EspClass::getVcc() {
+    return 3100 + simRandom() % 50;
+}
+
+// NOR flash: erase sets a sector to 0xFF, writes can only clear bits
+// offset and size must be 4 byte aligned, like with the SDK
+bool EspClass::flashEraseSector(uint32_t sector) {
+    if ((sector + 1) * SPI_FLASH_SEC_SIZE > SIM_FLASH_SIZE)
+        return false;
+    memset(sim->flash + sector * SPI_FLASH_SEC_SIZE, 0xFF, SPI_FLASH_SEC_SIZE);
+    simAdvance(simConfig.flashEraseMs);
+    sim->flashErases++;
+    return true;
+}
+
+bool EspClass::flashWrite(uint32_t offset, uint32_t* data, size_t size) {
+    if ((offset & 3) || (size & 3) || offset + size > SIM_FLASH_SIZE)
+        return false;
+    const uint8_t* src = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
+        sim->flash[offset + i] &= src[i];
+    simAdvance(simConfig.flashWriteMs * ((size + 255) / 256));
+    return true;
+}
+
+bool EspClass::flashRead(uint32_t offset, uint32_t* data, size_t size) {
+    if ((offset & 3) || (size & 3) || offset + size > SIM_FLASH_SIZE)
+        return false;
+    memcpy(data, sim->flash + offset, size);
+    simAdvance(simConfig.flashReadMs * size / 1024);
+    return true;
+}
+
+uint32_t EspClass::getFreeHeap() {
+    return SIM_HEAP_SIZE - sim->heapUsed;
+}
+
+uint32_t EspClass::getCycleCount() {
+    return (uint32_t)(sim->nowUs * 80);
+}
+
+//same as the core: the SDK request is followed by esp_yield(), which panics in timer context
+void EspClass::deepSleep(uint64_t time_us, RFMode mode) {
+    if (simInTimer) {
+        fprintf(stderr, "ESP.deepSleep() called from a timer callback\n");
+        fflush(stdout);
+        _exit(3);
+    }
+    system_deep_sleep_set_option(mode);
+    system_deep_sleep(time_us);
+}
+
+//same as the core: the longest sleep the RTC timer can count
+uint64_t EspClass::deepSleepMax() {
+    return (uint64_t)system_rtc_clock_cali_proc() * (0x80000000 - 1) / 0x1000;
+}
+
+static int deepSleepOption;
+
+bool system_deep_sleep_set_option(uint8_t option) {
+    deepSleepOption = option;
+    return true;
+}
+
+//the chip goes down as soon as the running task gives control back to the SDK
+//which is modelled as right away
+bool system_deep_sleep(uint64_t time_in_us) {
+    //the SDK takes it, but the timer wraps around and the chip wakes at some other time
+    if (time_in_us > ESP.deepSleepMax()) {
+        fprintf(stderr, "deep sleep of %llu us is longer than the RTC timer can count\n", (unsigned long long)time_in_us);
+        fflush(stdout);
+        _exit(3);
+    }
+    sim->slept = true;
+    sim->sleepUs = time_in_us;
+    sim->sleepMode = deepSleepOption;
+    sim->timerSleep = simTimerFired;
+    fflush(stdout);
+    //the chip is off now - nothing after this point runs on real HW
+    _exit(0);
+}
+
+void EspClass::restart() {
+    fflush(stdout);
+    _exit(0);
+}
+
+//user RTC memory: blocks 64..191. SDK rejects anything outside
+bool system_rtc_mem_read(uint8_t src_addr, void* des_addr, uint16_t load_size) {
+    if (src_addr < 64 || src_addr * 4 + load_size > SIM_RTC_SIZE)
+        return false;
+    memcpy(des_addr, &sim->rtcMem[src_addr * 4], load_size);
+    return true;
+}
+
+bool system_rtc_mem_write(uint8_t des_addr, const void* src_addr, uint16_t save_size) {
+    if (des_addr < 64 || des_addr * 4 + save_size > SIM_RTC_SIZE)
+        return false;
+    memcpy(&sim->rtcMem[des_addr * 4], src_addr, save_size);
+    return true;
+}
+
+//RTC timer ticks at ~5.75 us per tick. Starts from zero on every reset, deep sleep 
+//wake included, so it counts the boot time as well
+uint32_t system_get_rtc_time(void) {
+    return (uint32_t)(sim->nowUs * 4 / 23);
+}
+
+uint32_t system_rtc_clock_cali_proc(void) {
+    return (uint32_t)(5.75 * (1 << 12));
+}
@@ -0,0 +1,64 @@
+#include <FS.h>
+
+FS SPIFFS;
+
+static const struct {
+    const char* name;
+    size_t size;
+} files[] = {
+    { "/cert.der", 862 },
+    { "/private.der", 1192 },
+};
+#define FILE_COUNT (sizeof(files) / sizeof(files[0]))
+
+size_t File::read(uint8_t* buf, size_t size) {
+    size_t n = 0;
+    while (n < size && available())
+        buf[n++] = read();
+    return n;
+}
+
+bool Dir::next() {
+    return ++_i < (int)FILE_COUNT;
+}
+
+String Dir::fileName() {
+    return String(files[_i].name);
+}
+
+size_t Dir::fileSize() {
+    return files[_i].size;
+}
+
+File Dir::openFile(const char* mode) {
+    return File(files[_i].name, files[_i].size);
+}
+
+bool FS::begin() {
+    simAdvance(simConfig.spiffsMs);
+    sim->spiffsMounts++;
+    _mounted = true;
+    return true;
+}
+
+void FS::end() {
+    _mounted = false;
+}
+
+Dir FS::openDir(const char* path) {
+    return Dir();
+}
+
+File FS::open(const char* path, const char* mode) {
+    if (!_mounted)
+        return File();
+    simAdvance(simConfig.spiffsOpenMs);
+    for (size_t i = 0; i < FILE_COUNT; i++)
+        if (strcmp(path, files[i].name) == 0)
+            return File(files[i].name, files[i].size);
+    return File();
+}
+
+bool FS::exists(const char* path) {
+    return open(path, "r");
+}
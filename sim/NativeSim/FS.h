@@ -0,0 +1,55 @@
+#ifndef SIM_FS_H
+#define SIM_FS_H
+
+#include <Arduino.h>
+
+// SPIFFS stand-in. Only knows the two credential files, content is not needed
+// as the TLS client is simulated too
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+class File : public Stream {
+    public:
+        File(const char* name = NULL, size_t size = 0) : _name(name), _size(size), _pos(0) {}
+        operator bool() const { return _name != NULL; }
+        int available() override { return _size - _pos; }
+        int read() override { return _pos < _size ? (_pos++ & 0xFF) : -1; }
+        size_t read(uint8_t* buf, size_t size);
+        size_t readBytes(char* buf, size_t size) { return read((uint8_t*)buf, size); }
+        bool seek(uint32_t pos, SeekMode mode) { _pos = pos; return true; }
+        size_t size() const { return _size; }
+        const char* name() const { return _name; }
+        void close() { _name = NULL; }
+    private:
+        const char* _name;
+        size_t _size;
+        size_t _pos;
+};
+
+class Dir {
+    public:
+        bool next();
+        String fileName();
+        size_t fileSize();
+        File openFile(const char* mode);
+    private:
+        int _i = -1;
+};
+
+class FS {
+    public:
+        bool begin();
+        void end();
+        Dir openDir(const char* path);
+        File open(const char* path, const char* mode);
+        bool exists(const char* path);
+    private:
+        bool _mounted = false;
+};
+extern FS SPIFFS;
+
+#endif
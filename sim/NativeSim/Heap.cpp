@@ -0,0 +1,53 @@
+#include "Sim.h"
+#include <stdlib.h>
+#include <new>
+
+// heap accounting for operator new/delete. Only allocations made during a wake
+// are counted (after simHeapTrack(), in the forked wake process), so the
+// runner's own bookkeeping does not show up. Mock internals do, like the real
+// libraries would.
+
+#define HEAP_TAG        0x48454150UL    // "HEAP"
+
+typedef struct {
+    size_t size;
+    uint32_t tag;
+} heapHeaderDef __attribute__((aligned(16)));
+
+static bool tracking = false;
+
+void simHeapTrack() {
+    sim->heapUsed = 0;
+    sim->heapPeak = 0;
+    tracking = true;
+}
+
+static void* heapAlloc(size_t size) {
+    heapHeaderDef* h = (heapHeaderDef*)malloc(sizeof(heapHeaderDef) + size);
+    if (!h)
+        throw std::bad_alloc();
+    h->size = size;
+    h->tag = tracking ? HEAP_TAG : 0;
+    if (tracking) {
+        sim->heapUsed += size;
+        if (sim->heapUsed > sim->heapPeak)
+            sim->heapPeak = sim->heapUsed;
+    }
+    return h + 1;
+}
+
+static void heapFree(void* p) {
+    if (!p)
+        return;
+    heapHeaderDef* h = (heapHeaderDef*)p - 1;
+    if (h->tag == HEAP_TAG)
+        sim->heapUsed -= h->size;
+    free(h);
+}
+
+void* operator new(size_t size) { return heapAlloc(size); }
+void* operator new[](size_t size) { return heapAlloc(size); }
+void operator delete(void* p) noexcept { heapFree(p); }
+void operator delete[](void* p) noexcept { heapFree(p); }
+void operator delete(void* p, size_t) noexcept { heapFree(p); }
+void operator delete[](void* p, size_t) noexcept { heapFree(p); }
@@ -0,0 +1,41 @@
+#include <IOTAppStory.h>
+#include <ESP8266WiFi.h>
+
+IOTAppStory::IOTAppStory(const char* appName, const char* appVersion, const char* compDate, int modeButton) {
+    simAppVersion = appVersion;
+}
+
+// %08X in a field value is replaced by the chip ID, e.g. a topic per device in a fleet
+void IOTAppStory::addField(char*& defaultVal, const char* fieldIdName, const char* fieldLabel, int length) {
+    for (int i = 0; i < SIM_MAX_FIELDS && simFields[i].name; i++)
+        if (strcmp(simFields[i].name, fieldIdName) == 0) {
+            const char* id = strstr(simFields[i].value, "%08X");
+            if (!id) {
+                defaultVal = strdup(simFields[i].value);
+                continue;
+            }
+            char value[128];
+            snprintf(value, sizeof(value), "%.*s%08X%s", (int)(id - simFields[i].value), simFields[i].value, sim->chipId, id + 4);
+            defaultVal = strdup(value);
+        }
+}
+
+void IOTAppStory::processField() {
+    simAdvance(simConfig.iasFieldsMs);
+}
+
+//IAS connects to WiFi itself on cold boot
+void IOTAppStory::begin(bool bootstats, char ea) {
+    processField();
+    WiFi.begin();
+    while (!WiFi.isConnected() && millis() < simConfig.iasBeginMs * 4)
+        delay(100);
+    simAdvance(simConfig.iasBeginMs);
+}
+
+void IOTAppStory::callHome(bool spiffs) {
+    if (!WiFi.isConnected())
+        return;
+    simAdvance(simConfig.callHomeMs);
+    sim->callHomes++;
+}
@@ -0,0 +1,35 @@
+#ifndef SIM_IOTAPPSTORY_H
+#define SIM_IOTAPPSTORY_H
+
+#include <Arduino.h>
+#include <functional>
+
+// IOTAppStory 1.1 stand-in. Fields keep their default values, config mode is never entered
+
+enum ModeButtonState {
+    ModeButtonNoPress,
+    ModeButtonShortPress,
+    ModeButtonLongPress,
+    ModeButtonVeryLongPress,
+    ModeButtonFirmwareUpdate,
+    ModeButtonConfigMode
+};
+
+class IOTAppStory {
+    public:
+        typedef std::function<void(void)> THandlerFunction;
+
+        IOTAppStory(const char* appName, const char* appVersion, const char* compDate, int modeButton);
+        void serialdebug(bool onoff, int speed = 115200) {}
+        void preSetConfig(const char* boardName, bool automaticUpdate = false) {}
+        void addField(char*& defaultVal, const char* fieldIdName, const char* fieldLabel, int length);
+        void processField();
+        void begin(bool bootstats = true, char ea = 'L');
+        void callHome(bool spiffs = true);
+        ModeButtonState buttonLoop() { return ModeButtonNoPress; }
+        void loop() {}
+        void onConfigMode(THandlerFunction fn) {}
+        void onFirmwareUpdateCheck(THandlerFunction fn) {}
+};
+
+#endif
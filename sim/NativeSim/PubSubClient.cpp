@@ -0,0 +1,292 @@
+#include <PubSubClient.h>
+#include <PackedPayload.h>
+#include <JsonScan.h>
+
+//client of the current connection, for packets written to the socket
+static PubSubClient* active;
+static std::string socketTx;
+
+boolean PubSubClient::connect(const char* id) {
+    if (connected())
+        return false;
+
+    uint64_t start = sim->nowUs;
+    if (!_client->connect(_domain, _port)) {
+        _state = MQTT_CONNECT_FAILED;
+        sim->mqttFails++;
+        return false;
+    }
+    //CONNACK never comes, readPacket() gives up after the socket timeout
+    if (simChance(simConfig.mqttHangRate)) {
+        simClockAdvance((uint64_t)MQTT_SOCKET_TIMEOUT * 1000000);
+        _client->stop();
+        _state = MQTT_CONNECTION_TIMEOUT;
+        sim->mqttFails++;
+        return false;
+    }
+    simAdvance(simConfig.mqttConnectMs);
+    if (simChance(simConfig.mqttFailRate)) {
+        _client->stop();
+        _state = MQTT_CONNECT_UNAVAILABLE;
+        sim->mqttFails++;
+        return false;
+    }
+    _state = MQTT_CONNECTED;
+    active = this;
+    socketTx.clear();
+    sim->mqttConnects++;
+    if (sim->connects < SIM_WAKE_EVENTS)
+        sim->connectUs[sim->connects++] = sim->nowUs - start;
+    return true;
+}
+
+void PubSubClient::disconnect() {
+    if (active == this)
+        active = NULL;
+    _client->stop();
+    _state = MQTT_DISCONNECTED;
+    _subscribed.clear();
+    _pending.clear();
+}
+
+// readings and reported drops in a content message, for the gap check of the runner
+static void countReadings(const char* topic, const uint8_t* payload, unsigned int plength) {
+    if (strncmp(topic, "$aws/", 5) == 0)
+        return;
+    //packed format goes through the host decoder, a message it rejects shows up as a gap
+    if (plength > 0 && payload[0] == PACKED_MAGIC) {
+        static packedMessageDef packed;
+        if (!packedDecode(payload, plength, &packed))
+            return;
+        if (packed.type == PACKED_WINDOW)
+            for (uint16_t i = 0; i < packed.count; i++)
+                sim->readingsSent += packed.stats[i].n;
+        else {
+            sim->readingsSent += packed.count;
+            sim->droppedReported += packed.dropped;
+        }
+        return;
+    }
+    std::string msg((const char*)payload, plength);
+    //aggregation window: "temperature" is the mean of n readings, per sensor
+    if (msg.find("\"n\":") != std::string::npos) {
+        for (size_t p = msg.find("\"n\":"); p != std::string::npos; p = msg.find("\"n\":", p + 4))
+            sim->readingsSent += atol(msg.c_str() + p + 4);
+        return;
+    }
+    //one "temperature" per sensor in messages keyed by ROM ID
+    for (size_t p = msg.find("\"temperature\":"); p != std::string::npos; p = msg.find("\"temperature\":", p)) {
+        p += 14;
+        if (msg[p] != '[')
+            sim->readingsSent++;
+        else
+            for (; p < msg.size() && msg[p] != ']'; p++)
+                if (msg[p] == '[' || msg[p] == ',')
+                    sim->readingsSent++;
+    }
+    size_t p = msg.find("\"dropped\":");
+    if (p != std::string::npos)
+        sim->droppedReported += atol(msg.c_str() + p + 10);
+}
+
+// value at path ("config.sample_interval") in object
+static bool shadowValue(jsonSpanDef object, const char* path, char* text, size_t size) {
+    char key[SIM_SHADOW_VALUE];
+    while (const char* dot = strchr(path, '.')) {
+        snprintf(key, sizeof(key), "%.*s", (int)(dot - path), path);
+        if (!jsonMember(object, key, &object))
+            return false;
+        path = dot + 1;
+    }
+    jsonSpanDef value;
+    return jsonMember(object, path, &value) && jsonText(value, text, size);
+}
+
+// shadow service: keeps what a shadow update reports for each desired leaf and
+// returns the delta document, empty if the reported state matches the desired one.
+// Values are compared as text, leaves nest one level at most
+static std::string shadowUpdate(const uint8_t* payload, unsigned int plength) {
+    jsonSpanDef doc = { (const char*)payload, plength }, state, reported;
+    bool found = jsonMember(doc, "state", &state) && jsonMember(state, "reported", &reported);
+    std::string delta;
+    std::string group;      // object of the last leaf written, left open
+    for (int i = 0; i < SIM_MAX_FIELDS && simDesired[i].name; i++) {
+        if (found)
+            shadowValue(reported, simDesired[i].name, sim->shadowReported[i], SIM_SHADOW_VALUE);
+        if (strcmp(sim->shadowReported[i], simDesired[i].value) == 0)
+            continue;
+        std::string path = simDesired[i].name;
+        size_t dot = path.find('.');
+        std::string parent = dot == std::string::npos ? "" : path.substr(0, dot);
+        if (parent != group) {
+            if (!group.empty())
+                delta += "}";
+            if (!parent.empty())
+                delta += (delta.empty() ? "\"" : ",\"") + parent + "\":{";
+            group = parent;
+        } else if (!delta.empty() && delta[delta.size() - 1] != '{')
+            delta += ",";
+        delta += "\"" + path.substr(dot + 1) + "\":\"" + simDesired[i].value + "\"";
+    }
+    if (delta.empty())
+        return delta;
+    if (!group.empty())
+        delta += "}";
+    char head[48];
+    snprintf(head, sizeof(head), "{\"version\":1,\"timestamp\":%u,\"state\":{", simUnixTime());
+    return head + delta + "},\"metadata\":{}}";
+}
+
+// report of a streaming wake, {"state":{"reported":{"stream":{"reading_ms":..,"latency":[..]}}}}
+static void streamReport(const uint8_t* payload, unsigned int plength) {
+    std::string msg((const char*)payload, plength);
+    size_t p = msg.find("\"stream\":{");
+    if (p == std::string::npos)
+        return;
+    sim->streamed = true;
+    size_t q = msg.find("\"reading_ms\":", p);
+    if (q != std::string::npos)
+        sim->streamReadingMs = atol(msg.c_str() + q + 13);
+    q = msg.find("\"latency\":[", p);
+    if (q != std::string::npos)
+        sscanf(msg.c_str() + q + 11, "%u,%u,%u", &sim->streamLatencyMs[0], &sim->streamLatencyMs[1], &sim->streamLatencyMs[2]);
+}
+
+boolean PubSubClient::publish(const char* topic, const char* payload) {
+    return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, false);
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength) {
+    return publish(topic, payload, plength, false);
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
+    //same size check as the library: fixed header + topic length + topic + payload
+    if (!connected() || MQTT_MAX_PACKET_SIZE < 5 + 2 + strlen(topic) + plength) {
+        sim->publishFails++;
+        return false;
+    }
+    simAdvance(simConfig.publishMs);
+    //QoS0: the client does not know
+    if (simChance(simConfig.publishLossRate)) {
+        sim->publishesLost++;
+        return true;
+    }
+    received(topic, payload, plength);
+    return true;
+}
+
+// PUBLISH packets as they are written to the socket, QoS1 ones are answered with a PUBACK
+void simSocketWrite(const uint8_t* data, size_t n) {
+    socketTx.append((const char*)data, n);
+    while (socketTx.size() >= 2) {
+        const uint8_t* p = (const uint8_t*)socketTx.data();
+        size_t length = 0, pos = 1;
+        for (uint8_t shift = 0; pos < socketTx.size(); shift += 7) {
+            length |= (size_t)(p[pos] & 0x7F) << shift;
+            if (!(p[pos++] & 0x80))
+                break;
+        }
+        if (pos + length > socketTx.size())
+            return;
+        std::string packet = socketTx.substr(0, pos + length);
+        socketTx.erase(0, pos + length);
+        p = (const uint8_t*)packet.data();
+        if ((p[0] & 0xF0) != 0x30 || !active || !active->connected())
+            continue;
+        uint8_t qos = (p[0] >> 1) & 3;
+        p += pos;
+        size_t topicLength = p[0] << 8 | p[1];
+        std::string topic((const char*)p + 2, topicLength);
+        size_t header = 2 + topicLength + (qos ? 2 : 0);
+        simAdvance(simConfig.publishMs);
+        if (qos)
+            sim->qos1Publishes++;
+        if (simChance(simConfig.publishLossRate)) {
+            sim->publishesLost++;
+            continue;
+        }
+        active->received(topic.c_str(), p + header, length - header);
+        if (qos) {
+            uint8_t puback[] = { 0x40, 2, p[2 + topicLength], p[3 + topicLength] };
+            simSocketReceive(puback, sizeof(puback), sim->nowUs + (uint64_t)(simJitter(simConfig.pubackMs) * 1000));
+        }
+    }
+}
+
+// the broker has the message
+void PubSubClient::received(const char* topic, const uint8_t* payload, unsigned int plength) {
+    sim->publishes++;
+    sim->publishedBytes += 2 + strlen(topic) + plength;
+    simBrokerPublish();
+    countReadings(topic, payload, plength);
+    streamReport(payload, plength);
+    if (simVerbose && plength > 0 && payload[0] == PACKED_MAGIC)
+        printf("[sim] publish %s (%u bytes packed)\n", topic, plength);
+    else if (simVerbose)
+        printf("[sim] publish %s %.*s\n", topic, (int)plength, (const char*)payload);
+    std::string name(topic);
+    if (name.size() >= 14 && name.compare(name.size() - 14, 14, "/shadow/update") == 0) {
+        std::string delta = shadowUpdate(payload, plength);
+        if (!delta.empty() && subscribed(name + "/delta"))
+            _pending.push_back(std::make_pair(name + "/delta", delta));
+    }
+    //shadow service response: state echoed plus metadata of about the same size. 
+    //Packets over MQTT_MAX_PACKET_SIZE are dropped by the library
+    name += "/accepted";
+    if (subscribed(name) && 2 * plength + 40 + name.size() <= MQTT_MAX_PACKET_SIZE) {
+        char tail[48];
+        snprintf(tail, sizeof(tail), ",\"version\":1,\"timestamp\":%u}", simUnixTime());
+        _pending.push_back(std::make_pair(name,
+            "{\"echo\":" + std::string((const char*)payload, plength) + ",\"metadata\":{}" + tail));
+    }
+}
+
+bool PubSubClient::subscribed(const std::string& topic) {
+    for (size_t i = 0; i < _subscribed.size(); i++)
+        if (_subscribed[i] == topic)
+            return true;
+    return false;
+}
+
+boolean PubSubClient::subscribe(const char* topic, uint8_t qos) {
+    if (!connected())
+        return false;
+    simAdvance(simConfig.publishMs);
+    if (!subscribed(topic))
+        _subscribed.push_back(topic);
+    return true;
+}
+
+boolean PubSubClient::loop() {
+    if (!connected())
+        return false;
+    //one packet from the socket (PUBACK), it has arrived in one piece
+    if (_client->available()) {
+        _client->read();
+        size_t length = 0;
+        for (uint8_t shift = 0; _client->available(); shift += 7) {
+            int b = _client->read();
+            length |= (size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+        while (length-- > 0 && _client->available())
+            _client->read();
+        return true;
+    }
+    if (!_pending.empty() && callback) {
+        //the round trip of the message before
+        simAdvance(simConfig.publishMs);
+        std::string topic = _pending.front().first, payload = _pending.front().second;
+        _pending.pop_front();
+        callback(&topic[0], (uint8_t*)&payload[0], payload.size());
+    }
+    return true;
+}
+
+boolean PubSubClient::connected() {
+    if (_state == MQTT_CONNECTED && !_client->connected())
+        _state = MQTT_CONNECTION_LOST;
+    return _state == MQTT_CONNECTED;
+}
@@ -0,0 +1,65 @@
+#ifndef SIM_PUBSUBCLIENT_H
+#define SIM_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <deque>
+
+// PubSubClient 2.6 stand-in. Same limits and return codes as the library,
+// broker round trips only advance the virtual clock. Shadow updates are answered on
+// .../accepted if subscribed, with the state echoed and the broker's unix time, and
+// on .../delta if subscribed and the desired state (--desired.<path>) is not reported.
+// PUBLISH packets the firmware writes to the socket itself are taken as well, QoS1 ones
+// are answered with a PUBACK on the socket. loop() reads the socket as the library does
+
+#ifndef MQTT_MAX_PACKET_SIZE
+#define MQTT_MAX_PACKET_SIZE 128
+#endif
+#ifndef MQTT_KEEPALIVE
+#define MQTT_KEEPALIVE 15
+#endif
+#ifndef MQTT_SOCKET_TIMEOUT
+#define MQTT_SOCKET_TIMEOUT 15
+#endif
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+#define MQTT_CONNECT_UNAVAILABLE     3
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+class PubSubClient {
+    public:
+        PubSubClient(Client& client) : _client(&client) {}
+        PubSubClient& setServer(const char* domain, uint16_t port) { _domain = domain; _port = port; return *this; }
+        PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE) { this->callback = callback; return *this; }
+        boolean connect(const char* id);
+        void disconnect();
+        boolean publish(const char* topic, const char* payload);
+        boolean publish(const char* topic, const uint8_t* payload, unsigned int plength);
+        boolean publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained);
+        boolean subscribe(const char* topic, uint8_t qos = 0);
+        boolean loop();
+        boolean connected();
+        int state() { return _state; }
+    private:
+        friend void simSocketWrite(const uint8_t* data, size_t n);
+        void received(const char* topic, const uint8_t* payload, unsigned int plength);
+        Client* _client;
+        const char* _domain = NULL;
+        uint16_t _port = 0;
+        int _state = MQTT_DISCONNECTED;
+        MQTT_CALLBACK_SIGNATURE;
+        bool subscribed(const std::string& topic);
+        std::vector<std::string> _subscribed;
+        // messages the broker has sent (topic, payload), loop() delivers one per call
+        std::deque<std::pair<std::string, std::string> > _pending;
+};
+
+#endif
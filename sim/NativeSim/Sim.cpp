@@ -0,0 +1,127 @@
+#include "Sim.h"
+#include <Ticker.h>
+
+simConfigDef simConfig = {
+    /* bootMs */            70,
+    /* rfCalMs */           110,
+    /* iasFieldsMs */       15,
+    /* iasBeginMs */        2500,
+    /* spiffsMs */          180,
+    /* spiffsOpenMs */      8,
+    /* certMs */            60,
+    /* sensorSearchMs */    14,
+    /* sensorReadMs */      6,
+    /* sensorEepromMs */    22,
+    /* wifiFullMs */        2200,
+    /* wifiFastMs */        350,
+    /* tlsFullMs */         2800,
+    /* tlsResumeMs */       450,
+    /* mqttConnectMs */     120,
+    /* publishMs */         40,
+    /* pubackMs */          80,
+    /* callHomeMs */        3000,
+    /* flashEraseMs */      45,
+    /* flashWriteMs */      0.8,
+    /* flashReadMs */       0.25,
+    /* jitter */            0.2,
+    /* wifiFailRate */      0.01,
+    /* fastFailRate */      0.02,
+    /* tlsRejectRate */     0.05,
+    /* mqttFailRate */      0.01,
+    /* mqttHangRate */      0.005,
+    /* publishLossRate */   0,
+    /* outageRate */        0,
+    /* outageHours */       6,
+    /* sensors */           1,
+    /* rssi */              -62,
+    /* sleepDrift */        0.02,
+    /* tempStart */         21.0,
+    /* tempDrift */         0.15,
+    /* sleepMa */           0.02,
+    /* cpuMa */             16,
+    /* radioMa */           72,
+    /* lightSleepMa */      2,
+    /* volts */             3.3,
+    /* batteryMah */        2000,
+    /* powerOnSpread */     3600,
+    /* driftSpread */       0.01,
+    /* brokerWorkers */     4,
+    /* brokerConnectMs */   20,
+    /* brokerIngestMs */    1,
+};
+
+simFieldDef simFields[SIM_MAX_FIELDS];
+simFieldDef simDesired[SIM_MAX_FIELDS];
+simStateDef* sim;
+bool simVerbose;
+const char* simAppVersion = "?";
+
+uint32_t simUnixTime() {
+    return SIM_EPOCH + (sim->wallUs + sim->nowUs) / 1000000;
+}
+
+uint32_t simRandom() {
+    //xorshift32
+    uint32_t x = sim->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim->rng = x;
+    return x;
+}
+
+double simUniform() {
+    return (simRandom() >> 8) / (double)(1 << 24);
+}
+
+bool simChance(double p) {
+    return simUniform() < p;
+}
+
+double simJitter(double ms) {
+    return ms * (1 + simConfig.jitter * (2 * simUniform() - 1));
+}
+
+void simClockAdvance(uint64_t us) {
+    uint64_t target = sim->nowUs + us;
+    simTimersRun(target);
+    if (sim->nowUs < target)
+        sim->nowUs = target;
+}
+
+void simAdvance(double ms) {
+    simClockAdvance((uint64_t)(simJitter(ms) * 1000));
+}
+
+// no jitter here, the broker must not change the random sequence of a single device
+uint64_t simBrokerConnect(bool resumed) {
+    simBrokerDef* broker = &sim->broker;
+    uint64_t now = sim->wallUs + sim->nowUs;
+    int workers = simConfig.brokerWorkers < 1 ? 1 : simConfig.brokerWorkers > SIM_BROKER_WORKERS ? SIM_BROKER_WORKERS : (int)simConfig.brokerWorkers;
+    uint32_t capacity = workers * SIM_BROKER_SLOT_US;
+    uint64_t left = (uint64_t)(simConfig.brokerConnectMs * (resumed ? 250 : 1000));
+    uint64_t start = 0;
+    bool started = false;
+    for (uint64_t slot = now / SIM_BROKER_SLOT_US; left; slot++) {
+        uint32_t i = slot % SIM_BROKER_SLOTS;
+        if (broker->slot[i] != slot) {
+            broker->slot[i] = slot;
+            broker->usedUs[i] = 0;
+        }
+        if (broker->usedUs[i] >= capacity)
+            continue;
+        if (!started) {
+            start = slot * SIM_BROKER_SLOT_US;
+            started = true;
+        }
+        uint64_t take = capacity - broker->usedUs[i] < left ? capacity - broker->usedUs[i] : left;
+        broker->usedUs[i] += take;
+        left -= take;
+    }
+    return start > now ? start - now : 0;
+}
+
+void simBrokerPublish() {
+    if (sim->arrivals < SIM_WAKE_EVENTS)
+        sim->arrivalUs[sim->arrivals++] = sim->wallUs + sim->nowUs;
+}
@@ -0,0 +1,176 @@
+#ifndef SIM_H
+#define SIM_H
+
+// Host simulation of TempMon wake cycles.
+// All mocks run on a virtual clock; every hardware operation advances it by a
+// configurable latency. Each wake runs setup() in a forked process so RAM starts 
+// clean like after a real reset, while RTC memory and the simulated world are 
+// kept in shared memory.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    // latencies in ms
+    double bootMs;                  // reset until setup() is entered
+    double rfCalMs;                 // extra boot time when woken with RF enabled
+    double iasFieldsMs;             // IAS.processField()
+    double iasBeginMs;              // IAS.begin() on cold boot
+    double spiffsMs;                // SPIFFS mount
+    double spiffsOpenMs;            // SPIFFS file open (object lookup)
+    double certMs;                  // cert or key load
+    double sensorSearchMs;          // OneWire ROM search
+    double sensorReadMs;            // read scratchpad
+    double sensorEepromMs;          // setResolution (copy scratchpad to EEPROM)
+    double wifiFullMs;              // scan, association and DHCP
+    double wifiFastMs;              // directed connect with static IP
+    double tlsFullMs;               // full TLS handshake
+    double tlsResumeMs;             // resumed TLS handshake
+    double mqttConnectMs;           // MQTT CONNECT/CONNACK
+    double publishMs;               // per publish
+    double pubackMs;                // QoS1 publish until its PUBACK is read (broker round trip)
+    double callHomeMs;              // IAS FW update check
+    double flashEraseMs;            // flash sector erase
+    double flashWriteMs;            // flash write, per 256 byte page
+    double flashReadMs;             // flash read, per KB
+    double jitter;                  // +- relative jitter applied to all latencies
+    // failure probabilities 0..1
+    double wifiFailRate;            // AP not reachable during a wake
+    double fastFailRate;            // cached AP/lease not valid anymore
+    double tlsRejectRate;           // server does not resume the session
+    double mqttFailRate;            // MQTT connect fails
+    double mqttHangRate;            // broker does not answer CONNECT, client waits MQTT_SOCKET_TIMEOUT
+    double publishLossRate;         // published message never reaches the broker (no PUBACK either)
+    double outageRate;              // chance per wake that the AP goes away for a while
+    double outageHours;             // duration of such an outage
+    // world
+    double sensors;                 // DS18B20 on the bus
+    double rssi;                    // dBm
+    double sleepDrift;              // deep sleep timer error, actual = requested * (1 + sleepDrift)
+    double tempStart;               // deg C
+    double tempDrift;               // std deviation of temperature change per wake
+    // power model
+    double sleepMa;                 // deep sleep
+    double cpuMa;                   // awake, radio off
+    double radioMa;                 // awake, radio on (average of RX/TX)
+    double lightSleepMa;            // awake, idle in WiFi light sleep (streaming), DTIM wakeups included
+    double volts;
+    double batteryMah;
+    // fleet (--devices=N) and broker stand-in
+    double powerOnSpread;           // s, devices are powered on at random within this time. 0 - all at once
+    double driftSpread;             // sleep timer error of each device is sleepDrift +- driftSpread
+    double brokerWorkers;           // connections the broker sets up in parallel
+    double brokerConnectMs;         // broker time per connection (full TLS handshake, CONNECT), 1/4 if resumed
+    double brokerIngestMs;          // broker time per published message
+} simConfigDef;
+
+#define SIM_HEAP_SIZE       40000   // free heap at boot, as reported by ESP.getFreeHeap()
+#define SIM_RTC_SIZE        768     // 192 blocks of 4 bytes
+#define SIM_FLASH_SIZE      (4 * 1024 * 1024)
+#define SIM_WAKE_EVENTS     48      // connects and publishes recorded per wake
+#define SIM_BROKER_WORKERS  64
+#define SIM_BROKER_SLOT_US  10000   // broker capacity is booked in slots of 10 ms
+#define SIM_BROKER_SLOTS    65536   // ~11 minutes ahead or behind the wake that books
+// flash the firmware writes, kept per device in fleet mode (see eagle.flash.4m.tempmon.ld)
+#define SIM_APPDATA_BEGIN   0x3EA000
+#define SIM_APPDATA_END     0x3FB000
+
+// broker stand-in shared by all devices. Connection setup time is booked in a calendar
+// of time slots, as wakes overlap and do not run in the order of their events
+typedef struct {
+    uint64_t slot[SIM_BROKER_SLOTS];        // slot number held by the entry
+    uint32_t usedUs[SIM_BROKER_SLOTS];      // worker time booked in it
+} simBrokerDef;
+#define SIM_EPOCH           1760000000  // unix time at power on, broker clock
+#define SIM_MAX_FIELDS      16
+#define SIM_SHADOW_VALUE    32
+
+typedef struct {
+    // persists across wakes
+    uint8_t rtcMem[SIM_RTC_SIZE];
+    uint8_t flash[SIM_FLASH_SIZE];  // erased to 0xFF on first power on
+    uint32_t chipId;
+    double temperature;
+    uint8_t serverSession[32];      // session ID the broker would resume
+    char shadowReported[SIM_MAX_FIELDS][SIM_SHADOW_VALUE];  // reported value of each desired leaf
+    uint32_t rng;
+    // set by the runner before each wake
+    uint32_t resetReason;
+    bool rfEnabled;
+    bool wifiDown;                  // AP not reachable this wake
+    bool apMoved;                   // cached AP/lease not valid this wake
+    // virtual clock of the current wake (reset on wake)
+    uint64_t nowUs;
+    // simulated time since power on at the start of the current wake
+    uint64_t wallUs;
+    // results of the current wake
+    bool slept;
+    uint64_t sleepUs;
+    int sleepMode;
+    bool timerSleep;                // deep sleep after the deadline timer has fired
+    uint16_t wifiFull, wifiFast, wifiFail;
+    uint16_t tlsFull, tlsResumed;
+    uint16_t mqttConnects, mqttFails;
+    uint16_t publishes, publishFails;
+    uint16_t publishesLost;         // not taken by the broker (publishLossRate)
+    uint16_t qos1Publishes;         // written to the socket by the firmware, PUBACK requested
+    uint32_t publishedBytes;
+    uint32_t readingsSent;          // readings in published content messages
+    uint32_t droppedReported;       // sum of "dropped" in published content messages
+    uint16_t callHomes;
+    uint16_t spiffsMounts;
+    uint16_t flashErases;
+    uint32_t heapUsed;              // bytes allocated with new and not freed yet
+    uint32_t heapPeak;              // high-water mark of heapUsed
+    uint8_t connects;               // successful MQTT connects, latency in connectUs[]
+    uint32_t connectUs[SIM_WAKE_EVENTS];    // CONNECT to CONNACK, TLS and broker queue included
+    uint8_t arrivals;               // messages that reached the broker
+    uint64_t arrivalUs[SIM_WAKE_EVENTS];    // fleet time (wallUs + nowUs) of arrival
+    bool lightSleep;                // WiFi light sleep set, delay() idles in it
+    uint64_t lightSleepUs;          // time idle in light sleep
+    bool streamed;                  // the wake has sent a stream report (shadow "stream")
+    uint32_t streamReadingMs;       // reported mean ms between readings
+    uint32_t streamLatencyMs[3];    // reported min/mean/max age of the oldest reading per publish
+    // all devices
+    simBrokerDef broker;
+} simStateDef;
+
+// IAS field values, overriding the defaults passed to IAS.addField()
+typedef struct {
+    const char* name;
+    const char* value;
+} simFieldDef;
+extern simFieldDef simFields[SIM_MAX_FIELDS];
+// desired shadow state of all devices, leaves by path below "state" (config.sample_interval)
+extern simFieldDef simDesired[SIM_MAX_FIELDS];
+
+extern simConfigDef simConfig;
+extern simStateDef* sim;
+extern bool simVerbose;
+extern const char* simAppVersion;
+
+// latency with random jitter applied
+double simJitter(double ms);
+// advance the virtual clock, running timers that become due on the way
+void simClockAdvance(uint64_t us);
+// advance the virtual clock by a (jittered) latency
+void simAdvance(double ms);
+// broker's unix time now
+uint32_t simUnixTime();
+// random helpers, deterministic for a given seed
+uint32_t simRandom();
+double simUniform();
+bool simChance(double p);
+// start counting heap allocations of the current wake
+void simHeapTrack();
+// book broker time for a connection, returns the time it waits for a free worker in us
+uint64_t simBrokerConnect(bool resumed);
+// a message has reached the broker, ingestion is worked out after the run
+void simBrokerPublish();
+// MQTT packets the firmware writes to the TLS socket past PubSubClient (QoS1 PUBLISH),
+// taken by the broker stand-in (PubSubClient.cpp)
+void simSocketWrite(const uint8_t* data, size_t n);
+// bytes the broker sends on the TLS socket, readable from atUs (virtual clock of the wake)
+void simSocketReceive(const uint8_t* data, size_t n, uint64_t atUs);
+
+#endif
@@ -0,0 +1,532 @@
+#include <Arduino.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include <map>
+#include <queue>
+extern "C" {
+    #include <spi_flash.h>
+}
+
+// Wake cycle simulator: runs the firmware setup() once per simulated wake and
+// reports awake time and energy per cycle.
+//
+//   program [--cycles=N] [--devices=N] [--seed=N] [--verbose] [--<config>=value ...] [--field.<name>=value ...]
+//           [--desired.<path>=value ...]
+//
+// <config> is any field of simConfigDef, e.g. --wifiFullMs=3000 --tlsRejectRate=0.5
+// --field.<name> sets an IAS field, e.g. --field.sample_interval=5
+// --desired.<path> sets the desired shadow state of all devices, e.g. --desired.Version=9.9.9
+// --desired.config.sample_interval=10. The broker sends the delta until it is reported
+//
+// With --field.stream=<ms>,<s> upload wakes stream (loop() runs until the next slot). 
+// WiFi light sleep is counted at lightSleepMa, the firmware's stream report is summed up.
+//
+// QoS1 publishes (--field.qos_window > 0) are written to the socket past PubSubClient and
+// answered with a PUBACK pubackMs later. With --publishLossRate messages do not reach the
+// broker: QoS0 ones are gone, QoS1 ones get no PUBACK and their readings are sent again
+//
+// With --devices=N a fleet of N devices (consecutive chip IDs, powered on within 
+// powerOnSpread) runs cycles wakes each against the broker stand-in, in order of 
+// wake time. Each device keeps its own RTC memory, app data flash, TLS session and 
+// sleep timer error. Adds broker throughput, connect latency and backlog to the report.
+// A device's wake runs to its end before the next one starts, so overlapping wakes
+// reach the broker out of order: connects book worker time in slots, ingestion is
+// worked out after the run from the sorted arrival times
+
+// unit tests (pio test defines UNIT_TEST) link the stand-ins without the runner
+#ifndef UNIT_TEST
+
+void setup();
+void loop();
+
+// a streaming wake runs to the end of its sample slot, 60 minutes at most (firmware's
+// STREAM_WAKE_MAX_MINUTES), after the connect phase. 5 minutes on top cover the connect
+// and a slot stretched by jitter; a wake that has not slept after this is stuck
+#define SIM_STREAM_MAX_US   ((60 + 5) * 60 * 1000000ULL)
+
+static const struct {
+    const char* name;
+    double* value;
+} options[] = {
+    { "bootMs", &simConfig.bootMs },
+    { "rfCalMs", &simConfig.rfCalMs },
+    { "iasFieldsMs", &simConfig.iasFieldsMs },
+    { "iasBeginMs", &simConfig.iasBeginMs },
+    { "spiffsMs", &simConfig.spiffsMs },
+    { "spiffsOpenMs", &simConfig.spiffsOpenMs },
+    { "certMs", &simConfig.certMs },
+    { "sensorSearchMs", &simConfig.sensorSearchMs },
+    { "sensorReadMs", &simConfig.sensorReadMs },
+    { "sensorEepromMs", &simConfig.sensorEepromMs },
+    { "wifiFullMs", &simConfig.wifiFullMs },
+    { "wifiFastMs", &simConfig.wifiFastMs },
+    { "tlsFullMs", &simConfig.tlsFullMs },
+    { "tlsResumeMs", &simConfig.tlsResumeMs },
+    { "mqttConnectMs", &simConfig.mqttConnectMs },
+    { "publishMs", &simConfig.publishMs },
+    { "pubackMs", &simConfig.pubackMs },
+    { "callHomeMs", &simConfig.callHomeMs },
+    { "flashEraseMs", &simConfig.flashEraseMs },
+    { "flashWriteMs", &simConfig.flashWriteMs },
+    { "flashReadMs", &simConfig.flashReadMs },
+    { "jitter", &simConfig.jitter },
+    { "wifiFailRate", &simConfig.wifiFailRate },
+    { "fastFailRate", &simConfig.fastFailRate },
+    { "tlsRejectRate", &simConfig.tlsRejectRate },
+    { "mqttFailRate", &simConfig.mqttFailRate },
+    { "mqttHangRate", &simConfig.mqttHangRate },
+    { "publishLossRate", &simConfig.publishLossRate },
+    { "outageRate", &simConfig.outageRate },
+    { "outageHours", &simConfig.outageHours },
+    { "sensors", &simConfig.sensors },
+    { "rssi", &simConfig.rssi },
+    { "sleepDrift", &simConfig.sleepDrift },
+    { "tempStart", &simConfig.tempStart },
+    { "tempDrift", &simConfig.tempDrift },
+    { "sleepMa", &simConfig.sleepMa },
+    { "cpuMa", &simConfig.cpuMa },
+    { "radioMa", &simConfig.radioMa },
+    { "lightSleepMa", &simConfig.lightSleepMa },
+    { "volts", &simConfig.volts },
+    { "batteryMah", &simConfig.batteryMah },
+    { "powerOnSpread", &simConfig.powerOnSpread },
+    { "driftSpread", &simConfig.driftSpread },
+    { "brokerWorkers", &simConfig.brokerWorkers },
+    { "brokerConnectMs", &simConfig.brokerConnectMs },
+    { "brokerIngestMs", &simConfig.brokerIngestMs },
+};
+#define OPTION_COUNT (sizeof(options) / sizeof(options[0]))
+
+typedef struct {
+    unsigned long count;
+    double sum, min, max;
+    std::vector<double> values;
+} statDef;
+
+static void statAdd(statDef* stat, double v) {
+    if (stat->count == 0 || v < stat->min)
+        stat->min = v;
+    if (stat->count == 0 || v > stat->max)
+        stat->max = v;
+    stat->sum += v;
+    stat->count++;
+    stat->values.push_back(v);
+}
+
+static double statMean(const statDef* stat) {
+    return stat->count ? stat->sum / stat->count : 0;
+}
+
+static double statPercentile(statDef* stat, double p) {
+    if (stat->count == 0)
+        return 0;
+    std::sort(stat->values.begin(), stat->values.end());
+    return stat->values[(size_t)(p * (stat->count - 1))];
+}
+
+static void statPrint(const char* name, statDef* stat) {
+    printf("  %-22s n=%-7lu mean=%8.1f  min=%8.1f  p95=%8.1f  max=%8.1f\n", name, stat->count, 
+        statMean(stat), stat->min, statPercentile(stat, 0.95), stat->max);
+}
+
+// p50/p95/p99/max, for the fleet report
+static void statPrintPercentiles(const char* name, statDef* stat) {
+    printf("  %-22s n=%-7lu p50=%8.1f  p95=%8.1f  p99=%8.1f  max=%8.1f\n", name, stat->count, 
+        statPercentile(stat, 0.5), statPercentile(stat, 0.95), statPercentile(stat, 0.99), stat->count ? stat->max : 0);
+}
+
+// everything the report is made of, summed up over all wakes (and devices)
+typedef struct {
+    statDef awakeUpload, awakeSample, awakeAll, energy, heapPeak, interval;
+    unsigned long wakes, failedWakes;
+    uint64_t totalUs;
+    double totalMas;   //mA*s
+    unsigned long wifiFull, wifiFast, tlsFull, tlsResumed;
+    unsigned long publishes, publishFails, publishesLost, qos1Publishes, mqttFails, callHomes, spiffsMounts, flashErases;
+    uint64_t publishedBytes, readingsSent, droppedReported;
+    unsigned long outageWakes, timerSleeps;
+    // streaming wakes
+    statDef streamReadingMs, streamLatencyMean, streamLatencyMax;
+    uint64_t streamUs, streamReadings;
+    // fleet only
+    statDef connectMs;
+    std::vector<uint64_t> arrivalUs;    //messages reaching the broker
+} simTotalsDef;
+
+static bool parseArgs(int argc, char** argv, unsigned long* cycles, unsigned long* devices, uint32_t* seed) {
+    int fields = 0;
+    int desired = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0)
+            return false;
+        arg += 2;
+        if (strcmp(arg, "verbose") == 0) {
+            simVerbose = true;
+            continue;
+        }
+        const char* eq = strchr(arg, '=');
+        if (!eq)
+            return false;
+        size_t len = eq - arg;
+        if (strncmp(arg, "field.", 6) == 0) {
+            if (fields == SIM_MAX_FIELDS)
+                return false;
+            simFields[fields].name = strndup(arg + 6, len - 6);
+            simFields[fields++].value = eq + 1;
+            continue;
+        }
+        if (strncmp(arg, "desired.", 8) == 0) {
+            if (desired == SIM_MAX_FIELDS)
+                return false;
+            simDesired[desired].name = strndup(arg + 8, len - 8);
+            simDesired[desired++].value = eq + 1;
+            continue;
+        }
+        if (len == 6 && strncmp(arg, "cycles", len) == 0) {
+            *cycles = strtoul(eq + 1, NULL, 0);
+            continue;
+        }
+        if (len == 7 && strncmp(arg, "devices", len) == 0) {
+            *devices = strtoul(eq + 1, NULL, 0);
+            continue;
+        }
+        if (len == 4 && strncmp(arg, "seed", len) == 0) {
+            *seed = strtoul(eq + 1, NULL, 0);
+            continue;
+        }
+        size_t o;
+        for (o = 0; o < OPTION_COUNT; o++)
+            if (strlen(options[o].name) == len && strncmp(arg, options[o].name, len) == 0)
+                break;
+        if (o == OPTION_COUNT)
+            return false;
+        *options[o].value = strtod(eq + 1, NULL);
+    }
+    return true;
+}
+
+// one wake of the device in *sim, powered on (cycle 0) or from deep sleep. The AP outage
+// state of the device is in *outageEndUs. Returns the time slept in us
+static uint64_t runWake(simTotalsDef* totals, unsigned long cycle, bool rfEnabled, double drift, uint64_t* outageEndUs) {
+    sim->resetReason = cycle == 0 ? REASON_DEFAULT_RST : REASON_DEEP_SLEEP_AWAKE;
+    sim->rfEnabled = rfEnabled;
+    sim->wifiDown = simChance(simConfig.wifiFailRate);
+    if (sim->wallUs >= *outageEndUs && simChance(simConfig.outageRate))
+        *outageEndUs = sim->wallUs + (uint64_t)(simConfig.outageHours * 3.6e9);
+    if (sim->wallUs < *outageEndUs) {
+        sim->wifiDown = true;
+        totals->outageWakes++;
+    }
+    sim->apMoved = simChance(simConfig.fastFailRate);
+    sim->nowUs = (uint64_t)(simJitter(simConfig.bootMs + (rfEnabled ? simConfig.rfCalMs : 0)) * 1000);
+    sim->slept = false;
+    sim->timerSleep = false;
+    sim->wifiFull = sim->wifiFast = sim->wifiFail = 0;
+    sim->tlsFull = sim->tlsResumed = 0;
+    sim->mqttConnects = sim->mqttFails = 0;
+    sim->publishes = sim->publishFails = 0;
+    sim->publishesLost = sim->qos1Publishes = 0;
+    sim->publishedBytes = 0;
+    sim->readingsSent = 0;
+    sim->droppedReported = 0;
+    sim->callHomes = 0;
+    sim->spiffsMounts = 0;
+    sim->flashErases = 0;
+    sim->connects = 0;
+    sim->arrivals = 0;
+    sim->lightSleep = false;
+    sim->lightSleepUs = 0;
+    sim->streamed = false;
+
+    //fresh RAM for every wake, like after a real reset
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        simHeapTrack();
+        setup();
+        //setup() ends in deep sleep, unless the wake streams: then loop() goes on until it 
+        //sleeps. A loop() that does not move the clock on is not streaming
+        for (uint64_t last = ~0ULL; sim->nowUs != last && sim->nowUs < SIM_STREAM_MAX_US; ) {
+            last = sim->nowUs;
+            loop();
+        }
+        _exit(2);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !sim->slept) {
+        fprintf(stderr, "cycle %lu: wake did not end in deep sleep (status %d)\n", cycle, status);
+        totals->failedWakes++;
+        sim->sleepUs = 60 * 1000000ULL;
+        sim->sleepMode = RF_DEFAULT;
+    }
+
+    //the sleep timer is off by a fixed ratio
+    uint64_t sleptUs = (uint64_t)(sim->sleepUs * (1 + drift));
+    double awakeMs = sim->nowUs / 1000.0;
+    double sleepS = sleptUs / 1e6;
+    double lightMs = sim->lightSleepUs / 1000.0;
+    double wakeMas = (awakeMs - lightMs) / 1000 * (rfEnabled ? simConfig.radioMa : simConfig.cpuMa) 
+        + lightMs / 1000 * simConfig.lightSleepMa + sleepS * simConfig.sleepMa;
+    statAdd(rfEnabled ? &totals->awakeUpload : &totals->awakeSample, awakeMs);
+    statAdd(&totals->awakeAll, awakeMs);
+    statAdd(&totals->energy, wakeMas * simConfig.volts);
+    statAdd(&totals->heapPeak, sim->heapPeak);
+    totals->wakes++;
+    totals->totalMas += wakeMas;
+    totals->totalUs += sim->nowUs + sleptUs;
+
+    totals->wifiFull += sim->wifiFull;
+    totals->wifiFast += sim->wifiFast;
+    totals->tlsFull += sim->tlsFull;
+    totals->tlsResumed += sim->tlsResumed;
+    totals->publishes += sim->publishes;
+    totals->publishFails += sim->publishFails;
+    totals->publishesLost += sim->publishesLost;
+    totals->qos1Publishes += sim->qos1Publishes;
+    totals->publishedBytes += sim->publishedBytes;
+    totals->readingsSent += sim->readingsSent;
+    totals->droppedReported += sim->droppedReported;
+    totals->mqttFails += sim->mqttFails;
+    totals->callHomes += sim->callHomes;
+    totals->spiffsMounts += sim->spiffsMounts;
+    totals->flashErases += sim->flashErases;
+    totals->timerSleeps += sim->timerSleep;
+    if (sim->streamed) {
+        statAdd(&totals->streamReadingMs, sim->streamReadingMs);
+        statAdd(&totals->streamLatencyMean, sim->streamLatencyMs[1]);
+        statAdd(&totals->streamLatencyMax, sim->streamLatencyMs[2]);
+        totals->streamUs += sim->nowUs;
+        totals->streamReadings += sim->readingsSent;
+    }
+    for (uint8_t i = 0; i < sim->connects; i++)
+        statAdd(&totals->connectMs, sim->connectUs[i] / 1000.0);
+    totals->arrivalUs.insert(totals->arrivalUs.end(), sim->arrivalUs, sim->arrivalUs + sim->arrivals);
+    return sleptUs;
+}
+
+// power on: erased app data flash, RTC memory content is random
+static void powerOn(uint32_t chipId) {
+    sim->chipId = chipId;
+    sim->temperature = simConfig.tempStart;
+    memset(sim->serverSession, 0, sizeof(sim->serverSession));
+    memset(sim->shadowReported, 0, sizeof(sim->shadowReported));
+    memset(sim->flash, 0xFF, sizeof(sim->flash));
+    for (size_t i = 0; i < sizeof(sim->rtcMem); i++)
+        sim->rtcMem[i] = simRandom();
+}
+
+static void runSingle(simTotalsDef* totals, unsigned long cycles) {
+    uint64_t outageEndUs = 0;
+    bool rfEnabled = true;
+
+    powerOn(simRandom() & 0xFFFFFF);
+    for (unsigned long cycle = 0; cycle < cycles; cycle++) {
+        uint64_t sleptUs = runWake(totals, cycle, rfEnabled, simConfig.sleepDrift, &outageEndUs);
+        sim->wallUs += sim->nowUs + sleptUs;
+        //reset to reset, i.e. the reporting cadence
+        if (cycle + 1 < cycles)
+            statAdd(&totals->interval, (sim->nowUs + sleptUs) / 1e6);
+        rfEnabled = sim->sleepMode != RF_DISABLED;
+    }
+}
+
+#define SIM_APPDATA_SECTORS ((SIM_APPDATA_END - SIM_APPDATA_BEGIN) / SPI_FLASH_SEC_SIZE)
+
+// what a device keeps between its wakes while the others run
+typedef struct {
+    uint32_t chipId;
+    uint8_t rtcMem[SIM_RTC_SIZE];
+    uint8_t serverSession[32];
+    char shadowReported[SIM_MAX_FIELDS][SIM_SHADOW_VALUE];
+    double temperature;
+    double drift;                   // sleep timer error of this device
+    uint64_t wallUs;                // fleet time of the next wake
+    uint64_t outageEndUs;
+    unsigned long cycle;
+    bool rfEnabled;
+    std::vector<uint8_t> sectors[SIM_APPDATA_SECTORS];     // app data flash, empty - erased
+} simDeviceDef;
+
+static void deviceLoad(const simDeviceDef* device) {
+    sim->chipId = device->chipId;
+    memcpy(sim->rtcMem, device->rtcMem, sizeof(sim->rtcMem));
+    memcpy(sim->serverSession, device->serverSession, sizeof(sim->serverSession));
+    memcpy(sim->shadowReported, device->shadowReported, sizeof(sim->shadowReported));
+    sim->temperature = device->temperature;
+    sim->wallUs = device->wallUs;
+    for (size_t i = 0; i < SIM_APPDATA_SECTORS; i++) {
+        uint8_t* sector = sim->flash + SIM_APPDATA_BEGIN + i * SPI_FLASH_SEC_SIZE;
+        if (device->sectors[i].empty())
+            memset(sector, 0xFF, SPI_FLASH_SEC_SIZE);
+        else
+            memcpy(sector, device->sectors[i].data(), SPI_FLASH_SEC_SIZE);
+    }
+}
+
+static void deviceSave(simDeviceDef* device) {
+    memcpy(device->rtcMem, sim->rtcMem, sizeof(sim->rtcMem));
+    memcpy(device->serverSession, sim->serverSession, sizeof(sim->serverSession));
+    memcpy(device->shadowReported, sim->shadowReported, sizeof(sim->shadowReported));
+    device->temperature = sim->temperature;
+    for (size_t i = 0; i < SIM_APPDATA_SECTORS; i++) {
+        const uint8_t* sector = sim->flash + SIM_APPDATA_BEGIN + i * SPI_FLASH_SEC_SIZE;
+        size_t j = 0;
+        while (j < SPI_FLASH_SEC_SIZE && sector[j] == 0xFF)
+            j++;
+        if (j == SPI_FLASH_SEC_SIZE)
+            device->sectors[i].clear();
+        else
+            device->sectors[i].assign(sector, sector + SPI_FLASH_SEC_SIZE);
+    }
+}
+
+// the devices take turns in order of their next wake
+static void runFleet(simTotalsDef* totals, unsigned long cycles, unsigned long devices) {
+    std::vector<simDeviceDef> fleet(devices);
+    typedef std::pair<uint64_t, unsigned long> wakeDef;
+    std::priority_queue<wakeDef, std::vector<wakeDef>, std::greater<wakeDef> > wakes;
+
+    //a production batch has consecutive chip IDs
+    uint32_t firstId = simRandom() & 0xFFFFFF;
+    for (unsigned long d = 0; d < devices; d++) {
+        simDeviceDef* device = &fleet[d];
+        powerOn(firstId + d);
+        device->wallUs = (uint64_t)(simUniform() * simConfig.powerOnSpread * 1e6);
+        device->drift = simConfig.sleepDrift + simConfig.driftSpread * (2 * simUniform() - 1);
+        device->rfEnabled = true;
+        deviceSave(device);
+        device->chipId = firstId + d;
+        wakes.push(wakeDef(device->wallUs, d));
+    }
+
+    while (!wakes.empty()) {
+        simDeviceDef* device = &fleet[wakes.top().second];
+        wakes.pop();
+        deviceLoad(device);
+        uint64_t sleptUs = runWake(totals, device->cycle, device->rfEnabled, device->drift, &device->outageEndUs);
+        deviceSave(device);
+        if (device->cycle + 1 < cycles)
+            statAdd(&totals->interval, (sim->nowUs + sleptUs) / 1e6);
+        device->wallUs += sim->nowUs + sleptUs;
+        device->rfEnabled = sim->sleepMode != RF_DISABLED;
+        if (++device->cycle < cycles)
+            wakes.push(wakeDef(device->wallUs, wakeDef::second_type(device - &fleet[0])));
+    }
+}
+
+// ingestion is a single queue served brokerIngestMs per message, in order of arrival
+static void printFleet(simTotalsDef* totals, unsigned long devices) {
+    std::vector<uint64_t>& arrivals = totals->arrivalUs;
+    std::sort(arrivals.begin(), arrivals.end());
+    uint64_t service = (uint64_t)(simConfig.brokerIngestMs * 1000);
+    uint64_t freeUs = 0;
+    statDef backlog = {};
+    std::map<uint64_t, unsigned long> perSecond;
+    for (size_t i = 0; i < arrivals.size(); i++) {
+        uint64_t t = arrivals[i];
+        statAdd(&backlog, service && freeUs > t ? (freeUs - t + service - 1) / service : 0);
+        freeUs = (freeUs > t ? freeUs : t) + service;
+        perSecond[t / 1000000]++;
+    }
+    unsigned long peak = 0;
+    for (std::map<uint64_t, unsigned long>::iterator i = perSecond.begin(); i != perSecond.end(); ++i)
+        if (i->second > peak)
+            peak = i->second;
+    unsigned long arrived = arrivals.size();
+    double seconds = arrived > 1 ? (arrivals.back() - arrivals.front()) / 1e6 : 0;
+    printf("broker (%lu devices):\n", devices);
+    printf("  messages                      %lu, %.2f/s average, %lu/s peak\n", arrived, 
+        seconds > 0 ? arrived / seconds : 0, peak);
+    printf("connect latency (ms), TLS and CONNECT:\n");
+    statPrintPercentiles("all", &totals->connectMs);
+    printf("broker backlog (messages queued ahead of each):\n");
+    statPrintPercentiles("all", &backlog);
+    printf("FLEET version=%s devices=%lu messages=%lu peak_per_s=%lu connect_p50_ms=%.1f connect_p99_ms=%.1f backlog_p99=%.0f backlog_max=%.0f\n",
+        simAppVersion, devices, arrived, peak, statPercentile(&totals->connectMs, 0.5), statPercentile(&totals->connectMs, 0.99),
+        statPercentile(&backlog, 0.99), arrived ? backlog.max : 0);
+}
+
+int main(int argc, char** argv) {
+    unsigned long cycles = 1000;
+    unsigned long devices = 1;
+    uint32_t seed = 1;
+
+    if (!parseArgs(argc, argv, &cycles, &devices, &seed) || devices == 0) {
+        fprintf(stderr, "usage: %s [--cycles=N] [--devices=N] [--seed=N] [--verbose] [--<option>=value ...] [--field.<name>=value ...] [--desired.<path>=value ...]\noptions:", argv[0]);
+        for (size_t o = 0; o < OPTION_COUNT; o++)
+            fprintf(stderr, " %s", options[o].name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    sim = (simStateDef*)mmap(NULL, sizeof(simStateDef), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sim == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(sim, 0, sizeof(simStateDef));
+    sim->rng = seed ? seed : 1;
+
+    simTotalsDef* totals = new simTotalsDef();
+    if (devices > 1)
+        runFleet(totals, cycles, devices);
+    else
+        runSingle(totals, cycles);
+
+    double hours = totals->totalUs / 3.6e9;
+    double avgMa = hours > 0 ? totals->totalMas / 3600 / hours : 0;
+    printf("TempMon %s wake cycle simulation, seed %u\n", simAppVersion, seed);
+    printf("  cycles %lu, simulated %.1f h, wakes not ending in deep sleep: %lu\n", totals->wakes, hours, totals->failedWakes);
+    printf("awake time per wake (ms):\n");
+    statPrint("radio on", &totals->awakeUpload);
+    statPrint("radio off", &totals->awakeSample);
+    statPrint("all", &totals->awakeAll);
+    printf("energy per wake (mJ):\n");
+    statPrint("all", &totals->energy);
+    printf("heap high-water mark per wake (bytes):\n");
+    statPrint("all", &totals->heapPeak);
+    printf("wake interval (s):\n");
+    statPrint("all", &totals->interval);
+    printf("network:\n");
+    printf("  wifi connects full/fast       %lu/%lu\n", totals->wifiFull, totals->wifiFast);
+    printf("  tls handshakes full/resumed   %lu/%lu\n", totals->tlsFull, totals->tlsResumed);
+    printf("  mqtt connect failures         %lu\n", totals->mqttFails);
+    printf("  publishes ok/failed           %lu/%lu (%llu bytes)\n", totals->publishes, totals->publishFails, (unsigned long long)totals->publishedBytes);
+    printf("  publishes QoS1/lost           %lu/%lu\n", totals->qos1Publishes, totals->publishesLost);
+    printf("  wakes in AP outage            %lu\n", totals->outageWakes);
+    printf("  wakes cut short by a timer    %lu\n", totals->timerSleeps);
+    printf("  readings delivered/dropped    %llu/%llu\n", (unsigned long long)totals->readingsSent, (unsigned long long)totals->droppedReported);
+    printf("  fw update checks              %lu\n", totals->callHomes);
+    printf("  spiffs mounts                 %lu\n", totals->spiffsMounts);
+    printf("  flash sector erases           %lu\n", totals->flashErases);
+    if (totals->streamReadingMs.count) {
+        printf("streaming wakes (firmware report):\n");
+        statPrint("ms between readings", &totals->streamReadingMs);
+        statPrint("publish latency mean", &totals->streamLatencyMean);
+        statPrint("publish latency max", &totals->streamLatencyMax);
+        printf("  readings delivered per s      %.2f\n", totals->streamUs ? totals->streamReadings / (totals->streamUs / 1e6) : 0);
+    }
+    printf("power:\n");
+    printf("  average current               %.1f uA\n", avgMa * 1000);
+    printf("  battery life (%.0f mAh)       %.0f days\n", simConfig.batteryMah, avgMa > 0 ? simConfig.batteryMah / avgMa / 24 : 0);
+    if (devices > 1)
+        printFleet(totals, devices);
+
+    //one line summary to track across versions
+    printf("BENCHMARK version=%s cycles=%lu awake_ms=%.1f radio_on_ms=%.1f energy_mj=%.3f avg_current_ua=%.1f battery_days=%.0f heap_peak=%.0f\n",
+        simAppVersion, totals->wakes, statMean(&totals->awakeAll), statMean(&totals->awakeUpload), statMean(&totals->energy), avgMa * 1000,
+        avgMa > 0 ? simConfig.batteryMah / avgMa / 24 : 0, totals->heapPeak.max);
+    return totals->failedWakes ? 2 : 0;
+}
+
+#endif
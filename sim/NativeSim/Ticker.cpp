@@ -0,0 +1,51 @@
+#include <Ticker.h>
+#include "Sim.h"
+
+// armed one-shot timers of the current wake
+
+#define SIM_MAX_TIMERS      4
+static Ticker* timers[SIM_MAX_TIMERS];
+bool simInTimer;
+bool simTimerFired;
+
+void Ticker::once_ms(uint32_t ms, callback_function_t callback) {
+    detach();
+    for (int i = 0; i < SIM_MAX_TIMERS; i++) {
+        if (!timers[i]) {
+            timers[i] = this;
+            _armed = true;
+            _dueUs = sim->nowUs + (uint64_t)ms * 1000;
+            _callback = callback;
+            return;
+        }
+    }
+}
+
+void Ticker::detach() {
+    for (int i = 0; i < SIM_MAX_TIMERS; i++)
+        if (timers[i] == this)
+            timers[i] = NULL;
+    _armed = false;
+}
+
+void simTimersRun(uint64_t untilUs) {
+    //a callback may not be interrupted by another one
+    if (simInTimer)
+        return;
+    for (;;) {
+        Ticker* next = NULL;
+        for (int i = 0; i < SIM_MAX_TIMERS; i++)
+            if (timers[i] && timers[i]->_dueUs <= untilUs && (!next || timers[i]->_dueUs < next->_dueUs))
+                next = timers[i];
+        if (!next)
+            return;
+        if (next->_dueUs > sim->nowUs)
+            sim->nowUs = next->_dueUs;
+        Ticker::callback_function_t callback = next->_callback;
+        next->detach();
+        simInTimer = true;
+        simTimerFired = true;
+        callback();
+        simInTimer = false;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef SIM_TICKER_H
+#define SIM_TICKER_H
+
+#include <stdint.h>
+#include <functional>
+
+// once_ms() runs on the virtual clock: the callback fires in timer context as soon 
+// as the clock passes its due time, i.e. in the middle of whatever the firmware is
+// waiting for. attach_ms() only drives the LED and never fires
+class Ticker {
+    public:
+        typedef std::function<void(void)> callback_function_t;
+        ~Ticker() { detach(); }
+        void attach_ms(uint32_t ms, callback_function_t callback) {}
+        void once_ms(uint32_t ms, callback_function_t callback);
+        void detach();
+        bool active() { return _armed; }
+
+        bool _armed = false;
+        uint64_t _dueUs = 0;
+        callback_function_t _callback;
+};
+
+// run the callbacks of timers due by untilUs, in order of their due time
+void simTimersRun(uint64_t untilUs);
+// a timer callback is running (SDK system context on the device)
+extern bool simInTimer;
+// a timer callback has run this wake
+extern bool simTimerFired;
+
+#endif
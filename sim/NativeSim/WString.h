@@ -0,0 +1,24 @@
+#ifndef SIM_WSTRING_H
+#define SIM_WSTRING_H
+
+#include <string>
+
+// minimal Arduino String, backed by std::string
+class String {
+    public:
+        String() {}
+        String(const char* s) : _s(s ? s : "") {}
+        String(const std::string& s) : _s(s) {}
+        const char* c_str() const { return _s.c_str(); }
+        unsigned int length() const { return _s.length(); }
+        String& operator+=(const char* s) { _s += s; return *this; }
+        String& operator+=(char c) { _s += c; return *this; }
+        bool concat(char c) { _s += c; return true; }
+        bool concat(const char* s) { _s += s; return true; }
+        bool operator==(const char* s) const { return _s == s; }
+        char operator[](unsigned int i) const { return _s[i]; }
+    private:
+        std::string _s;
+};
+
+#endif
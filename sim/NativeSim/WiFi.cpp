@@ -0,0 +1,200 @@
+#include <ESP8266WiFi.h>
+#include <deque>
+
+ESP8266WiFiClass WiFi;
+
+static const uint8_t apBssid[6] = { 0x5C, 0x49, 0x79, 0x12, 0x34, 0x56 };
+#define AP_CHANNEL 6
+
+static bool staticIp;
+static bool started;
+static uint64_t connectAtUs;
+static bool gotIP;
+static std::weak_ptr<WiFiEventHandlerOpaque> gotIPHandler;
+//bytes from the broker on the TLS socket and their arrival time
+static std::deque<std::pair<uint64_t, uint8_t> > socketRx;
+
+//association runs in the background, like on the device
+static wl_status_t startConnect(double latencyMs, bool reachable) {
+    started = true;
+    gotIP = false;
+    connectAtUs = reachable ? sim->nowUs + (uint64_t)(latencyMs * 1000) : UINT64_MAX;
+    return WL_DISCONNECTED;
+}
+
+wl_status_t ESP8266WiFiClass::begin() {
+    if (!sim->rfEnabled)
+        return WL_DISCONNECTED;
+    sim->wifiFull++;
+    return startConnect(simJitter(simConfig.wifiFullMs), !sim->wifiDown);
+}
+
+wl_status_t ESP8266WiFiClass::begin(const char* ssid, const char* passphrase, int32_t channel, const uint8_t* bssid, bool connect) {
+    if (!sim->rfEnabled)
+        return WL_DISCONNECTED;
+
+    //directed connect with static IP skips scan and DHCP
+    if (channel && bssid && staticIp) {
+        sim->wifiFast++;
+        bool valid = channel == AP_CHANNEL && memcmp(bssid, apBssid, sizeof(apBssid)) == 0 && !sim->apMoved;
+        return startConnect(simJitter(simConfig.wifiFastMs), valid && !sim->wifiDown);
+    }
+    sim->wifiFull++;
+    return startConnect(simJitter(simConfig.wifiFullMs), !sim->wifiDown);
+}
+
+bool ESP8266WiFiClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+    staticIp = (uint32_t)local_ip != 0;
+    return true;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifioff) {
+    started = false;
+    gotIP = false;
+    return true;
+}
+
+bool ESP8266WiFiClass::isConnected() {
+    if (!started || sim->nowUs < connectAtUs)
+        return false;
+    if (!gotIP) {
+        gotIP = true;
+        std::shared_ptr<WiFiEventHandlerOpaque> handler = gotIPHandler.lock();
+        if (handler) {
+            WiFiEventStationModeGotIP event;
+            event.ip = localIP();
+            handler->onGotIP(event);
+        }
+    }
+    return true;
+}
+
+//light sleep is only entered when the CPU idles in delay()
+bool ESP8266WiFiClass::setSleepMode(WiFiSleepType_t type, uint8_t listenInterval) {
+    sim->lightSleep = type == WIFI_LIGHT_SLEEP;
+    return true;
+}
+
+wl_status_t ESP8266WiFiClass::status() {
+    return isConnected() ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+int32_t ESP8266WiFiClass::RSSI() {
+    if (!sim->rfEnabled)
+        return 31;
+    return (int32_t)(simConfig.rssi + 4 * (simUniform() - 0.5));
+}
+
+uint8_t* ESP8266WiFiClass::BSSID() {
+    static uint8_t bssid[6];
+    memcpy(bssid, apBssid, sizeof(bssid));
+    return bssid;
+}
+
+int32_t ESP8266WiFiClass::channel() {
+    return AP_CHANNEL;
+}
+
+IPAddress ESP8266WiFiClass::localIP() {
+    return isConnected() ? IPAddress(192, 168, 1, 42) : IPAddress();
+}
+
+IPAddress ESP8266WiFiClass::gatewayIP() {
+    return IPAddress(192, 168, 1, 1);
+}
+
+IPAddress ESP8266WiFiClass::subnetMask() {
+    return IPAddress(255, 255, 255, 0);
+}
+
+IPAddress ESP8266WiFiClass::dnsIP(uint8_t dns_no) {
+    return IPAddress(192, 168, 1, 1);
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)> f) {
+    WiFiEventHandler handler = std::make_shared<WiFiEventHandlerOpaque>();
+    handler->onGotIP = f;
+    gotIPHandler = handler;
+    return handler;
+}
+
+namespace BearSSL {
+
+//the broker resumes a session only if it issued that session ID last time
+int WiFiClientSecure::connect(const char* host, uint16_t port) {
+    _connected = false;
+    socketRx.clear();
+    if (!WiFi.isConnected())
+        return 0;
+
+    bool offered = _session && _session->_session_id_len && 
+        memcmp(_session->_session_id, sim->serverSession, sizeof(sim->serverSession)) == 0;
+    if (offered && !simChance(simConfig.tlsRejectRate)) {
+        simClockAdvance(simBrokerConnect(true));
+        simAdvance(simConfig.tlsResumeMs);
+        sim->tlsResumed++;
+    }
+    else {
+        simClockAdvance(simBrokerConnect(false));
+        simAdvance(simConfig.tlsFullMs);
+        sim->tlsFull++;
+        for (size_t i = 0; i < sizeof(sim->serverSession); i++)
+            sim->serverSession[i] = simRandom();
+        if (_session) {
+            memcpy(_session->_session_id, sim->serverSession, sizeof(_session->_session_id));
+            _session->_session_id_len = sizeof(_session->_session_id);
+            for (size_t i = 0; i < sizeof(_session->_master_secret); i++)
+                _session->_master_secret[i] = simRandom();
+        }
+    }
+    _connected = true;
+    return 1;
+}
+
+size_t WiFiClientSecure::write(const uint8_t* buf, size_t size) {
+    if (!_connected)
+        return 0;
+    simSocketWrite(buf, size);
+    return size;
+}
+
+int WiFiClientSecure::available() {
+    int n = 0;
+    for (size_t i = 0; i < socketRx.size() && socketRx[i].first <= sim->nowUs; i++)
+        n++;
+    return _connected ? n : 0;
+}
+
+int WiFiClientSecure::peek() {
+    return available() ? socketRx.front().second : -1;
+}
+
+int WiFiClientSecure::read() {
+    if (!available())
+        return -1;
+    uint8_t b = socketRx.front().second;
+    socketRx.pop_front();
+    return b;
+}
+
+int WiFiClientSecure::read(uint8_t* buf, size_t size) {
+    size_t n = 0;
+    while (n < size && available())
+        buf[n++] = read();
+    return n;
+}
+
+void WiFiClientSecure::stop() {
+    _connected = false;
+    socketRx.clear();
+}
+
+};
+
+void simSocketReceive(const uint8_t* data, size_t n, uint64_t atUs) {
+    //TCP keeps the order
+    if (!socketRx.empty() && atUs < socketRx.back().first)
+        atUs = socketRx.back().first;
+    for (size_t i = 0; i < n; i++)
+        socketRx.push_back(std::make_pair(atUs, data[i]));
+}
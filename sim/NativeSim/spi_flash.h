@@ -0,0 +1,8 @@
+#ifndef SIM_SPI_FLASH_H
+#define SIM_SPI_FLASH_H
+
+// ESP8266 SDK stand-in. Flash access goes through ESP.flashRead/flashWrite
+
+#define SPI_FLASH_SEC_SIZE      4096
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef SIM_USER_INTERFACE_H
+#define SIM_USER_INTERFACE_H
+
+// ESP8266 SDK stand-in. RTC memory lives in the simulation shared state
+
+#include <stdint.h>
+#include <stdbool.h>
+
+bool system_rtc_mem_read(uint8_t src_addr, void* des_addr, uint16_t load_size);
+bool system_rtc_mem_write(uint8_t des_addr, const void* src_addr, uint16_t save_size);
+uint32_t system_get_rtc_time(void);
+uint32_t system_rtc_clock_cali_proc(void);
+bool system_deep_sleep_set_option(uint8_t option);
+bool system_deep_sleep(uint64_t time_in_us);
+
+#endif
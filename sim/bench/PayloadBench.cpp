@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <JsonWriter.h>
+#include <SampleRing.h>
+#include <PhaseProfile.h>
+
+// Payload serializer benchmark: JsonWriter into a static buffer (1.12.0) builds a
+// content batch and a shadow update from fixed data. Time and heap per message, the
+// output is checked against the expected documents.
+//   pio run -e native_bench && .pio/build/native_bench/program [iterations]
+
+#ifndef MQTT_MAX_PACKET_SIZE
+#define MQTT_MAX_PACKET_SIZE 1024
+#endif
+
+// heap accounting for everything allocated with new while a message is built
+static size_t heapUsed, heapPeak, heapAllocs;
+
+typedef struct {
+    size_t size;
+} heapHeaderDef __attribute__((aligned(16)));
+
+void* operator new(size_t size) {
+    heapHeaderDef* h = (heapHeaderDef*)malloc(sizeof(heapHeaderDef) + size);
+    if (!h)
+        throw std::bad_alloc();
+    h->size = size;
+    heapUsed += size;
+    heapAllocs++;
+    if (heapUsed > heapPeak)
+        heapPeak = heapUsed;
+    return h + 1;
+}
+
+void operator delete(void* p) noexcept {
+    if (!p)
+        return;
+    heapHeaderDef* h = (heapHeaderDef*)p - 1;
+    heapUsed -= h->size;
+    free(h);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+static const char* thingName = "TempMon-00042021";
+static const char* contentTopic = "MyHouse/Room1/Temperature";
+static sampleRingDef samples;
+static phaseProfileDef profile;
+static char msgBuffer[MQTT_MAX_PACKET_SIZE];
+
+#define BATCH_SIZE  12
+
+//same data on every run, the expected documents below depend on it
+static void setupData() {
+    sampleRingReset(&samples);
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        sampleRingPush(&samples, samples.clock, 2150 + (i % 5) * 25 - (i % 3) * 50, 0);
+        samples.clock += 300;
+    }
+    phaseProfileReset(&profile);
+    for (int c = 0; c < 288; c++)
+        for (int i = 0; i < PHASE_COUNT; i++)
+            phaseProfileAdd(&profile, i, 20 + (c * 7 + i * 13) % 900);
+}
+
+// 1.12.0 serializers
+static void contentJsonWriter(JsonWriter& json) {
+    json.beginObject();
+    json.add("sensor", thingName);
+    json.beginArray("temperature");
+    for (int i = 0; i < samples.count; i++)
+        json.itemFixed(sampleRingAt(&samples, i)->temp, 2);
+    json.endArray();
+    json.beginArray("age");
+    for (int i = 0; i < samples.count; i++)
+        json.item(samples.clock - sampleRingAt(&samples, i)->time);
+    json.endArray();
+    json.endObject();
+}
+
+static void shadowJsonWriter(JsonWriter& json) {
+    json.beginObject();
+    json.beginObject("state");
+    json.beginObject("reported");
+    json.add("sensor", thingName);
+    json.add("topic", contentTopic);
+    json.add("battery", 3144);
+    json.add("rxlev", -62);
+    json.add("wifi_fast", 1);
+    json.add("tls_resumed", 287);
+    json.add("tls_full", 1);
+    json.add("AppName", "TempMon");
+    json.add("Version", "1.12.0");
+    json.add("CompileDate", "Jan  1 202012:00:00");
+    json.beginObject("timing");
+    json.add("cycles", profile.stat[PHASE_AWAKE].count);
+    for (int i = 0; i < PHASE_COUNT; i++){
+        json.beginArray(phaseNames[i]);
+        json.item(profile.stat[i].min);
+        json.item(phaseProfileMean(&profile, i));
+        json.item(profile.stat[i].max);
+        json.endArray();
+    }
+    json.add("overlap", 94);
+    json.endObject();
+    json.endObject();
+    json.endObject();
+    json.endObject();
+}
+
+typedef struct {
+    double nsPerMsg;
+    size_t length;
+    size_t heapPeak;
+    double allocsPerMsg;
+} benchResultDef;
+
+template <typename F>
+static benchResultDef run(long iterations, F build) {
+    benchResultDef r;
+    heapUsed = heapPeak = heapAllocs = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++)
+        r.length = build();
+    auto end = std::chrono::steady_clock::now();
+    r.nsPerMsg = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    r.heapPeak = heapPeak;
+    r.allocsPerMsg = (double)heapAllocs / iterations;
+    return r;
+}
+
+static void print(const char* name, const benchResultDef& r, size_t stack) {
+    printf("  %-24s %8.0f ns  %5zu bytes  heap peak %5zu bytes  %5.1f allocs/msg  stack %5zu bytes\n",
+        name, r.nsPerMsg, r.length, r.heapPeak, r.allocsPerMsg, stack);
+}
+
+static const char* expectedContent = "{\"sensor\":\"TempMon-00042021\","
+    "\"temperature\":[21.5,21.25,21,22.25,22,20.5,21.75,21.5,21.25,22.5,21,20.75],"
+    "\"age\":[3600,3300,3000,2700,2400,2100,1800,1500,1200,900,600,300]}";
+static const char* expectedShadow = "{\"state\":{\"reported\":{\"sensor\":\"TempMon-00042021\","
+    "\"topic\":\"MyHouse/Room1/Temperature\",\"battery\":3144,\"rxlev\":-62,\"wifi_fast\":1,"
+    "\"tls_resumed\":287,\"tls_full\":1,\"AppName\":\"TempMon\",\"Version\":\"1.12.0\","
+    "\"CompileDate\":\"Jan  1 202012:00:00\",\"timing\":{\"cycles\":288,\"boot\":[20,437,919],"
+    "\"config\":[22,436,918],\"spiffs\":[21,436,917],\"cert\":[20,435,916],\"sensor\":[22,439,919],"
+    "\"wifi\":[21,439,918],\"mqtt\":[20,440,917],\"publish\":[23,444,919],\"awake\":[22,445,918],"
+    "\"overlap\":94}}}}";
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 100000;
+    setupData();
+
+    JsonWriter json(msgBuffer, sizeof(msgBuffer));
+    contentJsonWriter(json);
+    bool contentSame = json.ok() && strcmp(json.c_str(), expectedContent) == 0;
+    json.reset();
+    shadowJsonWriter(json);
+    bool shadowSame = json.ok() && strcmp(json.c_str(), expectedShadow) == 0;
+
+    benchResultDef content = run(iterations, []() { 
+        JsonWriter json(msgBuffer, sizeof(msgBuffer)); contentJsonWriter(json); return json.length(); });
+    benchResultDef shadow = run(iterations, []() { 
+        JsonWriter json(msgBuffer, sizeof(msgBuffer)); shadowJsonWriter(json); return json.length(); });
+
+    //the buffer is a static, the writer itself is all there is on the stack
+    printf("payload serializer, %ld iterations, %d readings per batch\n", iterations, BATCH_SIZE);
+    print("JsonWriter content", content, sizeof(JsonWriter));
+    print("JsonWriter shadow", shadow, sizeof(JsonWriter));
+    printf("  static buffer %d bytes, output as expected: content %s, shadow %s\n", MQTT_MAX_PACKET_SIZE,
+        contentSame ? "yes" : "no", shadowSame ? "yes" : "no");
+
+    //a buffer that is too small must fail, never produce a truncated message
+    char small[64];
+    JsonWriter tooSmall(small, sizeof(small));
+    shadowJsonWriter(tooSmall);
+    printf("  shadow into %zu bytes: %s\n", sizeof(small), tooSmall.ok() ? "ok (unexpected)" : "rejected");
+
+    printf("BENCHMARK serializer content_ns=%.0f shadow_ns=%.0f heap_peak=%zu\n",
+        content.nsPerMsg, shadow.nsPerMsg, std::max(content.heapPeak, shadow.heapPeak));
+    return tooSmall.ok() || !contentSame || !shadowSame;
+}
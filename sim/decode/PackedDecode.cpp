@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <PackedPayload.h>
+
+// Host decoder for packed content messages (format "packed"). Reads one message
+// from stdin and prints it as the JSON the device sends with format "json".
+//   pio run -e native_decode && .pio/build/native_decode/program < message.bin
+
+static uint8_t message[64 * 1024];
+static packedMessageDef packed;
+
+static void printFixed(int32_t value) {
+    printf("%s%d.%02d", value < 0 ? "-" : "", (int)(value < 0 ? -value : value) / 100, (int)(value < 0 ? -value : value) % 100);
+}
+
+static void printRom(uint8_t sensor) {
+    printf("\"");
+    for (int j = 0; j < PACKED_ROM_SIZE; j++)
+        printf("%02X", packed.rom[sensor][j]);
+    printf("\":{");
+}
+
+static void printReadings(int sensor) {
+    const char* sep = "";
+    printf("\"temperature\":[");
+    for (uint16_t i = 0; i < packed.count; i++)
+        if (sensor < 0 || packed.readings[i].sensor == sensor) {
+            printf("%s", sep);
+            printFixed(packed.readings[i].temp);
+            sep = ",";
+        }
+    sep = "";
+    printf("],\"age\":[");
+    for (uint16_t i = 0; i < packed.count; i++)
+        if (sensor < 0 || packed.readings[i].sensor == sensor) {
+            printf("%s%u", sep, packed.readings[i].age);
+            sep = ",";
+        }
+    printf("]");
+}
+
+static void printStats(const packedStatDef* stat) {
+    printf("\"n\":%u,\"temperature\":", stat->n);
+    printFixed(stat->mean);
+    printf(",\"min\":");
+    printFixed(stat->min);
+    printf(",\"max\":");
+    printFixed(stat->max);
+    printf(",\"sd\":");
+    printFixed(stat->sd);
+}
+
+int main(int argc, char** argv) {
+    size_t length = fread(message, 1, sizeof(message), stdin);
+    if (!packedDecode(message, length, &packed)) {
+        fprintf(stderr, "not a packed content message (%u bytes)\n", (unsigned)length);
+        return 1;
+    }
+
+    printf("{\"sensor\":\"%s\"", packed.name);
+    if (packed.type == PACKED_WINDOW) {
+        printf(",\"period\":%u,", packed.period);
+        if (packed.sensors > 1) {
+            printf("\"window\":{");
+            for (uint16_t i = 0; i < packed.count; i++) {
+                printf("%s", i ? "," : "");
+                printRom(packed.stats[i].sensor);
+                printStats(&packed.stats[i]);
+                printf("}");
+            }
+            printf("}");
+        }
+        else if (packed.count)
+            printStats(&packed.stats[0]);
+    }
+    else {
+        printf(",");
+        if (packed.sensors > 1) {
+            printf("\"readings\":{");
+            for (uint8_t s = 0, first = 1; s < packed.sensors; s++) {
+                uint16_t i = 0;
+                while (i < packed.count && packed.readings[i].sensor != s)
+                    i++;
+                if (i == packed.count)
+                    continue;
+                printf("%s", first ? "" : ",");
+                printRom(s);
+                printReadings(s);
+                printf("}");
+                first = 0;
+            }
+            printf("}");
+        }
+        else
+            printReadings(-1);
+        if (packed.dropped)
+            printf(",\"dropped\":%u", packed.dropped);
+    }
+    printf("}\n");
+    return 0;
+}
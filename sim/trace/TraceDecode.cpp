@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <TraceLog.h>
+#include <TraceEvents.h>
+
+// Host decoder for the binary trace (lib/TraceLog). Reads a serial log or a shadow
+// document from stdin and prints the wakes found in it, oldest first:
+//   lines "TRACE <hex>", as dumped to serial on cold boot (other lines are skipped)
+//   "trace":"<base64>", as attached to shadow updates
+//   pio run -e native_trace && .pio/build/native_trace/program < serial.log
+
+#define TRACE_FORMAT(id, format)    format,
+static const char* const formats[] = { TRACE_EVENTS(TRACE_FORMAT) };
+
+static char line[16 * 1024];
+static uint8_t data[8 * 1024];
+static unsigned long wakes;
+
+static size_t unhex(const char* text, uint8_t* out, size_t size) {
+    size_t n = 0;
+    unsigned int b;
+    while (n < size && sscanf(text, "%2x", &b) == 1) {
+        out[n++] = b;
+        text += 2;
+    }
+    return n;
+}
+
+static void printBlock(const uint8_t* block) {
+    traceBlockDef header;
+    memcpy(&header, block, sizeof(header));
+    printf("wake %lu, device clock %u s, reset reason %u", ++wakes, header.clock, header.flags);
+    if (header.lost)
+        printf(", %u events lost", header.lost);
+    printf("\n");
+
+    size_t pos = 0;
+    traceRecordDef record;
+    memset(&record, 0, sizeof(record));
+    while (traceRecord(block, &pos, &record)) {
+        printf("  %6u ms  ", record.ms);
+        if (record.event < TRACE_EVENT_COUNT)
+            printf(formats[record.event], record.args[0], record.args[1], record.args[2]);
+        else
+            printf("event %u (%d, %d, %d)", record.event, record.args[0], record.args[1], record.args[2]);
+        printf("\n");
+        memset(record.args, 0, sizeof(record.args));
+    }
+}
+
+// blocks back to back, as in flash
+static void printBlocks(const uint8_t* blocks, size_t length) {
+    size_t pos = 0;
+    while (pos < length) {
+        size_t size = traceBlockSize(blocks + pos, length - pos);
+        if (!size) {
+            printf("(%u bytes not valid)\n", (unsigned)(length - pos));
+            return;
+        }
+        printBlock(blocks + pos);
+        pos += size;
+    }
+}
+
+int main(int argc, char** argv) {
+    static const char key[] = "\"trace\":\"";
+    while (fgets(line, sizeof(line), stdin)) {
+        const char* text;
+        if (strncmp(line, "TRACE ", 6) == 0)
+            printBlocks(data, unhex(line + 6, data, sizeof(data)));
+        else if ((text = strstr(line, key)) != NULL)
+            printBlocks(data, traceUnbase64(text + sizeof(key) - 1, data, sizeof(data)));
+    }
+    if (!wakes) {
+        fprintf(stderr, "no trace found\n");
+        return 1;
+    }
+    return 0;
+}
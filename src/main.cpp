@@ -17,13 +17,25 @@
 #include <OneWire.h>
 #include <DallasTemperature.h>
 #include <PubSubClient.h>
-#include <ArduinoJson.h>
 #include <Ticker.h>
 #include <cert.h>
 #include <private.h>
+#include <TraceEvents.h>
+#include <SampleRing.h>
+#include <Crc32.h>
+#include <PhaseProfile.h>
+#include <JsonWriter.h>
+#include <FlashQueue.h>
+#include <UploadBackoff.h>
+#include <WindowStats.h>
+#include <PackedPayload.h>
+#include <TraceLog.h>
+#include <JsonScan.h>
+#include <MqttWindow.h>
 
 extern "C" {
     #include <user_interface.h>
+    #include <spi_flash.h>
 }
 
 ADC_MODE(ADC_VCC);
@@ -32,9 +44,9 @@ ADC_MODE(ADC_VCC);
 
 #define APPNAME "TempMon"
 //  Important: pls set
-//  MQTT_MAX_PACKET_SIZE = 512
+//  MQTT_MAX_PACKET_SIZE = 1024
 //  MQTT_KEEPALIVE=30
-//  MQTT_SOCKET_TIMEOUT=30
+//  MQTT_SOCKET_TIMEOUT=8 (a hung connect is not cut short by the connect budget)
 //
 //
 //  Version log:
@@ -49,32 +61,121 @@ ADC_MODE(ADC_VCC);
 //  version 1.5.0:      option to load cert and private key from flash memmory
 //  version 1.5.1:      Improved stability over various types of WiFi AP. 
 //                      MQTT_SOSCKET_TIMEOUT increased from 15 sec to 30 sec
-
-#define VERSION "1.5.1"
+//  version 1.6.0:      Readings are kept in RTC memory and uploaded in batches. Batch size and 
+//                      number of wakes between uploads are set via IAS fields
+//  version 1.7.0:      Sample-only wakes keep the radio off (WAKE_RF_DISABLED). Sleep time between
+//                      wakes is set via IAS field
+//  version 1.8.0:      Fast WiFi reconnect. Last AP (BSSID, channel) and IP lease are kept in RTC
+//                      memory and used for a directed connect with static IP on the next wake
+//  version 1.9.0:      TLS session is kept in RTC memory and resumed on the next wake. MQTT client 
+//                      uses BearSSL (core 2.5), IAS stays on axTLS (USING_AXTLS)
+//  version 1.9.1:      Content, backlog and shadow update are sent in a single MQTT session. 
+//                      FW update check is done after the MQTT session is closed
+//  version 1.10.0:     Temperature conversion runs in parallel with WiFi and MQTT connect. 
+//                      Sensor resolution is set only on cold boot (saves sensor EEPROM)
+//  version 1.11.0:     Wake phase timings (min/mean/max since last shadow update) are kept in
+//                      RTC memory and reported to shadow service. MQTT_MAX_PACKET_SIZE is now 1024
+//  version 1.12.0:     Messages are serialized by JsonWriter into a static buffer of MQTT_MAX_PACKET_SIZE
+//                      (no String, no ArduinoJson). A message that does not fit is not sent
+//  version 1.13.0:     Resolved configuration is cached in flash and used on warm wakes instead of
+//                      processing IAS fields. App data sectors are carved off the end of SPIFFS 
+//                      (eagle.flash.4m.tempmon.ld) - file system has to be uploaded again
+//  version 1.14.0:     Cert and private key are copied from SPIFFS to an app data flash sector on 
+//                      cold boot. Warm wakes load them from there without mounting SPIFFS
+//  version 1.15.0:     Report-on-change: readings that differ less than delta_threshold from the last
+//                      reported one are dropped, at least one reading per heartbeat wakes is reported
+//  version 1.16.0:     Offline queue. When uploads fail and RTC memory is full, readings are appended 
+//                      to a log in flash (12 sectors) and replayed in batches of 48 on the next upload
+//  version 1.17.0:     Wake budgets. A timer sends the device to deep sleep when a wake exceeds its total,
+//                      WiFi, TLS/MQTT connect or publish budget (IAS field, seconds). Hits go to shadow
+//  version 1.18.0:     Upload backoff. After consecutive failed uploads the next attempts are held off for
+//                      1, 3, 7, ... wakes (max 4 hours), faster on a weak link. Readings are still taken
+//  version 1.19.0:     Multiple DS18B20 (up to 4, one or more buses). ROM IDs are searched on cold boot and
+//                      kept in RTC memory, one conversion for all sensors. Readings are keyed by ROM ID
+//                      when there is more than one sensor. Offline queue format has changed
+//  version 1.20.0:     Aggregation. With window (IAS field) > 1 readings are not uploaded one by one, the
+//                      upload wake sends min/mean/max/sd over the window instead (running stats in RTC
+//                      memory). RTC memory layout has changed, sample ring holds 12 readings
+//  version 1.21.0:     Aligned schedule. Wakes are aligned to slots of sample_interval plus a per-device 
+//                      offset (chip ID). Time awake is taken off the sleep, the sleep timer skew is measured
+//                      against the broker's time (shadow update answer) and compensated
+//  version 1.22.0:     Packed payload. With format (IAS field) "packed" readings and windows are sent in a
+//                      compact binary format (lib/PackedPayload), the offline queue is replayed in batches
+//                      of 240. Shadow messages stay JSON
+//  version 1.23.0:     Shadow diffing. Hashes of the reported fields are kept in flash, a shadow update only
+//                      sends fields that have changed (all of them every 7th update). Battery and RSSI are
+//                      sent on any upload wake when they have moved by more than 50 mV / 6 dB
+//  version 1.24.0:     Binary trace. Wake events (ID, ms, up to 3 numbers) are kept in a 2 sector ring in flash,
+//                      one block per wake. Dumped to serial on cold boot, the newest blocks go to shadow updates
+//                      when trace (IAS field) is set. sim/trace decodes both
+//  version 1.25.0:     Shadow delta. The daily shadow update subscribes to .../update/delta: a desired "Version"
+//                      newer than this one starts the FW update check, desired "config" sets IAS fields (batch_size,
+//                      sample_interval, ...), reported back under "config". Without a delta the FW update check
+//                      and IAS field processing only run on full shadow updates (cold boot, every 7th update)
+//  version 1.26.0:     Streaming for mains-powered units. With stream (IAS field) "ms,s" upload wakes stay connected
+//                      up to the next slot, read the sensors every ms and publish every s, WiFi in light sleep in
+//                      between. Achieved reading interval and publish latency are reported under "stream"
+//  version 1.27.0:     QoS1 for content messages. Up to qos_window (IAS field, 0 = QoS0) publishes are in flight before
+//                      the first PUBACK has to come back. Readings stay in RTC memory/the offline queue until their
+//                      message is acknowledged, the ones that are not are sent again on the next upload
+
+#define VERSION "1.27.0"
 #define COMPDATE __DATE__ __TIME__
 #define MODEBUTTON 0    //GPIO00 (nodeMCU: D3 (FLASH))
 
 #define LED_PIN 2       //GPIO02 (nodeMCU: D4)
 
-#define REPORT_INTERVAL 60 //minutes
+#define REPORT_INTERVAL 60 //minutes, used if sample interval field is not valid
 
 //RSSI should be above this level for reliable operation
 #define RSSI_CRITICAL_LEVEL (-75)
 
+//longest hold of upload attempts after repeated failures
+#define BACKOFF_MAX_MINUTES (4 * 60)
+
+//clock sync: max ms to wait for the broker's time. The sleep timer skew is updated 
+//only if at least SKEW_MIN_MINUTES have passed since the last sync
+#define CLOCK_SYNC_TIMEOUT 2000
+#define SKEW_MIN_MINUTES 60
+//largest sleep timer skew that is corrected, 1/65536 (12.5%)
+#define SKEW_MAX 8192
+#define SKEW_UNKNOWN INT16_MIN
+
 //timeout for wifi reconnect after deep sleep (in multiples pof 500 ms)
 #define WIFI_RECONNECT_TIMEOUT 6
 
+//streaming: shortest ms between readings (9 bit conversion), longest wake (the RTC timer 
+//behind awakeUs() wraps after ~6 h), WiFi light sleep listen interval (DTIM periods) and 
+//ms before the next slot at which the wake closes its session
+#define STREAM_PERIOD_MIN 100
+#define STREAM_WAKE_MAX_MINUTES 60
+#define STREAM_LISTEN_INTERVAL 3
+#define STREAM_CLOSE_MS 500
+
 Ticker ticker;
 
 // Data wire is plugged into port 2 on the ESP8266
 // TODO: is this the best pin to use!!!
 #define ONE_WIRE_BUS 4     //GPIO04 (nodeMCU: D2) 
-OneWire oneWire(ONE_WIRE_BUS);
-DallasTemperature DS18B20(&oneWire);
-DeviceAddress DS18B20Address;
+//more buses on other GPIOs are added with an entry in both arrays
+OneWire oneWire[] = { OneWire(ONE_WIRE_BUS) };
+DallasTemperature DS18B20[] = { DallasTemperature(&oneWire[0]) };
+#define SENSOR_BUSES (sizeof(DS18B20) / sizeof(DS18B20[0]))
+#define SENSOR_MAX 4    //over all buses
+//readings keep the sensor index in the low bits and the sensor table they were taken with
+//(hash of the ROM IDs) in the high bits: a new ROM search may number the sensors differently
+#define SENSOR_INDEX_BITS 2
+#define SENSOR_INDEX_MASK ((1 << SENSOR_INDEX_BITS) - 1)
+static_assert(SENSOR_MAX <= (1 << SENSOR_INDEX_BITS), "sensor index does not fit in its bits");
+#define SENSOR_RESOLUTION 9
+boolean sensorsSearched;            //ROM search was done this wake
+unsigned long conversionStart;
+unsigned long conversionWait;       //ms spent waiting for the conversion to complete
+unsigned long conversionOverlap;    //ms of conversion that ran in parallel with other work
+boolean readingTaken;
 
 // number of params to be defined 
-const int _nrXF = 3;
+const int _nrXF = 14;
 
 //MQTT broker address
 const char* PROGMEM AWS_ENDPOINT = "a1jkex5rueqh0y.iot.us-east-1.amazonaws.com";
@@ -88,21 +189,269 @@ char* AWS_thing_name;
 char* AWS_shadow;
 
 #define AWS_SHADOW_UPDATE_PERIOD        (24 * 60)     //minutes. AWS shadow service will be updated once during this time period
-#define AWS_SHADOW_UPDATE_INTERVALS     ((AWS_SHADOW_UPDATE_PERIOD/REPORT_INTERVAL))  
+#define AWS_SHADOW_UPDATE_INTERVALS(i)  ((AWS_SHADOW_UPDATE_PERIOD/(i)))  
 #define AWS_RTCMEM_MAGICBYTE            'W'
-#define AWS_RTCMEM_BEGIN                (128-sizeof(rtcMemAWSDef)/4)           //at the end of rtc mem
+#define RTCMEM_END                      192                                    //user rtc mem is blocks 64..191
+#define AWS_RTCMEM_BEGIN                (RTCMEM_END-sizeof(rtcMemAWSDef)/4)    //at the end of rtc mem
+
+//wake budgets, see deadlineArm()
+#define BUDGET_TOTAL                    0       //whole wake
+#define BUDGET_WIFI                     1       //WiFi association and IP, from wifiBegin()
+#define BUDGET_CONNECT                  2       //TLS handshake and MQTT connect, all retries
+#define BUDGET_PUBLISH                  3       //MQTT session after connect
+#define BUDGET_COUNT                    4
+#define BUDGET_UNIT_MS                  1000    //budgets are set in whole seconds
+//a wake over budget still waits for its reading, the conversion must be shorter than any budget
+static_assert((750 >> (12 - SENSOR_RESOLUTION)) < BUDGET_UNIT_MS, "conversion takes longer than a budget");
+const char* const budgetNames[BUDGET_COUNT] = { "total", "wifi", "connect", "publish" };
+
 typedef struct {
     char markerFlag;            // magic byte
-    int sleepCycles;            // AWS shadow service update countdown
-    //byte mode;  	            // spare
+    byte wakeMode;              // what the current wake was scheduled for
+    int16_t sleepCycles;        // AWS shadow service update countdown
+    int16_t flushCycles;        // batch upload countdown
+    int16_t heartbeatCycles;    // wakes left until a reading is reported regardless of change
+    uint8_t budgetHits[BUDGET_COUNT];   // wakes cut short by each budget since the last shadow update
+    uint32_t wallOffset;        // unix time minus device clock at the last clock sync, 0 - not known
+    int16_t sleepSkew;          // deep sleep timer error, actual/requested - 1 in 1/65536. SKEW_UNKNOWN - not measured
+    uint16_t syncMinute;        // device clock at the last clock sync, minutes (wraps)
 } rtcMemAWSDef __attribute__ ((aligned(4)));
 rtcMemAWSDef rtcMemAWS;
 
+//wake modes. Decided before going to sleep as the radio can only be enabled at wake up
+#define WAKE_MODE_UPLOAD                'U'     //radio on, readings will be uploaded
+#define WAKE_MODE_SAMPLE                'S'     //radio off, only take a reading
+
+//readings waiting to be uploaded. Kept just below rtcMemAWS
+#define SAMPLES_RTCMEM_BEGIN            (AWS_RTCMEM_BEGIN-sizeof(sampleRingDef)/4)
+sampleRingDef rtcMemSamples;
+
+//last good AP and IP lease. Used to skip scan and DHCP on the next wake
+#define WIFI_RTCMEM_BEGIN               (SAMPLES_RTCMEM_BEGIN-sizeof(rtcMemWiFiDef)/4)
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below
+    uint8_t bssid[6];
+    uint8_t channel;            // 0 - no valid AP cached
+    uint8_t fastConnect;        // last connect used cached data
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint32_t connectTime;       // ms from WiFi.begin() to IP, last upload wake
+} rtcMemWiFiDef __attribute__ ((aligned(4)));
+rtcMemWiFiDef rtcMemWiFi;
+
+//last TLS session with AWS endpoint. Resumed on the next wake to skip the full handshake
+#define TLS_RTCMEM_BEGIN                (WIFI_RTCMEM_BEGIN-sizeof(rtcMemTLSDef)/4)
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below
+    uint16_t resumed;           // handshakes resumed since power on
+    uint16_t full;              // full handshakes since power on
+    uint8_t valid;              // session below can be offered to the server
+    BearSSL::Session session;   // session ID and master secret
+} rtcMemTLSDef __attribute__ ((aligned(4)));
+rtcMemTLSDef rtcMemTLS;
+
+//wake phase statistics since the last shadow update
+#define PROFILE_RTCMEM_BEGIN            (TLS_RTCMEM_BEGIN-sizeof(phaseProfileDef)/4)
+phaseProfileDef rtcMemProfile;
+
+//cursors of the offline queue in flash. Rebuilt from flash after power loss
+#define QUEUE_RTCMEM_BEGIN              (PROFILE_RTCMEM_BEGIN-sizeof(flashQueueDef)/4)
+flashQueueDef rtcMemQueue;
+
+//consecutive upload failures and RSSI history, holds off upload attempts
+#define BACKOFF_RTCMEM_BEGIN            (QUEUE_RTCMEM_BEGIN-sizeof(backoffDef)/4)
+backoffDef rtcMemBackoff;
+
+//sensors found by the ROM search and their last reported readings
+//the ROM CRC byte is not kept, it is calculated again
+#define SENSORS_RTCMEM_BEGIN            (BACKOFF_RTCMEM_BEGIN-sizeof(rtcMemSensorsDef)/4)
+typedef struct {
+    uint8_t rom[7];             // family code and serial number
+    uint8_t bus;                // index in DS18B20[]
+} sensorDef;
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below
+    uint8_t count;              // 0 - buses are searched on the next wake
+    uint8_t spare[3];
+    sensorDef sensor[SENSOR_MAX];
+    int16_t lastTemp[SENSOR_MAX];   // last reported reading, centi deg C
+} rtcMemSensorsDef __attribute__ ((aligned(4)));
+rtcMemSensorsDef rtcMemSensors;
+
+//aggregation window in progress, one series per sensor
+#define WINDOW_RTCMEM_BEGIN             (SENSORS_RTCMEM_BEGIN-sizeof(windowDef)/4)
+static_assert(WINDOW_SERIES >= SENSOR_MAX, "aggregation window has less series than sensors");
+windowDef rtcMemWindow;
+
+//phase timings of the current wake
+unsigned long phaseStart[PHASE_COUNT];
+unsigned long phaseTime[PHASE_COUNT];
+uint16_t phaseUsed;
+uint16_t phaseOpen;             //begun but not ended yet
+
+//IOTAppStory keeps its own data at the beginning of user RTC memory (blocks 64..71)
+//note: eboot uses blocks 64..95 to pass the OTA command, CRC checks catch this
+#define IAS_RTCMEM_END                  72
+static_assert(WINDOW_RTCMEM_BEGIN >= IAS_RTCMEM_END, "RTC memory overlaps IOTAppStory data");
+
+//max readings in one message and number of wakes between uploads
+//a batch is also uploaded when it is full or when shadow service is due
+const char* PROGMEM BATCH_SIZE = "12";
+const char* PROGMEM FLUSH_INTERVAL = "1";
+char* batch_size;
+char* flush_interval;
+int batchSize;
+int flushInterval;
+
+//report-on-change: readings within threshold (deg C) of the last reported one are dropped,
+//unless heartbeat (wakes) has passed since then. Threshold 0 reports every reading
+const char* PROGMEM DELTA_THRESHOLD = "0";
+const char* PROGMEM HEARTBEAT = "12";
+char* delta_threshold;
+char* heartbeat;
+int deltaThreshold;             //centi deg C
+int heartbeatInterval;
+
+//minutes to sleep between two wakes (i.e. between two readings)
+const char* PROGMEM SAMPLE_INTERVAL = "60";
+char* sample_interval;
+int sampleInterval;
+
+//aggregation: readings per window (1 - off, every reading is uploaded). The window
+//is uploaded as min/mean/max/sd when it is full, the sample period is sample_interval
+const char* PROGMEM WINDOW_LENGTH = "1";
+char* window_length;
+int windowLength;
+
+//encoding of content messages: "json" or "packed" (binary, see PackedPayload.h)
+const char* PROGMEM PAYLOAD_FORMAT = "json";
+char* payload_format;
+boolean packedFormat;
+
+//bytes of binary trace (newest wakes) attached to each daily shadow update, 0 - none
+//less if the update would not fit in MQTT_MAX_PACKET_SIZE
+const char* PROGMEM TRACE_SHADOW = "0";
+char* trace_shadow;
+int traceShadow;
+
+//max seconds awake: total, WiFi, TLS/MQTT connect and publish. 0 or missing - no limit
+//a wake over budget goes to deep sleep right away. Not applied on cold boot (config mode) 
+//and to the FW update check
+const char* PROGMEM WAKE_BUDGET = "20,8,8,6";
+char* wake_budget;
+unsigned long wakeBudget[BUDGET_COUNT];    //ms
+
+//streaming, for units on mains power: "ms between readings,s between publishes", 0 - off.
+//Upload wakes stay connected until the next slot is due, sample_interval is the length of
+//such a wake (60 minutes at most). A publish is also made when batch_size readings are pending
+const char* PROGMEM STREAM_CONFIG = "0";
+char* stream_config;
+unsigned long streamPeriod;     //ms, 0 - streaming is off
+unsigned long streamPublish;    //ms
+
+//QoS1 content messages sent before the first PUBACK has to come back, 0 - QoS0 (no
+//acknowledgement). Shadow messages stay QoS0, the shadow service answers them anyway
+const char* PROGMEM QOS_WINDOW = "4";
+char* qos_window;
+uint8_t qosWindowSize;
 
 //MQTT topic for the actual content
 const char* PROGMEM AWS_CONTENT_TOPIC = "MyHouse/Room1/Temperature";
 char* AWS_content_topic;
 
+//max length of IAS field values
+#define DEVICE_NAME_LEN                 25
+#define AWS_ENDPOINT_LEN                96
+#define CONTENT_TOPIC_LEN               96
+#define BATCH_SIZE_LEN                  2
+#define FLUSH_INTERVAL_LEN              3
+#define SAMPLE_INTERVAL_LEN             4
+#define DELTA_THRESHOLD_LEN             4
+#define HEARTBEAT_LEN                   3
+#define WAKE_BUDGET_LEN                 15
+#define WINDOW_LENGTH_LEN               3
+#define PAYLOAD_FORMAT_LEN              6
+#define TRACE_SHADOW_LEN                3
+#define STREAM_CONFIG_LEN               11
+#define QOS_WINDOW_LEN                  1
+
+//IAS fields: name (also the key in the shadow's desired "config":{"<name>":"<value>", ...}),
+//label, PROGMEM default, value, max length and whether the shadow can set it. Device name,
+//endpoint and topic only in config mode - a wrong one would cut the device off
+#define CONFIG_FIELDS(X) \
+    X(device_name,      "Device Name",                      AWS_DEFAULT_NAME,   AWS_thing_name,     DEVICE_NAME_LEN,        false) \
+    X(aws_endpoint,     "AWS Endpoint",                     AWS_ENDPOINT,       AWS_endpoint,       AWS_ENDPOINT_LEN,       false) \
+    X(topic,            "Topic",                            AWS_CONTENT_TOPIC,  AWS_content_topic,  CONTENT_TOPIC_LEN,      false) \
+    X(batch_size,       "Readings per upload",              BATCH_SIZE,         batch_size,         BATCH_SIZE_LEN,         true) \
+    X(flush_interval,   "Wakes between uploads",            FLUSH_INTERVAL,     flush_interval,     FLUSH_INTERVAL_LEN,     true) \
+    X(sample_interval,  "Minutes between readings",         SAMPLE_INTERVAL,    sample_interval,    SAMPLE_INTERVAL_LEN,    true) \
+    X(delta_threshold,  "Report change of (C, 0 = all)",    DELTA_THRESHOLD,    delta_threshold,    DELTA_THRESHOLD_LEN,    true) \
+    X(heartbeat,        "Max wakes between reports",        HEARTBEAT,          heartbeat,          HEARTBEAT_LEN,          true) \
+    X(wake_budget,      "Max s awake: all,wifi,tls,pub",    WAKE_BUDGET,        wake_budget,        WAKE_BUDGET_LEN,        true) \
+    X(window,           "Readings per window (1 = off)",    WINDOW_LENGTH,      window_length,      WINDOW_LENGTH_LEN,      true) \
+    X(format,           "Payload: json or packed",          PAYLOAD_FORMAT,     payload_format,     PAYLOAD_FORMAT_LEN,     true) \
+    X(trace,            "Trace bytes in shadow (0 = off)",  TRACE_SHADOW,       trace_shadow,       TRACE_SHADOW_LEN,       true) \
+    X(stream,           "Stream: ms/reading,s/publish",     STREAM_CONFIG,      stream_config,      STREAM_CONFIG_LEN,      true) \
+    X(qos_window,       "QoS1 msgs in flight (0 = QoS0)",   QOS_WINDOW,         qos_window,         QOS_WINDOW_LEN,         true)
+
+//one slot per field, max length + 1 each
+#define CONFIG_SLOT(name, label, def, value, size, shadow)    char name[size + 1];
+typedef struct {
+    CONFIG_FIELDS(CONFIG_SLOT)
+} configValuesDef;
+
+//a value from the shadow delta: the longest field the shadow can set or a FW version
+#define CONFIG_DELTA_TEXT(name, label, def, value, size, shadow)    char name[shadow ? size + 1 : 1];
+typedef union {
+    CONFIG_FIELDS(CONFIG_DELTA_TEXT)
+    char version[sizeof("999.999.999")];
+} configDeltaTextDef;
+
+typedef struct {
+    const char* name;           // as in IAS.addField()
+    const char* label;
+    const char* const* def;     // PROGMEM
+    char** value;
+    size_t size;                // max length
+    size_t slot;                // offset in configValuesDef
+    boolean shadow;             // can be set through the shadow
+} configFieldDef;
+#define CONFIG_FIELD(name, label, def, value, size, shadow) \
+    { #name, label, &def, &value, size, offsetof(configValuesDef, name), shadow },
+const configFieldDef configFields[] = {
+    CONFIG_FIELDS(CONFIG_FIELD)
+};
+#define CONFIG_FIELD_COUNT              (sizeof(configFields) / sizeof(configFields[0]))
+static_assert(CONFIG_FIELD_COUNT == _nrXF, "IAS field count does not match the config fields");
+
+char* configSlot(configValuesDef* values, const configFieldDef* field) {
+    return (char*)values + field->slot;
+}
+
+//app data sectors carved off the end of SPIFFS, see eagle.flash.4m.tempmon.ld
+//EEPROM (IOTAppStory config) and SDK data follow at APPDATA_FLASH_END
+#define APPDATA_FLASH_BEGIN             0x3EA000
+#define APPDATA_FLASH_END               0x3FB000
+#define CONFIG_FLASH_SECTOR             (APPDATA_FLASH_BEGIN / SPI_FLASH_SEC_SIZE)
+
+//resolved configuration as one flash record. Written when IAS fields have been
+//processed and differ from the record, read in one go on warm wakes
+//fields set through the shadow are kept apart: processField() on full update wakes would
+//bring back the IAS values. They hold until the next cold boot
+#define CONFIG_CACHE_VERSION            10
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below
+    uint32_t version;
+    char shadow[DEVICE_NAME_LEN + 26 + 1];      // AWS_SHADOW formatted
+    configValuesDef values;     // in effect
+    uint32_t overridden;        // bit per configFields[] entry set through the shadow
+    configValuesDef overrides;
+} configCacheDef __attribute__ ((aligned(4)));
+static_assert(CONFIG_FIELD_COUNT <= 32, "config fields do not fit in the override bits");
+configCacheDef configCache;
+
 //global IAS object
 IOTAppStory IAS(APPNAME, VERSION, COMPDATE, MODEBUTTON);
 boolean firstBoot;
@@ -113,68 +462,590 @@ boolean firstBoot;
 #define CERTIFICATE_FILE "/cert.der"
 #define PRIVATE_KEY_FILE "/private.der"
 
+//flash copy of the two files above, refreshed on cold boot when SPIFFS content has changed
+//warm wakes read it directly instead of mounting SPIFFS. DER data follows the header
+#define CREDENTIALS_FLASH_SECTOR        (CONFIG_FLASH_SECTOR + 1)
+#define CREDENTIALS_VERSION             1
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below, DER data included
+    uint16_t version;
+    uint16_t certLength;
+    uint16_t keyLength;
+    uint16_t spare;
+} credentialHeaderDef __attribute__ ((aligned(4)));
+#define CREDENTIALS_MAX_LENGTH          (SPI_FLASH_SEC_SIZE - sizeof(credentialHeaderDef))
+
+//offline queue: readings that do not fit in RTC memory while uploads fail are
+//appended to a log in flash and replayed oldest first. 12 sectors hold ~6100 readings
+//(21 days at 5 minutes), after that the oldest sector is recycled
+#define QUEUE_FLASH_BEGIN               ((CREDENTIALS_FLASH_SECTOR + 1) * SPI_FLASH_SEC_SIZE)
+#define QUEUE_FLASH_SEGMENTS            12
+static_assert(QUEUE_FLASH_BEGIN + QUEUE_FLASH_SEGMENTS * FLASH_QUEUE_SEGMENT_SIZE <= APPDATA_FLASH_END, "offline queue does not fit in app data sectors");
+//readings per replayed message and max messages per wake. Packed messages take about 
+//2 bytes per reading, a batch that does not fit is sent in parts
+#define QUEUE_REPLAY_BATCH              48
+#define PACKED_REPLAY_BATCH             240
+#define QUEUE_REPLAY_MESSAGES           16
+static_assert(QUEUE_REPLAY_BATCH >= SAMPLE_RING_CAPACITY, "replay buffer is also used for RTC readings");
+static_assert(PACKED_REPLAY_BATCH >= QUEUE_REPLAY_BATCH, "replay buffer is sized for packed batches");
+
+//shadow fields as last reported. A record is appended to the sector after each successful
+//update, the sector is erased when it is full. The valid record with the highest seq is current
+#define SHADOW_FLASH_SECTOR             (QUEUE_FLASH_BEGIN / SPI_FLASH_SEC_SIZE + QUEUE_FLASH_SEGMENTS)
+static_assert((SHADOW_FLASH_SECTOR + 1) * SPI_FLASH_SEC_SIZE <= APPDATA_FLASH_END, "shadow state does not fit in app data sectors");
+//reported fields that are sent only when their hash changes
+#define SHADOW_SENSOR                   0
+#define SHADOW_TOPIC                    1
+#define SHADOW_WIFI_FAST                2
+#define SHADOW_TLS_RESUMED              3
+#define SHADOW_TLS_FULL                 4
+#define SHADOW_BACKLOG                  5
+#define SHADOW_SENSORS                  6
+#define SHADOW_APPNAME                  7
+#define SHADOW_VERSION                  8
+#define SHADOW_COMPDATE                 9
+#define SHADOW_BUDGET_HITS              10
+#define SHADOW_CONFIG                   11
+#define SHADOW_FIELDS                   12
+//every n-th update sends all fields, in case the shadow has been changed or lost
+#define SHADOW_REFRESH_UPDATES          7
+//battery (mV) and RSSI (dB) are sent when they have moved this much since last reported
+#define SHADOW_BATTERY_DELTA            50
+#define SHADOW_RSSI_DELTA               6
+typedef struct {
+    uint32_t crc;               // CRC32 over everything below
+    uint32_t seq;               // record number, 0xFFFFFFFF - slot is erased
+    uint16_t hash[SHADOW_FIELDS];   // low 16 bits of CRC32 of the value last reported
+    uint16_t battery;           // last reported, mV
+    int8_t rxlev;               // last reported, dB
+    uint8_t updates;            // shadow updates since the last full one
+} shadowStateDef __attribute__ ((aligned(4)));
+#define SHADOW_RECORDS                  (SPI_FLASH_SEC_SIZE / sizeof(shadowStateDef))
+shadowStateDef shadowState;     //as in flash
+shadowStateDef shadowNext;      //what the update being built reports
+boolean shadowKnown;            //shadowState has been read from a valid record
+boolean shadowFull;             //the update being built sends all fields
+uint16_t shadowSlot;            //next free record in the sector
+boolean configChanged;          //shadow delta has set IAS fields this wake
+boolean updateRequested;        //shadow delta asks for a newer FW version
+
+//binary trace, one block per wake appended before going to sleep. 2 sectors hold the 
+//last ~100 wakes, the older sector is erased when the newer one is full
+#define TRACE_FLASH_BEGIN               ((SHADOW_FLASH_SECTOR + 1) * SPI_FLASH_SEC_SIZE)
+#define TRACE_FLASH_SEGMENTS            2
+static_assert(TRACE_FLASH_BEGIN + TRACE_FLASH_SEGMENTS * TRACE_SEGMENT_SIZE <= APPDATA_FLASH_END, "trace does not fit in app data sectors");
+static_assert(TRACE_EVENT_COUNT <= TRACE_EVENTS_MAX, "too many trace events");
+//largest part of the trace in a shadow update
+#define TRACE_SHADOW_MAX                384
+traceBufferDef traceBuffer;
+
+//streaming wake in progress, see streamLoop(). RAM only, every wake starts over
+typedef struct {
+    unsigned long start;        // millis() when streaming began
+    unsigned long nextSample;   // millis() of the next conversion request
+    unsigned long nextPublish;
+    unsigned long oldest;       // millis() of the oldest reading not published yet
+    unsigned long end;          // millis() when the wake closes, STREAM_CLOSE_MS before the slot
+    boolean converting;
+    uint32_t readings;          // readings taken, at least one sensor answered
+    uint32_t publishes;         // publishes that emptied the pending readings
+    unsigned long latencyMin;   // age of the oldest reading of such a publish, ms
+    unsigned long latencyMax;
+    unsigned long latencySum;
+} streamDef;
+boolean streaming;
+streamDef stream;
+
 // forward declaration of msg callback function. probably not needed
 void callback(char* topic, byte* payload, unsigned int length);
+// a QoS1 message has been acknowledged / the ones in flight are given up
+void delivered(const mqttInFlightDef* message);
+void undelivered();
+
+//QoS1 messages in flight on the current connection
+mqttWindowDef qosWindow;
+
+//PubSubClient 2.6 publishes QoS0 only and drops the PUBACKs it reads. QoS1 PUBLISH packets
+//are written to the socket directly, the library reads the broker's packets through this
+//tap, which picks out the PUBACKs for the window
+class PubackTap : public Client {
+    public:
+        PubackTap(Client& client) : _client(client) {}
+        int connect(IPAddress ip, uint16_t port) override { return _client.connect(ip, port); }
+        int connect(const char* host, uint16_t port) override { return _client.connect(host, port); }
+        size_t write(uint8_t b) override { return _client.write(b); }
+        size_t write(const uint8_t* buf, size_t size) override { return _client.write(buf, size); }
+        int available() override { return _client.available(); }
+        int read() override {
+            int b = _client.read();
+            if (b >= 0){
+                uint8_t c = b;
+                mqttWindowScan(&qosWindow, &c, 1);
+            }
+            return b;
+        }
+        int read(uint8_t* buf, size_t size) override {
+            int n = _client.read(buf, size);
+            if (n > 0)
+                mqttWindowScan(&qosWindow, buf, n);
+            return n;
+        }
+        int peek() override { return _client.peek(); }
+        void flush() override { _client.flush(); }
+        void stop() override { _client.stop(); }
+        uint8_t connected() override { return _client.connected(); }
+        operator bool() override { return _client; }
+    private:
+        Client& _client;
+};
 
 //MQTT client
 //set  MQTT port number to 8883 as per standard
-WiFiClientSecure espClient;
-PubSubClient mqtt(espClient); 
+//BearSSL is needed for TLS session resumption
+BearSSL::WiFiClientSecure espClient;
+PubackTap mqttSocket(espClient);
+PubSubClient mqtt(mqttSocket); 
 #define MAX_MQTT_CONNECT_RETRIES 2
+//max wait for a PUBACK, after that the messages in flight are given up
+#define MQTT_PUBACK_TIMEOUT             3000    //ms
 
+//outgoing messages are serialized here. PubSubClient adds header and topic 
+//in a buffer of the same size, so this is the upper limit for any payload
+char msgBuffer[MQTT_MAX_PACKET_SIZE];
 
+// device clock in s. Readings of a streaming wake are stamped as they are taken
+uint32_t deviceClock() {
+    return rtcMemSamples.clock + (streaming ? millis() / 1000 : 0);
+}
 
-boolean mqttConnectAndSend(const char * topic, const char * msg) {
-    
-    int retries;
+void trace(uint8_t event) {
+    traceAdd(&traceBuffer, event, millis(), 0, NULL);
+}
 
-    DEBUG_LOG_T("Trying to publish: [%s] %s\n\r", topic, msg);
-    
-    retries = WIFI_RECONNECT_TIMEOUT;
-    DEBUG_LOG_T("Connecting to WiFi AP...");
-    long tStart = millis();
+void trace(uint8_t event, int32_t a) {
+    traceAdd(&traceBuffer, event, millis(), 1, &a);
+}
+
+void trace(uint8_t event, int32_t a, int32_t b) {
+    int32_t args[] = { a, b };
+    traceAdd(&traceBuffer, event, millis(), 2, args);
+}
+
+void trace(uint8_t event, int32_t a, int32_t b, int32_t c) {
+    int32_t args[] = { a, b, c };
+    traceAdd(&traceBuffer, event, millis(), 3, args);
+}
+
+void phaseBegin(uint8_t phase) {
+    phaseStart[phase] = millis();
+    phaseOpen |= 1 << phase;
+}
+
+// phases can be entered more than once per wake, time is summed up
+void phaseEnd(uint8_t phase) {
+    phaseTime[phase] += millis() - phaseStart[phase];
+    phaseUsed |= 1 << phase;
+    phaseOpen &= ~(1 << phase);
+}
+
+void phaseSet(uint8_t phase, unsigned long ms) {
+    phaseTime[phase] = ms;
+    phaseUsed |= 1 << phase;
+    phaseOpen &= ~(1 << phase);
+}
+
+Ticker deadline;
+boolean deadlineEnabled;            //budgets apply to this wake
+volatile uint8_t deadlineBudget;    //budget the timer is armed for
+volatile boolean deadlinePassed;    //set by the timer, the wait loops end the wake
+void deadlineExpired();
+void deadlineCheck();
+
+// arm the deadline timer for a budget counted from start (ms since boot)
+// what is left of the total budget is the upper limit. Replaces the previous 
+// deadline, BUDGET_TOTAL goes back to the total budget alone
+void deadlineArm(uint8_t budget, unsigned long start) {
+    if (!deadlineEnabled || deadlinePassed)
+        return;
+
+    long now = millis();
+    long left = (long)wakeBudget[BUDGET_TOTAL] - now;
+    deadlineBudget = BUDGET_TOTAL;
+    if (budget != BUDGET_TOTAL && wakeBudget[budget]){
+        long phaseLeft = (long)(start + wakeBudget[budget]) - now;
+        if (!wakeBudget[BUDGET_TOTAL] || phaseLeft < left){
+            left = phaseLeft;
+            deadlineBudget = budget;
+        }
+    }
+    else if (!wakeBudget[BUDGET_TOTAL]){
+        deadline.detach();
+        return;
+    }
+    //already over budget - expires as soon as the current task yields
+    deadline.once_ms(max(left, 1L), deadlineExpired);
+}
+
+// "total,wifi,connect,publish" in seconds
+void parseWakeBudget(const char* s) {
+    for (int i = 0; i < BUDGET_COUNT; i++){
+        wakeBudget[i] = s ? BUDGET_UNIT_MS * max(atoi(s), 0) : 0;
+        if (s && (s = strchr(s, ',')) != NULL)
+            s++;
+    }
+}
+
+//CRC of an RTC memory struct. By convention the CRC is the first field of the struct
+uint32_t rtcMemCrc(const void* mem, size_t size) {
+    return crc32((const uint8_t*)mem + sizeof(uint32_t), size - sizeof(uint32_t));
+}
+
+bool readRTCMemWiFi() {
+    DEBUG_LOG_T("Reading WiFi RTC Mem...\n\r");
+
+    system_rtc_mem_read(WIFI_RTCMEM_BEGIN, &rtcMemWiFi, sizeof(rtcMemWiFi));
+    if (rtcMemWiFi.crc != rtcMemCrc(&rtcMemWiFi, sizeof(rtcMemWiFi))) {
+        memset(&rtcMemWiFi, 0, sizeof(rtcMemWiFi));
+        return false;
+    }
+    return true;
+}
+
+void writeRTCMemWiFi() {
+    DEBUG_LOG_T("Writing WiFi RTC Mem...\n\r");
+
+    rtcMemWiFi.crc = rtcMemCrc(&rtcMemWiFi, sizeof(rtcMemWiFi));
+    system_rtc_mem_write(WIFI_RTCMEM_BEGIN, &rtcMemWiFi, sizeof(rtcMemWiFi));
+}
+
+unsigned long wifiConnectStart;
+volatile unsigned long wifiGotIP;
+WiFiEventHandler wifiGotIPHandler;
+
+// start WiFi connection. If last AP and IP lease are known (and useCache is set), 
+// connect directly to that AP on its channel with static IP - no scan, no DHCP
+void wifiBegin(boolean useCache) {
+    wifiGotIPHandler = WiFi.onStationModeGotIP([](const WiFiEventStationModeGotIP&){
+        wifiGotIP = millis();
+    });
+    wifiConnectStart = millis();
+
+    if (readRTCMemWiFi() && rtcMemWiFi.channel && useCache) {
+        DEBUG_LOG_T("Fast connect to %02X:%02X:%02X:%02X:%02X:%02X, channel %u\n\r", 
+            rtcMemWiFi.bssid[0], rtcMemWiFi.bssid[1], rtcMemWiFi.bssid[2], 
+            rtcMemWiFi.bssid[3], rtcMemWiFi.bssid[4], rtcMemWiFi.bssid[5], rtcMemWiFi.channel);
+        rtcMemWiFi.fastConnect = true;
+        //do not wear the flash by saving bssid and channel on every wake
+        WiFi.persistent(false);
+        WiFi.config(IPAddress(rtcMemWiFi.ip), IPAddress(rtcMemWiFi.gateway), IPAddress(rtcMemWiFi.subnet), IPAddress(rtcMemWiFi.dns));
+        WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str(), rtcMemWiFi.channel, rtcMemWiFi.bssid);
+    }
+    else {
+        rtcMemWiFi.fastConnect = false;
+        WiFi.begin();
+    }
+}
+
+boolean waitForWiFi() {
+    int retries = WIFI_RECONNECT_TIMEOUT;
     while (!WiFi.isConnected() && retries-- > 0 ) {
 		delay(500);
         DEBUG_LOG_T(".");
+        deadlineCheck();
 	} 
+    return WiFi.isConnected();
+}
+
+// wait for connection started by wifiBegin()
+// if the cached AP/IP lease does not work, fall back to full scan and DHCP
+boolean wifiConnect() {
+    if (WiFi.isConnected())
+        return true;
+
+    DEBUG_LOG_T("Connecting to WiFi AP...");
+    //open until connected, so a deadline in between still records it
+    phaseBegin(PHASE_WIFI);
+    phaseStart[PHASE_WIFI] = wifiConnectStart;
+    deadlineArm(BUDGET_WIFI, wifiConnectStart);
+    if (!waitForWiFi() && rtcMemWiFi.fastConnect) {
+        DEBUG_LOG_T("fast connect failed. Trying full scan with DHCP...");
+        trace(TRACE_WIFI_FAST_FAIL);
+        rtcMemWiFi.fastConnect = false;
+        rtcMemWiFi.channel = 0;
+        //the scan may not finish within budget, do not try the cached AP again
+        writeRTCMemWiFi();
+        WiFi.config(IPAddress(), IPAddress(), IPAddress());
+        WiFi.begin(WiFi.SSID().c_str(), WiFi.psk().c_str());
+        waitForWiFi();
+    }
+    deadlineArm(BUDGET_TOTAL, 0);
 
     if (!WiFi.isConnected()) {
         DEBUG_LOG_T("Unable to connect to WiFi AP!\n\r");
+        trace(TRACE_WIFI_FAIL, millis() - wifiConnectStart, WiFi.status());
+        writeRTCMemWiFi();
+        phaseSet(PHASE_WIFI, millis() - wifiConnectStart);
+        return false;
+    }
+
+    //remember this AP and lease for the next wake
+    rtcMemWiFi.connectTime = (wifiGotIP ? wifiGotIP : millis()) - wifiConnectStart;
+    memcpy(rtcMemWiFi.bssid, WiFi.BSSID(), sizeof(rtcMemWiFi.bssid));
+    rtcMemWiFi.channel = WiFi.channel();
+    rtcMemWiFi.ip = WiFi.localIP();
+    rtcMemWiFi.gateway = WiFi.gatewayIP();
+    rtcMemWiFi.subnet = WiFi.subnetMask();
+    rtcMemWiFi.dns = WiFi.dnsIP();
+    writeRTCMemWiFi();
+    phaseSet(PHASE_WIFI, rtcMemWiFi.connectTime);
+    DEBUG_LOG_T("done! Time elapsed: %lu ms\n\r", rtcMemWiFi.connectTime);
+    trace(TRACE_WIFI, rtcMemWiFi.connectTime, rtcMemWiFi.fastConnect, rtcMemWiFi.channel);
+    return true;
+}
+
+bool readRTCMemTLS() {
+    DEBUG_LOG_T("Reading TLS RTC Mem...\n\r");
+
+    system_rtc_mem_read(TLS_RTCMEM_BEGIN, &rtcMemTLS, sizeof(rtcMemTLS));
+    if (rtcMemTLS.crc != rtcMemCrc(&rtcMemTLS, sizeof(rtcMemTLS))) {
+        rtcMemTLS = rtcMemTLSDef();
+        return false;
+    }
+    return true;
+}
+
+void writeRTCMemTLS() {
+    DEBUG_LOG_T("Writing TLS RTC Mem...\n\r");
+
+    rtcMemTLS.crc = rtcMemCrc(&rtcMemTLS, sizeof(rtcMemTLS));
+    system_rtc_mem_write(TLS_RTCMEM_BEGIN, &rtcMemTLS, sizeof(rtcMemTLS));
+}
+
+// MQTT connect offering the cached TLS session
+// BearSSL falls back to a full handshake if the server does not accept it. If the 
+// connection fails anyway, the session is dropped so the next attempt starts clean
+boolean mqttConnect() {
+    if (mqtt.connected())
+        return true;
+
+    uint8_t offered[sizeof(BearSSL::Session)];
+    memcpy(offered, &rtcMemTLS.session, sizeof(offered));
+    if (!mqtt.connect(AWS_thing_name)) {
+        rtcMemTLS.session = BearSSL::Session();
+        rtcMemTLS.valid = false;
+        writeRTCMemTLS();
         return false;
     }
-    DEBUG_LOG_T("done! Time elapsed: %lu ms\n\r", millis()-tStart);
+
+    //resumed session keeps its ID and master secret
+    if (rtcMemTLS.valid && memcmp(offered, &rtcMemTLS.session, sizeof(offered)) == 0)
+        rtcMemTLS.resumed++;
+    else
+        rtcMemTLS.full++;
+    rtcMemTLS.valid = true;
+    writeRTCMemTLS();
+    DEBUG_LOG_T("TLS handshakes resumed/full: %u/%u\n\r", rtcMemTLS.resumed, rtcMemTLS.full);
+    return true;
+}
+
+// MQTT session for one wake: WiFi, TLS and MQTT connect happen once in begin(),
+// all pending messages are published over the same connection and end() 
+// disconnects once
+// QoS1 messages (qos_window > 0) are not waited for one by one: the next one goes out
+// while up to qosWindowSize are in flight, flush() collects the PUBACKs that are left
+class MqttSession {
+    public:
+        boolean begin();
+        boolean publish(const char* topic, const JsonWriter& msg, boolean qos1 = false);
+        boolean publish(const char* topic, const PackedWriter& msg, boolean qos1 = false);
+        // what the last message published carries, passed to delivered() once it is 
+        // acknowledged. Right away if it went out with QoS0
+        void carries(uint8_t kind, uint16_t count, uint32_t extra);
+        // wait for the PUBACKs of the messages in flight, the ones that do not come are given up
+        void flush();
+        void end();
+        boolean connected() { return _connected; }
+    private:
+        boolean publish(const char* topic, const uint8_t* payload, size_t length, boolean qos1);
+        boolean publishQos1(const char* topic, const uint8_t* payload, size_t length);
+        boolean waitAcked(uint8_t inFlight);
+        void settle();
+        boolean _connected = false;
+        boolean _lastQos1 = false;  // last message went into the window
+        uint16_t _sent = 0;         // QoS1 messages since the last flush()
+        uint16_t _acked = 0;
+};
+
+boolean MqttSession::begin() {
+    int retries;
+    long tStart;
+
+    if (_connected)
+        return true;
+
+    if (!wifiConnect())
+        return false;
+
+    phaseBegin(PHASE_MQTT);
+    deadlineArm(BUDGET_CONNECT, millis());
     retries = MAX_MQTT_CONNECT_RETRIES;
     while ( retries-- > 0){
         DEBUG_LOG_T("Attempting MQTT connection (timeout: %d s)...", MQTT_SOCKET_TIMEOUT);
         tStart = millis();
-        if (mqtt.connect(AWS_thing_name)){
+        if (mqttConnect()){
             DEBUG_LOG_T("connected! Time elapsed: %lu ms\n\r", millis()-tStart);
-            DEBUG_LOG_T("Publishing: [%s] %s (%d/%d)",topic, msg, strlen(topic)+strlen(msg), MQTT_MAX_PACKET_SIZE);         
-            tStart = millis();
-            if (mqtt.publish(topic, msg)) {
-                DEBUG_LOG_T(" -> Success. Time elapsed: %lu ms\n\r", millis()-tStart);
-                retries = 0;  
-                //loop untill data is sent
-                //unsigned long ts = millis();
-                //while(millis() < ts + 100){  
-                while (espClient.available()){
-                    mqtt.loop();         
-                    yield();
-                }
-                return true;
-            }
-            else{
-                DEBUG_LOG_T(" -> Fail. Is msg too long? Time elapsed: %lu ms\n\r", millis()-tStart);         
-            }
-        }
-        else{
-            DEBUG_LOG_T("failed, rc=%d. Time elapsed: %lu ms\n\r", mqtt.state(), millis()-tStart);
+            trace(TRACE_MQTT, millis() - tStart, rtcMemTLS.resumed, rtcMemTLS.full);
+            _connected = true;
+            //nothing in flight carries over, the readings are still where they were
+            mqttWindowReset(&qosWindow, qosWindowSize);
+            undelivered();
+            break;
         }
+        DEBUG_LOG_T("failed, rc=%d. Time elapsed: %lu ms\n\r", mqtt.state(), millis()-tStart);
+        trace(TRACE_MQTT_FAIL, millis() - tStart, mqtt.state());
+        deadlineCheck();
+    }
+    phaseEnd(PHASE_MQTT);
+    //publish budget covers the rest of the session, end() included
+    deadlineArm(_connected ? BUDGET_PUBLISH : BUDGET_TOTAL, millis());
+    return _connected;
+}
+
+boolean MqttSession::publish(const char* topic, const JsonWriter& msg, boolean qos1) {
+    if (!_connected)
+        return false;
+
+    //truncated message - would fail the same way on every attempt
+    if (!msg.ok()){
+        DEBUG_LOG_T("Message to [%s] does not fit in %d bytes, not sent\n\r", topic, MQTT_MAX_PACKET_SIZE);
+        trace(TRACE_TOO_BIG);
+        return false;
+    }
+
+    DEBUG_LOG_T("Publishing: [%s] %s",topic, msg.c_str());
+    return publish(topic, (const uint8_t*)msg.c_str(), msg.length(), qos1);
+}
+
+boolean MqttSession::publish(const char* topic, const PackedWriter& msg, boolean qos1) {
+    if (!_connected)
+        return false;
+
+    if (!msg.ok()){
+        DEBUG_LOG_T("Message to [%s] does not fit in %d bytes, not sent\n\r", topic, MQTT_MAX_PACKET_SIZE);
+        trace(TRACE_TOO_BIG);
+        return false;
+    }
+
+    DEBUG_LOG_T("Publishing: [%s] %d bytes packed",topic, msg.length());
+    return publish(topic, msg.data(), msg.length(), qos1);
+}
+
+boolean MqttSession::publish(const char* topic, const uint8_t* payload, size_t length, boolean qos1) {
+    DEBUG_LOG_T(" (%d/%d)", strlen(topic)+length, MQTT_MAX_PACKET_SIZE);
+    long tStart = millis();
+    phaseBegin(PHASE_PUBLISH);
+    _lastQos1 = qos1 && qosWindowSize > 0;
+    boolean ok = _lastQos1 ? publishQos1(topic, payload, length) : mqtt.publish(topic, payload, length);
+    phaseEnd(PHASE_PUBLISH);
+    if (ok) {
+        DEBUG_LOG_T(" -> Success. Time elapsed: %lu ms\n\r", millis()-tStart);
+        if (!streaming)
+            trace(TRACE_PUBLISH, length, millis() - tStart);
+        return true;
     }
+    DEBUG_LOG_T(" -> Fail. Is msg too long? Time elapsed: %lu ms\n\r", millis()-tStart);         
+    trace(TRACE_PUBLISH_FAIL, length, millis() - tStart, mqtt.state());
+    //nothing more can be sent if the connection is lost
+    _connected = mqtt.connected();
     return false;
+}
+
+// PUBLISH with QoS1 and a new packet ID, written past PubSubClient. Same size limit as the 
+// library. A full window waits for the oldest PUBACK first
+boolean MqttSession::publishQos1(const char* topic, const uint8_t* payload, size_t length) {
+    uint8_t header[MQTT_PUBLISH_HEADER_MAX + CONTENT_TOPIC_LEN];
+    if (MQTT_MAX_PACKET_SIZE < 5 + 2 + strlen(topic) + length || !waitAcked(qosWindowSize - 1))
+        return false;
+    uint16_t id = mqttWindowOpen(&qosWindow, 0, 0, 0);
+    if (!id)
+        return false;
+    _sent++;
+    size_t n = mqttPublishHeader(header, sizeof(header), topic, length, id);
+    return n && mqttSocket.write(header, n) == n && mqttSocket.write(payload, length) == length;
+}
 
+// read the broker's packets until at most inFlight messages are not acknowledged
+// false if the PUBACKs do not come in time or the connection is lost
+boolean MqttSession::waitAcked(uint8_t inFlight) {
+    unsigned long start = millis();
+    settle();
+    while (mqttWindowCount(&qosWindow) > inFlight){
+        if (millis() - start >= MQTT_PUBACK_TIMEOUT || !mqtt.loop())
+            return false;
+        if (!espClient.available())
+            delay(1);
+        settle();
+        deadlineCheck();
+    }
+    return true;
+}
+
+// acknowledged messages, oldest first
+void MqttSession::settle() {
+    mqttInFlightDef message;
+    while (mqttWindowPop(&qosWindow, &message)){
+        _acked++;
+        delivered(&message);
+    }
+}
+
+void MqttSession::carries(uint8_t kind, uint16_t count, uint32_t extra) {
+    if (_lastQos1){
+        mqttWindowSet(&qosWindow, kind, count, extra);
+        return;
+    }
+    mqttInFlightDef message = { 0, kind, true, count, extra };
+    delivered(&message);
 }
 
+void MqttSession::flush() {
+    if (!_sent)
+        return;
+    unsigned long tStart = millis();
+    waitAcked(0);
+    uint8_t lost = mqttWindowCount(&qosWindow);
+    DEBUG_LOG_T("QoS1: %u/%u acknowledged. Time elapsed: %lu ms\n\r", _acked, _sent, millis() - tStart);
+    if (!streaming || lost)
+        trace(TRACE_PUBACK, _acked, lost, millis() - tStart);
+    //a PUBACK that comes later does not match any new packet ID
+    if (lost){
+        mqttWindowReset(&qosWindow, qosWindowSize);
+        undelivered();
+    }
+    _sent = _acked = 0;
+}
+
+void MqttSession::end() {
+    if (!_connected)
+        return;
+
+    flush();
+    //process whatever the broker sent, then say goodbye
+    phaseBegin(PHASE_PUBLISH);
+    while (espClient.available()){
+        mqtt.loop();         
+        yield();
+        deadlineCheck();
+    }
+    mqtt.disconnect();
+    phaseEnd(PHASE_PUBLISH);
+    deadlineArm(BUDGET_TOTAL, 0);
+    _connected = false;
+    DEBUG_LOG_T("MQTT session closed.\n\r");
+}
+
+MqttSession session;
+
 bool readRTCMemAWS() {
     DEBUG_LOG_T("Reading AWS RTC Mem...\n\r");
 
@@ -184,6 +1055,13 @@ bool readRTCMemAWS() {
 	if (rtcMemAWS.markerFlag != AWS_RTCMEM_MAGICBYTE) {
 		rtcMemAWS.markerFlag = AWS_RTCMEM_MAGICBYTE;
 		rtcMemAWS.sleepCycles = 0;
+		rtcMemAWS.flushCycles = 0;
+		rtcMemAWS.wakeMode = WAKE_MODE_UPLOAD;
+		rtcMemAWS.heartbeatCycles = 0;
+		memset(rtcMemAWS.budgetHits, 0, sizeof(rtcMemAWS.budgetHits));
+		rtcMemAWS.wallOffset = 0;
+		rtcMemAWS.sleepSkew = SKEW_UNKNOWN;
+		rtcMemAWS.syncMinute = 0;
 		system_rtc_mem_write(AWS_RTCMEM_BEGIN, &rtcMemAWS, sizeof(rtcMemAWS));
 		ret = false;
 	}
@@ -197,9 +1075,1325 @@ void writeRTCMemAWS() {
 	system_rtc_mem_write(AWS_RTCMEM_BEGIN, &rtcMemAWS, sizeof(rtcMemAWS));
 }
 
+bool readRTCMemProfile() {
+    DEBUG_LOG_T("Reading profile RTC Mem...\n\r");
+
+    system_rtc_mem_read(PROFILE_RTCMEM_BEGIN, &rtcMemProfile, sizeof(rtcMemProfile));
+    if (!phaseProfileValid(&rtcMemProfile)) {
+        phaseProfileReset(&rtcMemProfile);
+        return false;
+    }
+    return true;
+}
+
+void writeRTCMemProfile() {
+    DEBUG_LOG_T("Writing profile RTC Mem...\n\r");
+
+    phaseProfileSeal(&rtcMemProfile);
+    system_rtc_mem_write(PROFILE_RTCMEM_BEGIN, &rtcMemProfile, sizeof(rtcMemProfile));
+}
+
+bool queueFlashRead(uint32_t offset, void* data, size_t size) {
+    return ESP.flashRead(offset, (uint32_t*)data, size);
+}
+
+bool queueFlashWrite(uint32_t offset, const void* data, size_t size) {
+    return ESP.flashWrite(offset, (uint32_t*)data, size);
+}
+
+bool queueFlashErase(uint32_t offset) {
+    return ESP.flashEraseSector(offset / SPI_FLASH_SEC_SIZE);
+}
+
+const flashQueueIoDef queueFlash = { 
+    queueFlashRead, queueFlashWrite, queueFlashErase, QUEUE_FLASH_BEGIN, QUEUE_FLASH_SEGMENTS 
+};
+
+const traceIoDef traceFlash = { 
+    queueFlashRead, queueFlashWrite, queueFlashErase, TRACE_FLASH_BEGIN, TRACE_FLASH_SEGMENTS 
+};
+
+// whole trace to serial, oldest wake first. One line per block: TRACE <hex>
+void traceDump() {
+    traceCursorDef cursor;
+    uint32_t block[TRACE_BLOCK_MAX / 4];
+    size_t size;
+    if (!traceFirst(&cursor, &traceFlash))
+        return;
+    while ((size = traceNext(&cursor, &traceFlash, (uint8_t*)block)) > 0){
+        Serial.print("TRACE ");
+        for (size_t i = 0; i < size; i++)
+            Serial.printf("%02X", ((uint8_t*)block)[i]);
+        Serial.println();
+    }
+}
+
+// cursors are trusted only on deep sleep wakes. Any other reset may have 
+// interrupted a flash write, the log is scanned then
+bool readRTCMemQueue(boolean coldBoot) {
+    DEBUG_LOG_T("Reading queue RTC Mem...\n\r");
+
+    system_rtc_mem_read(QUEUE_RTCMEM_BEGIN, &rtcMemQueue, sizeof(rtcMemQueue));
+    if (coldBoot || !flashQueueValid(&rtcMemQueue)) {
+        DEBUG_LOG_T("Scanning offline queue...\n\r");
+        flashQueueMount(&rtcMemQueue, &queueFlash);
+        return false;
+    }
+    return true;
+}
+
+void writeRTCMemQueue() {
+    DEBUG_LOG_T("Writing queue RTC Mem...\n\r");
+
+    flashQueueSeal(&rtcMemQueue);
+    system_rtc_mem_write(QUEUE_RTCMEM_BEGIN, &rtcMemQueue, sizeof(rtcMemQueue));
+}
+
+bool readRTCMemBackoff() {
+    DEBUG_LOG_T("Reading backoff RTC Mem...\n\r");
+
+    system_rtc_mem_read(BACKOFF_RTCMEM_BEGIN, &rtcMemBackoff, sizeof(rtcMemBackoff));
+    if (!backoffValid(&rtcMemBackoff)) {
+        backoffReset(&rtcMemBackoff);
+        return false;
+    }
+    return true;
+}
+
+void writeRTCMemBackoff() {
+    DEBUG_LOG_T("Writing backoff RTC Mem...\n\r");
+
+    backoffSeal(&rtcMemBackoff);
+    system_rtc_mem_write(BACKOFF_RTCMEM_BEGIN, &rtcMemBackoff, sizeof(rtcMemBackoff));
+}
+
+// outcome of this wake's upload attempt, decides when the next one is made
+boolean uploading;
+void uploadDone(boolean success) {
+    if (!uploading)
+        return;
+    uploading = false;
+    backoffUpdate(&rtcMemBackoff, success, WiFi.isConnected() ? WiFi.RSSI() : 0, RSSI_CRITICAL_LEVEL, 
+        max(BACKOFF_MAX_MINUTES / sampleInterval, 1));
+    DEBUG_LOG_T("Upload %s, failures in a row: %u, next attempt held for %u wakes (mean RSSI %d)\n\r", 
+        success ? "done" : "failed", rtcMemBackoff.failures, rtcMemBackoff.hold, backoffRssi(&rtcMemBackoff));
+    trace(TRACE_UPLOAD, success, rtcMemBackoff.failures, rtcMemBackoff.hold);
+}
+
 void printRTCMemAWS() {
-	DEBUG_LOG_T("AWS RTC Mem Status:\n\rmarkerFlag: %c\n\rremaining sleep cycles: %d\n\r", rtcMemAWS.markerFlag, rtcMemAWS.sleepCycles);
+	DEBUG_LOG_T("AWS RTC Mem Status:\n\rmarkerFlag: %c\n\rremaining sleep cycles: %d\n\rremaining flush cycles: %d\n\rnext wake: %c\n\rremaining heartbeat cycles: %d\n\rbudget hits: %u/%u/%u/%u\n\rwall clock offset: %u\n\rsleep skew: %d\n\r", rtcMemAWS.markerFlag, rtcMemAWS.sleepCycles, rtcMemAWS.flushCycles, rtcMemAWS.wakeMode, rtcMemAWS.heartbeatCycles, 
+        rtcMemAWS.budgetHits[BUDGET_TOTAL], rtcMemAWS.budgetHits[BUDGET_WIFI], rtcMemAWS.budgetHits[BUDGET_CONNECT], rtcMemAWS.budgetHits[BUDGET_PUBLISH],
+        rtcMemAWS.wallOffset, rtcMemAWS.sleepSkew);
+
+}
+
+bool readRTCMemSamples() {
+    DEBUG_LOG_T("Reading samples RTC Mem...\n\r");
+
+    system_rtc_mem_read(SAMPLES_RTCMEM_BEGIN, &rtcMemSamples, sizeof(rtcMemSamples));
+    if (!sampleRingValid(&rtcMemSamples)) {
+        DEBUG_LOG_T("Samples RTC Mem corrupted. Resetting...\n\r");
+        sampleRingReset(&rtcMemSamples);
+        system_rtc_mem_write(SAMPLES_RTCMEM_BEGIN, &rtcMemSamples, sizeof(rtcMemSamples));
+        return false;
+    }
+    return true;
+}
+
+void writeRTCMemSamples() {
+    DEBUG_LOG_T("Writing samples RTC Mem...\n\r");
+
+    sampleRingSeal(&rtcMemSamples);
+    system_rtc_mem_write(SAMPLES_RTCMEM_BEGIN, &rtcMemSamples, sizeof(rtcMemSamples));
+}
+
+bool readRTCMemSensors() {
+    DEBUG_LOG_T("Reading sensors RTC Mem...\n\r");
+
+    system_rtc_mem_read(SENSORS_RTCMEM_BEGIN, &rtcMemSensors, sizeof(rtcMemSensors));
+    if (rtcMemSensors.count > SENSOR_MAX || rtcMemSensors.crc != rtcMemCrc(&rtcMemSensors, sizeof(rtcMemSensors))) {
+        memset(&rtcMemSensors, 0, sizeof(rtcMemSensors));
+        return false;
+    }
+    return true;
+}
+
+void writeRTCMemSensors() {
+    DEBUG_LOG_T("Writing sensors RTC Mem...\n\r");
+
+    rtcMemSensors.crc = rtcMemCrc(&rtcMemSensors, sizeof(rtcMemSensors));
+    system_rtc_mem_write(SENSORS_RTCMEM_BEGIN, &rtcMemSensors, sizeof(rtcMemSensors));
+}
+
+bool readRTCMemWindow() {
+    DEBUG_LOG_T("Reading window RTC Mem...\n\r");
+
+    system_rtc_mem_read(WINDOW_RTCMEM_BEGIN, &rtcMemWindow, sizeof(rtcMemWindow));
+    if (!windowValid(&rtcMemWindow)) {
+        windowReset(&rtcMemWindow);
+        return false;
+    }
+    return true;
+}
+
+void writeRTCMemWindow() {
+    DEBUG_LOG_T("Writing window RTC Mem...\n\r");
+
+    windowSeal(&rtcMemWindow);
+    system_rtc_mem_write(WINDOW_RTCMEM_BEGIN, &rtcMemWindow, sizeof(rtcMemWindow));
+}
+
+void sensorAddress(uint8_t i, uint8_t* rom) {
+    memcpy(rom, rtcMemSensors.sensor[i].rom, sizeof(rtcMemSensors.sensor[i].rom));
+    rom[7] = OneWire::crc8(rom, 7);
+}
+
+// hash of the sensors found by the last ROM search, fits in the bits above the sensor index
+uint8_t sensorTable() {
+    return crc32(rtcMemSensors.sensor, rtcMemSensors.count * sizeof(sensorDef)) >> (SENSOR_INDEX_BITS + 24);
+}
 
+// readings from the first one on that were taken with the same sensor table
+int sensorTableRun(const sampleDef* samples, int n) {
+    int run = 0;
+    while (run < n && (samples[run].sensor >> SENSOR_INDEX_BITS) == (samples[0].sensor >> SENSOR_INDEX_BITS))
+        run++;
+    return run;
+}
+
+boolean sensorTableCurrent(const sampleDef* sample) {
+    return (sample->sensor >> SENSOR_INDEX_BITS) == sensorTable();
+}
+
+// sensor table taken off, readings as the content messages expect them
+void sensorIndexes(sampleDef* samples, int n) {
+    for (int i = 0; i < n; i++)
+        samples[i].sensor &= SENSOR_INDEX_MASK;
+}
+
+// ROM ID as 16 hex digits
+void sensorId(uint8_t i, char* id) {
+    DeviceAddress rom;
+    sensorAddress(i, rom);
+    for (uint8_t j = 0; j < sizeof(rom); j++)
+        sprintf(id + 2 * j, "%02X", rom[j]);
+}
+
+// temperatures and ages of the readings of one sensor
+void buildReadings(JsonWriter& json, const sampleDef* samples, int n, int sensor) {
+    json.beginArray("temperature");
+    for (int i = 0; i < n; i++)
+        if (sensor < 0 || samples[i].sensor == sensor)
+            json.itemFixed(samples[i].temp, 2);
+    json.endArray();
+    json.beginArray("age");
+    for (int i = 0; i < n; i++)
+        if (sensor < 0 || samples[i].sensor == sensor)
+            json.item(deviceClock() - samples[i].time);
+    json.endArray();
+}
+
+// build the content message from n readings, oldest first
+// a single current reading keeps the original format {"sensor":..., "temperature":...}
+// batches are sent as arrays, age[] is in seconds before the upload. With more than
+// one sensor the arrays are grouped by ROM ID: "readings":{"28FF...":{"temperature":[...],...}}
+void buildContentMsg(JsonWriter& json, const sampleDef* samples, int n, uint32_t dropped) {
+    json.beginObject();
+    json.add("sensor", AWS_thing_name);
+    if (rtcMemSensors.count > 1){
+        json.beginObject("readings");
+        for (uint8_t s = 0; s < rtcMemSensors.count; s++){
+            int i = 0;
+            while (i < n && samples[i].sensor != s)
+                i++;
+            if (i == n)
+                continue;
+            char id[2 * sizeof(DeviceAddress) + 1];
+            sensorId(s, id);
+            json.beginObject(id);
+            buildReadings(json, samples, n, s);
+            json.endObject();
+        }
+        json.endObject();
+        if (dropped)
+            json.add("dropped", dropped);
+    }
+    else if (n == 1 && samples[0].time == deviceClock() && dropped == 0){
+        json.addFixed("temperature", samples[0].temp, 2);
+    }
+    else {
+        buildReadings(json, samples, n, -1);
+        if (dropped)
+            json.add("dropped", dropped);
+    }
+    json.endObject();
+}
+
+// statistics of one sensor over the aggregation window, centi deg C
+void buildWindowStats(JsonWriter& json, uint8_t series) {
+    json.add("n", rtcMemWindow.count[series]);
+    json.addFixed("temperature", windowMean(&rtcMemWindow, series), 2);
+    json.addFixed("min", rtcMemWindow.stat[series].min, 2);
+    json.addFixed("max", rtcMemWindow.stat[series].max, 2);
+    json.addFixed("sd", windowStddev(&rtcMemWindow, series), 2);
+}
+
+// build the aggregation window message, temperature is the mean over n readings
+// taken period seconds apart: {"sensor":...,"period":300,"n":12,"temperature":...,"min":...}
+// with more than one sensor the statistics are grouped by ROM ID: "window":{"28FF...":{"n":...}}
+void buildWindowMsg(JsonWriter& json) {
+    json.beginObject();
+    json.add("sensor", AWS_thing_name);
+    json.add("period", 60 * sampleInterval);
+    if (rtcMemSensors.count > 1){
+        json.beginObject("window");
+        for (uint8_t s = 0; s < rtcMemSensors.count; s++){
+            if (rtcMemWindow.count[s] == 0)
+                continue;
+            char id[2 * sizeof(DeviceAddress) + 1];
+            sensorId(s, id);
+            json.beginObject(id);
+            buildWindowStats(json, s);
+            json.endObject();
+        }
+        json.endObject();
+    }
+    else
+        buildWindowStats(json, 0);
+    json.endObject();
+}
+
+// sensor table of the packed format, ROM IDs with CRC byte
+void packedRoms(uint8_t (*roms)[PACKED_ROM_SIZE]) {
+    for (uint8_t s = 0; s < rtcMemSensors.count; s++)
+        sensorAddress(s, roms[s]);
+}
+
+// packed messages are sized so that PubSubClient always takes them (header and topic)
+size_t packedSize() {
+    return sizeof(msgBuffer) - 7 - strlen(AWS_content_topic);
+}
+
+// publish up to n readings, oldest first, as one content message in the format of the device
+// returns the number of readings sent, the first ones. A packed batch that does not fit is cut
+// down until it does. 0 - publish failed
+int publishReadings(const sampleDef* samples, int n, uint32_t dropped) {
+    if (!packedFormat){
+        JsonWriter json(msgBuffer, sizeof(msgBuffer));
+        buildContentMsg(json, samples, n, dropped);
+        return session.publish(AWS_content_topic, json, true) ? n : 0;
+    }
+
+    uint8_t roms[SENSOR_MAX][PACKED_ROM_SIZE];
+    packedRoms(roms);
+    PackedWriter packed((uint8_t*)msgBuffer, packedSize());
+    packedReadings(packed, AWS_thing_name, roms, rtcMemSensors.count, samples, n, deviceClock(), dropped);
+    while (!packed.ok() && n > 1){
+        n = n * 3 / 4;
+        packed.reset();
+        packedReadings(packed, AWS_thing_name, roms, rtcMemSensors.count, samples, n, deviceClock(), dropped);
+    }
+    return session.publish(AWS_content_topic, packed, true) ? n : 0;
+}
+
+boolean publishWindow() {
+    if (!packedFormat){
+        JsonWriter json(msgBuffer, sizeof(msgBuffer));
+        buildWindowMsg(json);
+        return session.publish(AWS_content_topic, json, true);
+    }
+
+    uint8_t roms[SENSOR_MAX][PACKED_ROM_SIZE];
+    packedRoms(roms);
+    PackedWriter packed((uint8_t*)msgBuffer, packedSize());
+    packedWindow(packed, AWS_thing_name, roms, rtcMemSensors.count, &rtcMemWindow, 60 * sampleInterval);
+    return session.publish(AWS_content_topic, packed, true);
+}
+
+// aggregation window is uploaded when the next reading completes it
+boolean windowDue() {
+    return windowLength > 1 && windowSamples(&rtcMemWindow) + 1 >= windowLength;
+}
+
+// decide if the coming wake has to upload, the same decision schedules the radio for it
+// on the way to sleep and picks the upload path on the wake itself
+// i.e. streaming, shadow service is due, flush countdown expired (or last upload failed) 
+// or the next reading fills up the batch or the aggregation window
+// with report-on-change or aggregation the next reading does not go to the batch, 
+// only pending ones count
+boolean uploadDue() {
+    if (streamPeriod)
+        return true;
+    int expected = rtcMemSamples.count + rtcMemQueue.count + (deltaThreshold > 0 || windowLength > 1 ? 0 : rtcMemSensors.count);
+    return rtcMemAWS.sleepCycles <= 0 || (rtcMemAWS.flushCycles <= 0 && expected > 0) || expected >= batchSize || windowDue();
+}
+
+// wake scheduler: radio on for the next wake only if it will upload
+byte scheduleNextWake() {
+    return uploadDue() ? WAKE_MODE_UPLOAD : WAKE_MODE_SAMPLE;
+}
+
+// ROM search on all buses, on cold boot or when none of the cached sensors answers
+void searchSensors() {
+    memset(&rtcMemSensors, 0, sizeof(rtcMemSensors));
+    for (uint8_t b = 0; b < SENSOR_BUSES; b++){
+        DS18B20[b].begin();
+        for (uint8_t i = 0; i < DS18B20[b].getDeviceCount() && rtcMemSensors.count < SENSOR_MAX; i++){
+            DeviceAddress rom;
+            if (!DS18B20[b].getAddress(rom, i))
+                continue;
+            sensorDef* sensor = &rtcMemSensors.sensor[rtcMemSensors.count++];
+            memcpy(sensor->rom, rom, sizeof(sensor->rom));
+            sensor->bus = b;
+            //resolution is kept in sensor EEPROM - do not wear it out on every wake
+            DS18B20[b].setResolution(rom, SENSOR_RESOLUTION);
+        }
+    }
+    DEBUG_LOG_T("Sensors found: %u\n\r", rtcMemSensors.count);
+    trace(TRACE_SENSORS, rtcMemSensors.count);
+    sensorsSearched = true;
+    writeRTCMemSensors();
+}
+
+// start temperature conversion without waiting for it
+// the result is collected by takeReading() when it is actually needed
+void startConversion(boolean coldBoot) {
+    if (coldBoot || !readRTCMemSensors() || rtcMemSensors.count == 0)
+        searchSensors();
+    //skip ROM - all sensors on a bus convert at once
+    for (uint8_t b = 0; b < SENSOR_BUSES; b++){
+        DS18B20[b].setWaitForConversion(false);
+        DS18B20[b].requestTemperatures(); 
+    }
+    conversionStart = millis();
+}
+
+// the bus reads 0 while any of its sensors is still converting
+boolean conversionComplete() {
+    for (uint8_t b = 0; b < SENSOR_BUSES; b++)
+        if (!DS18B20[b].isConversionComplete())
+            return false;
+    return true;
+}
+
+// append all readings from RTC memory to the offline queue in one flash write
+void spillSamples() {
+    sampleDef samples[SAMPLE_RING_CAPACITY];
+    int n = rtcMemSamples.count;
+    for (int i = 0; i < n; i++)
+        samples[i] = *sampleRingAt(&rtcMemSamples, i);
+    if (flashQueueAppend(&rtcMemQueue, &queueFlash, samples, n)){
+        DEBUG_LOG_T("%d readings moved to offline queue (%u queued)\n\r", n, rtcMemQueue.count);
+        trace(TRACE_SPILL, n, rtcMemQueue.count);
+        sampleRingDrop(&rtcMemSamples, n);
+        rtcMemQueue.dropped += rtcMemSamples.dropped;
+        rtcMemSamples.dropped = 0;
+    }
+    else {
+        DEBUG_LOG_T("Offline queue write failed!\n\r");
+    }
+    writeRTCMemQueue();
+}
+
+// wait for the conversion (if still running) and store the reading
+// returns the number of sensors that answered
+uint8_t takeReading() {
+    readingTaken = true;
+    phaseBegin(PHASE_SENSOR);
+    unsigned long waitStart = millis();
+    unsigned long conversionTime = DS18B20[0].millisToWaitForConversion(SENSOR_RESOLUTION);
+    while (!conversionComplete() && millis() - conversionStart < conversionTime)
+        yield();
+    conversionWait = millis() - waitStart;
+    conversionOverlap = min(waitStart - conversionStart, conversionTime);
+
+    //read by address, no search. All sensors are reported if one of them has changed
+    int16_t readings[SENSOR_MAX];
+    uint8_t answered = 0;
+    uint8_t valid = 0;              //bit i - sensor i answered
+    boolean changed = sensorsSearched || deltaThreshold == 0 || rtcMemAWS.heartbeatCycles <= 0;
+    for (uint8_t i = 0; i < rtcMemSensors.count; i++){
+        DeviceAddress rom;
+        sensorAddress(i, rom);
+        float temp = DS18B20[rtcMemSensors.sensor[i].bus].getTempC(rom);
+        DEBUG_LOG_T("Temperature %u: %f\n\r", i, temp);
+        if (temp == DEVICE_DISCONNECTED_C)
+            continue;
+        readings[i] = (int16_t)round(temp * 100);
+        valid |= 1 << i;
+        answered++;
+        if (abs(readings[i] - rtcMemSensors.lastTemp[i]) >= deltaThreshold)
+            changed = true;
+    }
+    phaseEnd(PHASE_SENSOR);
+    DEBUG_LOG_T("Waited %lu ms, overlapped %lu ms\n\r", conversionWait, conversionOverlap);
+    //a streaming wake takes thousands, its trace has the summary (TRACE_STREAM)
+    if (answered && !streaming)
+        trace(TRACE_READING, answered, conversionWait, readings[__builtin_ctz(valid)]);
+
+    //sensors replaced or bus broken - search again on the next wake
+    if (answered == 0){
+        DEBUG_LOG_T("No sensor answered!\n\r");
+        trace(TRACE_NO_SENSOR);
+        rtcMemSensors.count = 0;
+        writeRTCMemSensors();
+        return 0;
+    }
+    //aggregation: the window takes the readings, report-on-change does not apply
+    if (windowLength > 1){
+        for (uint8_t i = 0; i < rtcMemSensors.count; i++)
+            if (valid & (1 << i))
+                windowAdd(&rtcMemWindow, i, readings[i]);
+        return answered;
+    }
+    if (!changed){
+        DEBUG_LOG_T("No change since last report, readings dropped.\n\r");
+        rtcMemAWS.heartbeatCycles--;
+        return answered;
+    }
+    rtcMemAWS.heartbeatCycles = heartbeatInterval - 1;
+    //uploads keep failing - move the readings to the offline queue rather than overwrite them
+    if (rtcMemSamples.count + answered > SAMPLE_RING_CAPACITY)
+        spillSamples();
+    uint8_t table = sensorTable() << SENSOR_INDEX_BITS;
+    for (uint8_t i = 0; i < rtcMemSensors.count; i++){
+        if (!(valid & (1 << i)))
+            continue;
+        rtcMemSensors.lastTemp[i] = readings[i];
+        sampleRingPush(&rtcMemSamples, deviceClock(), readings[i], table | i);
+    }
+    writeRTCMemSensors();
+    return answered;
+}
+
+// last shadow state from its flash sector. shadowKnown is false if there is no valid record
+void readShadowState() {
+    DEBUG_LOG_T("Reading shadow state...\n\r");
+    uint32_t offset = SHADOW_FLASH_SECTOR * SPI_FLASH_SEC_SIZE;
+    shadowStateDef record;
+    shadowKnown = false;
+    for (shadowSlot = 0; shadowSlot < SHADOW_RECORDS; shadowSlot++){
+        if (!ESP.flashRead(offset + shadowSlot * sizeof(record), (uint32_t*)&record, sizeof(record)) || record.seq == UINT32_MAX)
+            break;
+        //a record cut short by a reset is skipped, the slot stays used
+        if (record.crc != rtcMemCrc(&record, sizeof(record)) || (shadowKnown && record.seq < shadowState.seq))
+            continue;
+        shadowState = record;
+        shadowKnown = true;
+    }
+    if (!shadowKnown)
+        memset(&shadowState, 0, sizeof(shadowState));
+}
+
+// append what the last update reported. The sector is erased when it is full
+void writeShadowState() {
+    shadowNext.seq = shadowState.seq + 1;
+    shadowNext.crc = rtcMemCrc(&shadowNext, sizeof(shadowNext));
+    shadowState = shadowNext;
+    shadowKnown = true;
+    if (shadowSlot >= SHADOW_RECORDS){
+        if (!ESP.flashEraseSector(SHADOW_FLASH_SECTOR)){
+            DEBUG_LOG_T("Shadow state erase failed!\n\r");
+            return;
+        }
+        shadowSlot = 0;
+    }
+    uint32_t offset = SHADOW_FLASH_SECTOR * SPI_FLASH_SEC_SIZE + shadowSlot++ * sizeof(shadowState);
+    if (!ESP.flashWrite(offset, (uint32_t*)&shadowState, sizeof(shadowState))) {
+        DEBUG_LOG_T("Shadow state write failed!\n\r");
+    }
+}
+
+// true if a field has to be sent: its value differs from the one last reported (by hash)
+// or the update is a full one. The new hash goes to shadowNext
+boolean shadowChanged(uint8_t field, const void* value, size_t size) {
+    uint16_t hash = crc32((const uint8_t*)value, size);
+    boolean changed = shadowFull || hash != shadowState.hash[field];
+    shadowNext.hash[field] = hash;
+    return changed;
+}
+
+boolean shadowChanged(uint8_t field, const char* value) {
+    return shadowChanged(field, value, strlen(value));
+}
+
+boolean shadowChanged(uint8_t field, long value) {
+    return shadowChanged(field, &value, sizeof(value));
+}
+
+// battery and RSSI have some noise, they are sent when they have moved more than delta
+// since last reported
+void addShadowVitals(JsonWriter& json) {
+    uint16_t battery = ESP.getVcc();
+    int rxlev = WiFi.RSSI();
+    if (shadowFull || abs((int)battery - shadowState.battery) >= SHADOW_BATTERY_DELTA){
+        json.add("battery", battery);
+        shadowNext.battery = battery;
+    }
+    if (shadowFull || abs(rxlev - shadowState.rxlev) >= SHADOW_RSSI_DELTA){
+        json.add("rxlev", rxlev);
+        shadowNext.rxlev = rxlev;
+    }
+}
+
+// shadow update, reported fields that have changed since the last update. timing covers
+// the time since then and is always sent. Set shadowFull for all fields
+// newest trace blocks, base64. As many as fit in traceShadow bytes and in what is left
+// of the message: MQTT header and topic, the key and the closing braces
+void addShadowTrace(JsonWriter& json) {
+    long space = MQTT_MAX_PACKET_SIZE - 7 - (long)strlen(AWS_shadow) - (long)json.length() - 11 - 3;
+    size_t limit = min((long)traceShadow, space / 4 * 3);
+    traceCursorDef cursor;
+    uint32_t block[TRACE_BLOCK_MAX / 4];
+    size_t size, total = 0;
+    if (!traceFirst(&cursor, &traceFlash))
+        return;
+    while ((size = traceNext(&cursor, &traceFlash, (uint8_t*)block)) > 0)
+        total += size;
+
+    //oldest blocks are skipped until the rest fits
+    static uint8_t data[TRACE_SHADOW_MAX];
+    static char text[TRACE_SHADOW_MAX / 3 * 4 + 5];
+    size_t length = 0;
+    traceFirst(&cursor, &traceFlash);
+    while ((size = traceNext(&cursor, &traceFlash, (uint8_t*)block)) > 0){
+        if (total > limit){
+            total -= size;
+            continue;
+        }
+        memcpy(data + length, block, size);
+        length += size;
+    }
+    if (length && traceBase64(data, length, text, sizeof(text)))
+        json.add("trace", text);
+}
+
+void buildShadowMsg(JsonWriter& json) {
+    shadowNext = shadowState;
+    json.beginObject();
+    json.beginObject("state");
+    json.beginObject("reported");
+    if (shadowChanged(SHADOW_SENSOR, AWS_thing_name))
+        json.add("sensor", AWS_thing_name);
+    if (shadowChanged(SHADOW_TOPIC, AWS_content_topic))
+        json.add("topic", AWS_content_topic);
+    addShadowVitals(json);
+    if (shadowChanged(SHADOW_WIFI_FAST, (long)rtcMemWiFi.fastConnect))
+        json.add("wifi_fast", rtcMemWiFi.fastConnect);
+    if (shadowChanged(SHADOW_TLS_RESUMED, (long)rtcMemTLS.resumed))
+        json.add("tls_resumed", rtcMemTLS.resumed);
+    if (shadowChanged(SHADOW_TLS_FULL, (long)rtcMemTLS.full))
+        json.add("tls_full", rtcMemTLS.full);
+    if (shadowChanged(SHADOW_BACKLOG, (long)rtcMemQueue.count))
+        json.add("backlog", rtcMemQueue.count);
+    if (shadowChanged(SHADOW_SENSORS, (long)rtcMemSensors.count))
+        json.add("sensors", rtcMemSensors.count);
+    if (shadowChanged(SHADOW_APPNAME, APPNAME))
+        json.add("AppName", APPNAME);
+    if (shadowChanged(SHADOW_VERSION, VERSION))
+        json.add("Version", VERSION);
+    if (shadowChanged(SHADOW_COMPDATE, COMPDATE))
+        json.add("CompileDate", COMPDATE);
+    //fields that can be set through the shadow. Reported back, so the delta goes away
+    uint32_t config = 0;
+    for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++)
+        if (configFields[i].shadow)
+            config = crc32(*configFields[i].value, strlen(*configFields[i].value) + 1, config);
+    if (shadowChanged(SHADOW_CONFIG, &config, sizeof(config))){
+        json.beginObject("config");
+        for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++)
+            if (configFields[i].shadow)
+                json.add(configFields[i].name, *configFields[i].value);
+        json.endObject();
+    }
+
+    //[min, mean, max] ms per wake phase since the last shadow update
+    json.beginObject("timing");
+    json.add("cycles", rtcMemProfile.stat[PHASE_AWAKE].count);
+    for (int i = 0; i < PHASE_COUNT; i++){
+        if (rtcMemProfile.stat[i].count == 0)
+            continue;
+        json.beginArray(phaseNames[i]);
+        json.item(rtcMemProfile.stat[i].min);
+        json.item(phaseProfileMean(&rtcMemProfile, i));
+        json.item(rtcMemProfile.stat[i].max);
+        json.endArray();
+    }
+    //sensor conversion time hidden behind WiFi/MQTT connect, this wake
+    json.add("overlap", conversionOverlap);
+    json.endObject();
+
+    //wakes cut short by each budget since the last shadow update
+    if (shadowChanged(SHADOW_BUDGET_HITS, rtcMemAWS.budgetHits, sizeof(rtcMemAWS.budgetHits))){
+        json.beginObject("budget_hits");
+        for (int i = 0; i < BUDGET_COUNT; i++)
+            json.add(budgetNames[i], rtcMemAWS.budgetHits[i]);
+        json.endObject();
+    }
+    if (traceShadow > 0)
+        addShadowTrace(json);
+    json.endObject();
+    json.endObject();
+    json.endObject();
+}
+
+// battery and RSSI between two shadow updates. false - neither has moved, nothing to send
+boolean buildVitalsMsg(JsonWriter& json) {
+    shadowNext = shadowState;
+    json.beginObject();
+    json.beginObject("state");
+    json.beginObject("reported");
+    size_t empty = json.length();
+    addShadowVitals(json);
+    boolean moved = json.length() != empty;
+    json.endObject();
+    json.endObject();
+    json.endObject();
+    return moved;
+}
+
+// time since reset in us. The RTC timer starts from zero on every reset, deep sleep
+// wake included, so unlike millis() it counts the boot ROM and bootloader as well
+uint64_t awakeUs() {
+    return ((uint64_t)system_get_rtc_time() * system_rtc_clock_cali_proc()) >> 12;
+}
+
+// slots are shifted by this many seconds on each device, so a fleet on the same 
+// sample interval does not report all at once. Chip IDs of a batch are often 
+// consecutive, the CRC spreads them
+uint32_t slotOffset(uint32_t period) {
+    uint32_t id = ESP.getChipId();
+    return crc32((const uint8_t*)&id, sizeof(id)) % period;
+}
+
+// unix time in ms once the clock has been synced, device clock before
+uint64_t clockNow() {
+    return 1000ULL * (rtcMemSamples.clock + rtcMemAWS.wallOffset) + awakeUs() / 1000;
+}
+
+// ms from now (as clockNow()) to the next slot
+uint64_t slotLeft(uint64_t now) {
+    uint64_t period = 60000ULL * sampleInterval;
+    return period - (now + period - 1000ULL * slotOffset(60 * sampleInterval)) % period;
+}
+
+// sleep until the next slot. Slots are sample_interval apart, aligned to unix time once 
+// the clock has been synced (device clock before). The time awake is taken off the sleep
+// and the sleep timer skew is compensated. Moves the device clock on to the slot and 
+// returns the time to sleep in us
+uint64_t scheduleSleep() {
+    uint64_t period = 60000ULL * sampleInterval;
+    int32_t skew = rtcMemAWS.sleepSkew == SKEW_UNKNOWN ? 0 : rtcMemAWS.sleepSkew;
+    uint64_t now = clockNow();
+    uint64_t left = slotLeft(now);
+    //a streaming wake runs up to the slot on purpose, if it is late the next one starts at once
+    if (streaming && left >= period / 2)
+        left = 1;
+    //woke up early or stayed long - the next slot is too close, take the one after
+    else if (!streaming && left < period / 2)
+        left += period;
+    rtcMemSamples.clock = (now + left) / 1000 - rtcMemAWS.wallOffset;
+    return left * 1000 * 65536 / (65536 + skew);
+}
+
+// device clock in the shadow. The update is small enough for the broker's answer on 
+// .../accepted to fit in the MQTT buffer
+void buildClockMsg(JsonWriter& json) {
+    json.beginObject();
+    json.beginObject("state");
+    json.beginObject("reported");
+    json.add("clock", rtcMemSamples.clock);
+    //ppm
+    if (rtcMemAWS.sleepSkew != SKEW_UNKNOWN)
+        json.add("sleep_skew", (long)rtcMemAWS.sleepSkew * 15625 / 1024);
+    json.add("slot", slotOffset(60 * sampleInterval));
+    json.endObject();
+    json.endObject();
+    json.endObject();
+}
+
+volatile uint32_t wallTime;         //broker's unix time, 0 - not received this wake
+uint64_t wallTimeAwake;             //awakeUs() when it was received
+
+// "1.10.2" > "1.9.0", numbers compared one by one
+boolean versionNewer(const char* a, const char* b) {
+    while (*a || *b){
+        long x = strtol(a, (char**)&a, 10);
+        long y = strtol(b, (char**)&b, 10);
+        if (x != y)
+            return x > y;
+        if (*a == '.')
+            a++;
+        if (*b == '.')
+            b++;
+        if ((*a && !isdigit(*a)) || (*b && !isdigit(*b)))
+            break;
+    }
+    return false;
+}
+
+// desired state that differs from the reported one: {"state":{"Version":"1.26.0","config":{...}}, ...}
+// IAS fields take effect when the MQTT session is over, the FW update check runs after it
+void shadowDelta(const char* payload, unsigned int length) {
+    jsonSpanDef doc = { payload, length }, state, config, value;
+    char text[sizeof(configDeltaTextDef)];
+    if (!jsonMember(doc, "state", &state))
+        return;
+    if (jsonMember(state, "Version", &value) && jsonText(value, text, sizeof(text)) && versionNewer(text, VERSION)){
+        DEBUG_LOG_T("Shadow asks for FW version %s\n\r", text);
+        updateRequested = true;
+    }
+    if (!jsonMember(state, "config", &config))
+        return;
+    for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++){
+        const configFieldDef* field = &configFields[i];
+        if (!field->shadow || !jsonMember(config, field->name, &value) || !jsonText(value, text, field->size + 1) 
+                || strcmp(text, *field->value) == 0)
+            continue;
+        DEBUG_LOG_T("Shadow sets %s to %s\n\r", field->name, text);
+        *field->value = configSlot(&configCache.overrides, field);
+        strcpy(*field->value, text);
+        configCache.overridden |= 1UL << i;
+        configChanged = true;
+    }
+}
+
+// MQTT messages. Shadow service answers end with the broker's unix time: ..."timestamp":1700000000}
+void callback(char* topic, byte* payload, unsigned int length) {
+    size_t n = strlen(topic);
+    if (n > 6 && strcmp(topic + n - 6, "/delta") == 0){
+        shadowDelta((const char*)payload, length);
+        return;
+    }
+
+    static const char key[] = "\"timestamp\":";
+    uint32_t t = 0;
+    for (unsigned int i = 0; i + sizeof(key) - 1 < length; i++){
+        if (memcmp(payload + i, key, sizeof(key) - 1) != 0)
+            continue;
+        t = 0;
+        for (i += sizeof(key) - 1; i < length && payload[i] >= '0' && payload[i] <= '9'; i++)
+            t = 10 * t + payload[i] - '0';
+    }
+    if (t){
+        wallTimeAwake = awakeUs();
+        wallTime = t;
+    }
+}
+
+// sync the device clock with the broker's time. What the device clock has fallen behind 
+// (or run ahead) since the last sync is down to the sleep timer, the skew is corrected by it
+void clockSync() {
+    char topic[sizeof(configCache.shadow) + 9];
+    snprintf(topic, sizeof(topic), "%s/accepted", AWS_shadow);
+    if (!session.connected() || !mqtt.subscribe(topic))
+        return;
+    JsonWriter json(msgBuffer, sizeof(msgBuffer));
+    buildClockMsg(json);
+    if (!session.publish(AWS_shadow, json))
+        return;
+    phaseBegin(PHASE_PUBLISH);
+    unsigned long start = millis();
+    while (!wallTime && millis() - start < CLOCK_SYNC_TIMEOUT && mqtt.loop())
+        delay(10);
+    phaseEnd(PHASE_PUBLISH);
+    if (!wallTime){
+        DEBUG_LOG_T("No time from the broker.\n\r");
+        trace(TRACE_CLOCK_FAIL);
+        return;
+    }
+
+    uint32_t now = rtcMemSamples.clock + wallTimeAwake / 1000000;
+    if (rtcMemAWS.wallOffset){
+        int32_t error = wallTime - (now + rtcMemAWS.wallOffset);
+        uint16_t minutes = now / 60 - rtcMemAWS.syncMinute;
+        int32_t skew = rtcMemAWS.sleepSkew == SKEW_UNKNOWN ? 0 : rtcMemAWS.sleepSkew;
+        if (minutes >= SKEW_MIN_MINUTES)
+            rtcMemAWS.sleepSkew = constrain(skew + (int32_t)((int64_t)error * 65536 / (60L * minutes)), -SKEW_MAX, SKEW_MAX);
+        DEBUG_LOG_T("Device clock off by %d s over %u minutes, sleep skew now %d\n\r", error, minutes, rtcMemAWS.sleepSkew);
+        trace(TRACE_CLOCK, error, rtcMemAWS.sleepSkew);
+    }
+    rtcMemAWS.wallOffset = wallTime - now;
+    rtcMemAWS.syncMinute = now / 60;
+}
+
+// store what the next wake needs and decide how it starts
+// runs once per wake - the deadline timer may have done it already
+boolean sleepPrepared;
+uint64_t sleepTime;                 //us
+void prepareSleep() {
+    if (sleepPrepared)
+        return;
+    sleepPrepared = true;
+    deadline.detach();
+    //counted however the wake ended once the deadline had passed
+    if (deadlinePassed){
+        if (rtcMemAWS.budgetHits[deadlineBudget] < UINT8_MAX)
+            rtcMemAWS.budgetHits[deadlineBudget]++;
+        trace(TRACE_BUDGET, deadlineBudget);
+    }
+
+    uint32_t wakeClock = rtcMemSamples.clock;
+    sleepTime = scheduleSleep();
+    writeRTCMemSamples();
+    writeRTCMemWindow();
+    //phases cut short by the deadline count up to now
+    for (int i = 0; i < PHASE_COUNT; i++)
+        if (phaseOpen & (1 << i))
+            phaseEnd(i);
+    phaseSet(PHASE_AWAKE, millis());
+    for (int i = 0; i < PHASE_COUNT; i++)
+        if (phaseUsed & (1 << i))
+            phaseProfileAdd(&rtcMemProfile, i, phaseTime[i]);
+    writeRTCMemProfile();
+    writeRTCMemQueue();
+    //while uploads are held off the radio stays off, readings pile up as usual
+    rtcMemAWS.wakeMode = backoffHold(&rtcMemBackoff) ? WAKE_MODE_SAMPLE : scheduleNextWake();
+    writeRTCMemBackoff();
+    writeRTCMemAWS();
+    printRTCMemAWS();
+    //last, a flash write cut short loses only the trace
+    trace(TRACE_SLEEP, sleepTime / 1000, rtcMemAWS.wakeMode);
+    traceWrite(&traceBuffer, &traceFlash, wakeClock, ESP.getResetInfoPtr()->reason);
+}
+
+void goToSleep() {
+    prepareSleep();
+    Serial.println(("Going to deep sleep..."));
+
+    // Connect GPIO16 to RST to allow ESP to wake up from deepSleep
+    // RF calibration and WiFi are skipped entirely on sample-only wakes
+    ESP.deepSleep(sleepTime, rtcMemAWS.wakeMode == WAKE_MODE_UPLOAD ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED); 
+}
+
+// deadline timer callback. Runs in system context, where nothing may yield or write 
+// flash - it only flags the wake, deadlineCheck() ends it
+void deadlineExpired() {
+    deadlinePassed = true;
+}
+
+// called by the loops that wait for the network. Once the deadline has passed the wake
+// ends here - readings and queue cursors in RAM are consistent at these points. A batch 
+// whose publish was cut short stays pending and is sent again with the next upload
+// A blocking call (TLS handshake, PubSubClient read) runs to its own timeout first
+void deadlineCheck() {
+    if (!deadlinePassed)
+        return;
+    DEBUG_LOG_T("\n\rWake budget '%s' exceeded!\n\r", budgetNames[deadlineBudget]);
+    //the conversion is done by now, see BUDGET_UNIT_MS
+    if (!readingTaken)
+        takeReading();
+    uploadDone(false);
+    goToSleep();
+}
+
+bool readConfigCache() {
+    DEBUG_LOG_T("Reading config cache...\n\r");
+
+    if (!ESP.flashRead(CONFIG_FLASH_SECTOR * SPI_FLASH_SEC_SIZE, (uint32_t*)&configCache, sizeof(configCache)))
+        return false;
+    if (configCache.version != CONFIG_CACHE_VERSION || configCache.crc != rtcMemCrc(&configCache, sizeof(configCache))){
+        DEBUG_LOG_T("Config cache not valid.\n\r");
+        return false;
+    }
+    return true;
+}
+
+boolean configCopy(char* dst, const char* src, size_t size) {
+    if (!src || strlen(src) >= size)
+        return false;
+    strcpy(dst, src);
+    return true;
+}
+
+// fields set through the shadow take the place of the IAS values
+void applyConfigOverrides() {
+    for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++)
+        if (configCache.overridden & (1UL << i))
+            *configFields[i].value = configSlot(&configCache.overrides, &configFields[i]);
+}
+
+// store the resolved configuration for the next warm wakes
+// the sector is only rewritten if the record has changed
+void writeConfigCache() {
+    //the fields may point into configCache
+    configCacheDef record;
+    memset(&record, 0, sizeof(record));
+    boolean fits = configCopy(record.shadow, AWS_shadow, sizeof(record.shadow));
+    for (size_t i = 0; i < CONFIG_FIELD_COUNT && fits; i++){
+        const configFieldDef* field = &configFields[i];
+        fits = configCopy(configSlot(&record.values, field), *field->value, field->size + 1);
+    }
+    //a record that does not validate sends every wake to IAS
+    record.overridden = configCache.overridden;
+    memcpy(&record.overrides, &configCache.overrides, sizeof(record.overrides));
+    if (fits){
+        record.version = CONFIG_CACHE_VERSION;
+        record.crc = rtcMemCrc(&record, sizeof(record));
+    }
+    else
+        memset(&record, 0, sizeof(record));
+
+    configCacheDef stored;
+    uint32_t offset = CONFIG_FLASH_SECTOR * SPI_FLASH_SEC_SIZE;
+    if (ESP.flashRead(offset, (uint32_t*)&stored, sizeof(stored)) && memcmp(&stored, &record, sizeof(stored)) == 0)
+        return;
+    DEBUG_LOG_T("Writing config cache...\n\r");
+    if (!ESP.flashEraseSector(CONFIG_FLASH_SECTOR) || !ESP.flashWrite(offset, (uint32_t*)&record, sizeof(record))) {
+        DEBUG_LOG_T("Config cache write failed!\n\r");
+    }
+}
+
+// credential record from flash in a buffer allocated with new[]
+// returns NULL if there is no valid record
+uint8_t* readCredentials() {
+    DEBUG_LOG_T("Reading credentials from flash...\n\r");
+
+    uint32_t offset = CREDENTIALS_FLASH_SECTOR * SPI_FLASH_SEC_SIZE;
+    credentialHeaderDef header;
+    if (!ESP.flashRead(offset, (uint32_t*)&header, sizeof(header)) || header.version != CREDENTIALS_VERSION 
+            || header.certLength == 0 || header.keyLength == 0
+            || header.certLength + header.keyLength > CREDENTIALS_MAX_LENGTH){
+        DEBUG_LOG_T("No credentials in flash.\n\r");
+        return NULL;
+    }
+
+    size_t length = sizeof(header) + header.certLength + header.keyLength;
+    uint8_t* record = new uint8_t[(length + 3) & ~3];
+    if (!ESP.flashRead(offset, (uint32_t*)record, (length + 3) & ~3) || header.crc != rtcMemCrc(record, length)){
+        DEBUG_LOG_T("Credentials in flash not valid.\n\r");
+        delete[] record;
+        return NULL;
+    }
+    return record;
+}
+
+// copy cert and private key from SPIFFS (already mounted) to the flash record
+// the sector is only rewritten if the content has changed
+boolean storeCredentials() {
+    File cert = SPIFFS.open(CERTIFICATE_FILE, "r");
+    File key = SPIFFS.open(PRIVATE_KEY_FILE, "r");
+    if (!cert || !key || cert.size() == 0 || key.size() == 0 || cert.size() + key.size() > CREDENTIALS_MAX_LENGTH){
+        DEBUG_LOG_T("Failed to open cert or private key file!\n\r");
+        return false;
+    }
+
+    size_t length = sizeof(credentialHeaderDef) + cert.size() + key.size();
+    uint8_t* record = new uint8_t[(length + 3) & ~3];
+    memset(record, 0xFF, (length + 3) & ~3);
+    credentialHeaderDef* header = (credentialHeaderDef*)record;
+    header->version = CREDENTIALS_VERSION;
+    header->certLength = cert.size();
+    header->keyLength = key.size();
+    header->spare = 0;
+    boolean ok = cert.read(record + sizeof(credentialHeaderDef), header->certLength) == header->certLength
+        && key.read(record + sizeof(credentialHeaderDef) + header->certLength, header->keyLength) == header->keyLength;
+    header->crc = rtcMemCrc(record, length);
+
+    uint32_t offset = CREDENTIALS_FLASH_SECTOR * SPI_FLASH_SEC_SIZE;
+    credentialHeaderDef stored;
+    if (ok && !(ESP.flashRead(offset, (uint32_t*)&stored, sizeof(stored)) && memcmp(&stored, header, sizeof(stored)) == 0)){
+        DEBUG_LOG_T("Writing credentials to flash...\n\r");
+        ok = ESP.flashEraseSector(CREDENTIALS_FLASH_SECTOR) && ESP.flashWrite(offset, (uint32_t*)record, (length + 3) & ~3);
+    }
+    delete[] record;
+    return ok;
+}
+
+//what a content message carries, see MqttSession::carries()
+#define CARRIES_QUEUE                   1       //offline queue positions, extra - drops reported
+#define CARRIES_RING                    2       //readings from RTC memory, extra - drops reported
+#define CARRIES_WINDOW                  3       //aggregation window
+
+//readings in content messages that are not acknowledged yet. They stay in RTC memory and
+//the offline queue until the PUBACK comes, the messages after them start behind them
+uint32_t queueInFlight;
+uint8_t ringInFlight;
+boolean windowInFlight;
+
+// messages are acknowledged in order: readings go from the oldest
+void delivered(const mqttInFlightDef* message) {
+    switch (message->kind){
+        case CARRIES_QUEUE:
+            flashQueueConsume(&rtcMemQueue, &queueFlash, message->count);
+            queueInFlight -= min(queueInFlight, (uint32_t)message->count);
+            rtcMemQueue.dropped -= min(rtcMemQueue.dropped, message->extra);
+            break;
+        case CARRIES_RING:
+            sampleRingDrop(&rtcMemSamples, message->count);
+            ringInFlight -= min(ringInFlight, (uint8_t)message->count);
+            rtcMemSamples.dropped -= min((uint32_t)rtcMemSamples.dropped, message->extra);
+            break;
+        case CARRIES_WINDOW:
+            windowReset(&rtcMemWindow);
+            windowInFlight = false;
+            break;
+    }
+}
+
+// no PUBACK for the messages in flight: their readings go out again with the next upload
+void undelivered() {
+    queueInFlight = 0;
+    ringInFlight = 0;
+    windowInFlight = false;
+}
+
+// offline queue, pending readings and the aggregation window over the open session
+// with QoS1 the messages go out back to back and the PUBACKs are collected at the end
+void uploadReadings() {
+    //offline queue first, oldest readings in big batches. A long backlog is spread over 
+    //several wakes, later readings stay queued behind it
+    //the buffer is static, a packed batch is too big for the stack
+    static sampleDef samples[PACKED_REPLAY_BATCH];
+    int replayBatch = packedFormat ? PACKED_REPLAY_BATCH : QUEUE_REPLAY_BATCH;
+    for (int messages = 0; rtcMemQueue.count > queueInFlight && messages < QUEUE_REPLAY_MESSAGES && session.connected(); messages++){
+        uint16_t span;
+        int n = flashQueuePeek(&rtcMemQueue, &queueFlash, queueInFlight, samples, replayBatch, &span);
+        //a message takes the readings of one sensor table, the batch ends where it changes
+        int run = sensorTableRun(samples, n);
+        if (run < n)
+            n = flashQueuePeek(&rtcMemQueue, &queueFlash, queueInFlight, samples, run, &span);
+        //drops are reported once, by the first message in flight
+        uint32_t dropped = queueInFlight ? 0 : rtcMemQueue.dropped;
+        if (n > 0 && sensorTableCurrent(&samples[0])){
+            sensorIndexes(samples, n);
+            int sent = publishReadings(samples, n, dropped);
+            if (!sent)
+                break;
+            trace(TRACE_REPLAY, sent, rtcMemQueue.count - queueInFlight - sent);
+            //only part of the batch fit in the message, consume what was sent
+            if (sent < n)
+                flashQueuePeek(&rtcMemQueue, &queueFlash, queueInFlight, samples, sent, &span);
+            queueInFlight += span;
+            session.carries(CARRIES_QUEUE, span, dropped);
+        }
+        //readings of an older sensor table cannot be told apart any more, they are dropped. 
+        //So is a batch that failed the check entirely, once nothing is in front of it
+        else if (!queueInFlight){
+            DEBUG_LOG_T("%d queued readings passed over\n\r", n);
+            flashQueueConsume(&rtcMemQueue, &queueFlash, span);
+            rtcMemQueue.dropped += n;
+        }
+        else
+            break;
+    }
+
+    //then all pending readings from RTC memory, one batch per message
+    while (rtcMemQueue.count == queueInFlight && rtcMemSamples.count > ringInFlight){
+        int n = min((int)rtcMemSamples.count - ringInFlight, batchSize);
+        for (int i = 0; i < n; i++)
+            samples[i] = *sampleRingAt(&rtcMemSamples, ringInFlight + i);
+        n = sensorTableRun(samples, n);
+        if (!sensorTableCurrent(&samples[0])){
+            if (ringInFlight)
+                break;
+            DEBUG_LOG_T("%d readings of another sensor table dropped\n\r", n);
+            sampleRingDrop(&rtcMemSamples, n);
+            rtcMemSamples.dropped += n;
+            continue;
+        }
+        sensorIndexes(samples, n);
+        uint32_t dropped = ringInFlight ? 0 : rtcMemSamples.dropped;
+        n = publishReadings(samples, n, dropped);
+        if (!n)
+            break;
+        //keep unsent readings for the next upload
+        ringInFlight += n;
+        session.carries(CARRIES_RING, n, dropped);
+    }
+
+    //aggregation window when it is full (or aggregation was turned off), newest data
+    //a window that is not sent grows until the next upload
+    if (!windowInFlight && windowSamples(&rtcMemWindow) >= windowLength && session.connected() && publishWindow()){
+        windowInFlight = true;
+        session.carries(CARRIES_WINDOW, 0, 0);
+    }
+
+    session.flush();
+    writeRTCMemQueue();
+    if (rtcMemSamples.count == 0 && rtcMemQueue.count == 0)
+        rtcMemAWS.flushCycles = flushInterval - 1;
+}
+
+// settings from the IAS field values
+void applyConfig() {
+    batchSize = constrain(atoi(batch_size), 1, SAMPLE_RING_CAPACITY);
+    flushInterval = max(atoi(flush_interval), 1);
+    sampleInterval = atoi(sample_interval);
+    if (sampleInterval <= 0)
+        sampleInterval = REPORT_INTERVAL;
+    //the longest sleep, one and a half periods stretched by the largest skew, must fit the RTC timer
+    uint64_t sleepMax = ESP.deepSleepMax() * 2 / 3 * (65536 - SKEW_MAX) / 65536;
+    sampleInterval = min(sampleInterval, (int)(sleepMax / 60000000ULL));
+    deltaThreshold = max((int)round(atof(delta_threshold) * 100), 0);
+    heartbeatInterval = max(atoi(heartbeat), 1);
+    parseWakeBudget(wake_budget);
+    windowLength = constrain(atoi(window_length), 1, 999);
+    packedFormat = strcmp(payload_format, "packed") == 0;
+    traceShadow = constrain(atoi(trace_shadow), 0, TRACE_SHADOW_MAX);
+    //publishes no more often than readings are taken
+    const char* s = strchr(stream_config, ',');
+    streamPeriod = atoi(stream_config) > 0 ? max(atoi(stream_config), STREAM_PERIOD_MIN) : 0;
+    streamPublish = max(s ? 1000UL * max(atoi(s + 1), 0) : 0, streamPeriod);
+    if (streamPeriod)
+        sampleInterval = min(sampleInterval, STREAM_WAKE_MAX_MINUTES);
+    qosWindowSize = constrain(atoi(qos_window), 0, MQTT_WINDOW_MAX);
+}
+
+// IAS fields set through the shadow are in effect from here, and on the next wakes
+void deltaApply() {
+    if (configChanged || updateRequested)
+        trace(TRACE_DELTA, configChanged, updateRequested);
+    if (configChanged){
+        writeConfigCache();
+        applyConfig();
+        configChanged = false;
+    }
+}
+
+// after the MQTT session is closed - both TLS stacks would not fit in heap
+void checkForUpdate() {
+    session.end();
+    deadlineCheck();
+    DEBUG_LOG_T("Time to check for new FW.\n\r");
+    trace(TRACE_FW_CHECK);
+    //a FW download must not be cut short
+    deadline.detach();
+    IAS.callHome();
+    updateRequested = false;
+}
+
+// streaming wake: no budget, WiFi light sleep between readings, the session stays open
+// until the next slot is due. false - no session
+boolean streamBegin() {
+    deadlineCheck();
+    if (!session.begin())
+        return false;
+    DEBUG_LOG_T("Streaming, reading every %lu ms, publish every %lu ms\n\r", streamPeriod, streamPublish);
+    streaming = true;
+    deadlineEnabled = false;
+    deadline.detach();
+    WiFi.setSleepMode(WIFI_LIGHT_SLEEP, STREAM_LISTEN_INTERVAL);
+    memset(&stream, 0, sizeof(stream));
+    stream.start = millis();
+    stream.nextSample = stream.start;
+    stream.nextPublish = stream.start + streamPublish;
+    uint64_t left = slotLeft(clockNow());
+    stream.end = stream.start + (left > STREAM_CLOSE_MS ? left - STREAM_CLOSE_MS : 0);
+    return true;
+}
+
+// publish what is pending. A lost session is opened again, false if that fails
+boolean streamUpload() {
+    stream.nextPublish = millis() + streamPublish;
+    if (!session.begin())
+        return false;
+    boolean pending = rtcMemSamples.count > 0;
+    uploadReadings();
+    if (pending && rtcMemSamples.count == 0){
+        unsigned long latency = millis() - stream.oldest;
+        if (stream.publishes == 0 || latency < stream.latencyMin)
+            stream.latencyMin = latency;
+        stream.latencyMax = max(stream.latencyMax, latency);
+        stream.latencySum += latency;
+        stream.publishes++;
+    }
+    return true;
+}
+
+// what the streaming wake has achieved: mean ms between readings, publishes and the age 
+// of the oldest reading in them [min, mean, max] ms
+void buildStreamMsg(JsonWriter& json) {
+    json.beginObject();
+    json.beginObject("state");
+    json.beginObject("reported");
+    json.beginObject("stream");
+    json.add("reading_ms", stream.readings ? (millis() - stream.start) / stream.readings : 0UL);
+    json.add("readings", stream.readings);
+    json.add("publishes", stream.publishes);
+    if (stream.publishes){
+        json.beginArray("latency");
+        json.item(stream.latencyMin);
+        json.item(stream.latencySum / stream.publishes);
+        json.item(stream.latencyMax);
+        json.endArray();
+    }
+    json.endObject();
+    json.endObject();
+    json.endObject();
+    json.endObject();
+}
+
+// the rest of the readings and the stream report, then deep sleep up to the slot
+void streamEnd() {
+    if (session.connected()){
+        uploadReadings();
+        JsonWriter json(msgBuffer, sizeof(msgBuffer));
+        buildStreamMsg(json);
+        session.publish(AWS_shadow, json);
+    }
+    unsigned long seconds = (millis() - stream.start) / 1000;
+    DEBUG_LOG_T("Streamed %lu s, %u readings, %u publishes\n\r", seconds, stream.readings, stream.publishes);
+    trace(TRACE_STREAM, seconds, stream.readings, stream.publishes);
+    session.end();
+    goToSleep();
+}
+
+// one pass of a streaming wake. Readings every streamPeriod with the conversion running in
+// the background, publishes every streamPublish or when a batch (window) is full. In 
+// between the CPU idles in delay() and WiFi drops to light sleep
+void streamLoop() {
+    mqtt.loop();
+    //a delta comes whenever the desired state is changed, not only after shadow updates
+    if (configChanged || updateRequested){
+        boolean check = updateRequested;
+        deltaApply();
+        if (check)
+            checkForUpdate();
+    }
+
+    unsigned long now = millis();
+    unsigned long conversionTime = DS18B20[0].millisToWaitForConversion(SENSOR_RESOLUTION);
+    if (stream.converting && (conversionComplete() || now - conversionStart >= conversionTime)){
+        stream.converting = false;
+        boolean pending = rtcMemSamples.count > 0;
+        if (takeReading())
+            stream.readings++;
+        if (!pending && rtcMemSamples.count > 0)
+            stream.oldest = now;
+    }
+    if (!stream.converting && (long)(now - stream.nextSample) >= 0){
+        for (uint8_t b = 0; b < SENSOR_BUSES; b++)
+            DS18B20[b].requestTemperatures();
+        conversionStart = now;
+        stream.converting = true;
+        //fallen behind (reconnect) - go on from now, no catching up
+        stream.nextSample += streamPeriod;
+        if ((long)(now - stream.nextSample) >= 0)
+            stream.nextSample = now + streamPeriod;
+    }
+
+    boolean full = rtcMemSamples.count >= batchSize || (windowLength > 1 && windowSamples(&rtcMemWindow) >= windowLength);
+    if (((long)(now - stream.nextPublish) >= 0 || full) && !streamUpload()){
+        DEBUG_LOG_T("Session lost, streaming ends.\n\r");
+        streamEnd();
+        return;
+    }
+    //streaming turned off through the shadow, or the slot is due
+    if (!streamPeriod || (long)(millis() - stream.end) >= 0){
+        streamEnd();
+        return;
+    }
+
+    //until the next conversion request or result, publish or the end. The MQTT keepalive
+    //needs a loop() at least every MQTT_KEEPALIVE
+    now = millis();
+    unsigned long next = stream.converting ? conversionStart + conversionTime : stream.nextSample;
+    unsigned long wait = MQTT_KEEPALIVE * 1000UL / 2;
+    wait = min(wait, (long)(next - now) > 0 ? next - now : 0UL);
+    wait = min(wait, (long)(stream.nextPublish - now) > 0 ? stream.nextPublish - now : 0UL);
+    wait = min(wait, (long)(stream.end - now) > 0 ? stream.end - now : 0UL);
+    delay(wait);
 }
 
 void fileDump(File* f){
@@ -209,6 +2403,7 @@ void fileDump(File* f){
 }
 
 void setup() {
+    phaseSet(PHASE_BOOT, millis());
     Serial.begin(115200);
 #ifdef DBG_PROG
 //    delay (10);
@@ -216,26 +2411,60 @@ void setup() {
     IAS.serialdebug(true,115200);      
 #endif
 
-
-
-    WiFi.begin();
-
     rst_info *resetInfo; 
     resetInfo = ESP.getResetInfoPtr();
 
-    AWS_endpoint = new char[strlen_P((AWS_ENDPOINT)) + 1]; //+1 to accomodate for the termination char
-    strcpy_P(AWS_endpoint, (AWS_ENDPOINT));
+    startConversion(resetInfo->reason != REASON_DEEP_SLEEP_AWAKE);
 
-    AWS_content_topic = new char[strlen_P((AWS_CONTENT_TOPIC)) + 1];
-    strcpy_P(AWS_content_topic, (AWS_CONTENT_TOPIC));
-
-    AWS_thing_name = new char[strlen_P((AWS_DEFAULT_NAME)) + 4 + 1]; 
-    sprintf_P(AWS_thing_name, (AWS_DEFAULT_NAME), ESP.getChipId());  
+    //radio is available only if this wake was scheduled for upload
+    readRTCMemAWS();
+    readRTCMemProfile();
+    //a reset starts with a clean slate - the user wants to see it connect
+    if (!readRTCMemBackoff() || resetInfo->reason != REASON_DEEP_SLEEP_AWAKE)
+        backoffReset(&rtcMemBackoff);
+    boolean radioOn = resetInfo->reason != REASON_DEEP_SLEEP_AWAKE || rtcMemAWS.wakeMode != WAKE_MODE_SAMPLE;
+    //on cold boot IAS handles the connection itself
+    if (radioOn)
+        wifiBegin(resetInfo->reason == REASON_DEEP_SLEEP_AWAKE);
+
+    //a full shadow update (cold boot, every SHADOW_REFRESH_UPDATES) is followed by a FW update 
+    //check, unless the shadow delta asks for one earlier
+    if (radioOn)
+        readShadowState();
+    boolean fullUpdate = radioOn && rtcMemAWS.sleepCycles == 0 && (!shadowKnown || resetInfo->reason != REASON_DEEP_SLEEP_AWAKE 
+        || shadowState.updates + 1 >= SHADOW_REFRESH_UPDATES);
+
+    //warm wakes take the resolved configuration from flash. IAS fields are processed
+    //on cold boot, on full shadow update wakes and whenever the cached copy is not valid
+    phaseBegin(PHASE_CONFIG);
+    boolean configRead = resetInfo->reason == REASON_DEEP_SLEEP_AWAKE && readConfigCache();
+    boolean configCached = configRead && !fullUpdate;
+    trace(TRACE_BOOT, rtcMemAWS.wakeMode, radioOn, configCached);
+    if (configCached) {
+        AWS_shadow = configCache.shadow;
+        for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++)
+            *configFields[i].value = configSlot(&configCache.values, &configFields[i]);
+    }
+    else {
+        //shadow overrides are kept for applyConfigOverrides()
+        if (!configRead){
+            configCache.overridden = 0;
+            memset(&configCache.overrides, 0, sizeof(configCache.overrides));
+        }
+        //defaults go to the cache's slots, processField() may point the fields elsewhere
+        for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++){
+            const configFieldDef* field = &configFields[i];
+            *field->value = configSlot(&configCache.values, field);
+            strcpy_P(*field->value, *field->def);
+        }
+        sprintf_P(AWS_thing_name, (AWS_DEFAULT_NAME), ESP.getChipId());
 
-    IAS.preSetConfig(AWS_thing_name, false);
-    IAS.addField(AWS_thing_name, "device_name", "Device Name", 25);
-    IAS.addField(AWS_endpoint, "aws_endpoint", "AWS Endpoint", 96);
-    IAS.addField(AWS_content_topic, "topic", "Topic", 96);
+        IAS.preSetConfig(AWS_thing_name, false);
+        for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++){
+            const configFieldDef* field = &configFields[i];
+            IAS.addField(*field->value, field->name, field->label, field->size);
+        }
+    }
 
 
     //set up LED blinker 
@@ -247,14 +2476,23 @@ void setup() {
 
     if (resetInfo->reason == REASON_DEEP_SLEEP_AWAKE){
         Serial.println(("Woke up from deep sleep!"));
-        IAS.processField();       
+        if (!configCached)
+            IAS.processField();       
+        phaseEnd(PHASE_CONFIG);
     }
     else {
         DEBUG_LOG_T("Booting...!\n\r");
+        //what happened before the reset, for sim/trace
+        traceDump();
         DEBUG_LOG_T("Flash real size: %u\n\r", ESP.getFlashChipRealSize());
         DEBUG_LOG_T("Flash IDE size:  %u\n\r", ESP.getFlashChipSize());
 
         rtcMemAWS.sleepCycles = 0;
+        rtcMemAWS.flushCycles = 0;
+        rtcMemAWS.wakeMode = WAKE_MODE_UPLOAD;
+        rtcMemAWS.heartbeatCycles = 0;
+        //device clock has stopped during the reset, the skew still holds
+        rtcMemAWS.wallOffset = 0;
         writeRTCMemAWS();
         DEBUG_LOG_T("AWS RTC Mem initialized!\n\r");
       
@@ -293,120 +2531,169 @@ void setup() {
         }
     }
     
-    readRTCMemAWS();
+    if (!configCached) {
+        AWS_shadow = new char[strlen_P((AWS_SHADOW)) + strlen(AWS_thing_name) - 2 + 1];
+        sprintf_P(AWS_shadow, (AWS_SHADOW), AWS_thing_name);
+        applyConfigOverrides();
+        writeConfigCache();
+    }
 
-    AWS_shadow = new char[strlen_P((AWS_SHADOW)) + strlen(AWS_thing_name) - 2 + 1];
-    sprintf_P(AWS_shadow, (AWS_SHADOW), AWS_thing_name);
+    applyConfig();
+
+    //from here on the whole wake runs against the total budget
+    deadlineEnabled = resetInfo->reason == REASON_DEEP_SLEEP_AWAKE;
+    deadlineArm(BUDGET_TOTAL, 0);
+
+    readRTCMemSamples();
+    readRTCMemWindow();
+    if (!readRTCMemQueue(resetInfo->reason != REASON_DEEP_SLEEP_AWAKE)){
+        //device clock restarts after power loss, keep it ahead of the queued readings
+        uint32_t newest = flashQueueNewest(&rtcMemQueue, &queueFlash);
+        if (newest >= rtcMemSamples.clock){
+            rtcMemSamples.clock = newest + 1;
+            rtcMemAWS.wallOffset = 0;
+        }
+    }
+
+    DEBUG_LOG_T("Readings pending: %u, queued: %u (batch size %d)\n\r", rtcMemSamples.count, rtcMemQueue.count, batchSize);
+
+    //upload when the countdown expires, this reading fills the batch or the window or shadow service 
+    //needs update. If the radio was not scheduled for this wake, upload is postponed to the next one
+    if (!radioOn || !uploadDue()){
+        DEBUG_LOG_T("Sample-only wake.\n\r");
+        takeReading();
+        //flush countdown only runs while there is something to upload
+        if (rtcMemAWS.flushCycles > 0 && rtcMemSamples.count > 0)
+            rtcMemAWS.flushCycles--;
+        if (rtcMemAWS.sleepCycles > 0)
+            rtcMemAWS.sleepCycles--;
+        goToSleep();
+        return;
+    }
 
     // verify all parameters are ok
     DEBUG_LOG_T("Parameters are:\n\r%s\n\r%s\n\r%s\n\r%s\n\r", AWS_thing_name, AWS_endpoint, AWS_shadow, AWS_content_topic);
 
     mqtt.setServer(AWS_endpoint, 8883);
-
-    DEBUG_LOG_T("Loading credentials for AWS IoT core from SPIFFS...\n\r");
-
-    if (!SPIFFS.begin()) {
-        DEBUG_LOG_T("Failed to mount file system!\n\r");
-    }
-    else {
-        DEBUG_LOG_T("SPIFFS content...\n\r");
-        Dir dir = SPIFFS.openDir("");
-        while (dir.next()) {
-            DEBUG_LOG_T("%s %u\n\r", dir.fileName().c_str(), dir.fileSize());
-        }        
-        DEBUG_LOG_T("Free heap: %u\n\r", ESP.getFreeHeap());
-
-        // Load certificate file
-        File cert = SPIFFS.open(CERTIFICATE_FILE, "r"); 
-        if (!cert){ 
-            DEBUG_LOG_T("Failed to open cert file.\n\r");
+    mqtt.setCallback(callback);
+
+    //same as axTLS before: server certificate is not verified
+    espClient.setInsecure();
+    readRTCMemTLS();
+    espClient.setSession(&rtcMemTLS.session);
+
+    //SPIFFS is only mounted on cold boot or if the flash copy of the credentials is not valid
+    uint8_t* credentials = resetInfo->reason == REASON_DEEP_SLEEP_AWAKE ? readCredentials() : NULL;
+    if (!credentials){
+        DEBUG_LOG_T("Copying credentials for AWS IoT core from SPIFFS...\n\r");
+        phaseBegin(PHASE_SPIFFS);
+        boolean mounted = SPIFFS.begin();
+        phaseEnd(PHASE_SPIFFS);
+        if (!mounted) {
+            DEBUG_LOG_T("Failed to mount file system!\n\r");
+        }
+        else {
+            DEBUG_LOG_T("SPIFFS content...\n\r");
+            Dir dir = SPIFFS.openDir("");
+            while (dir.next()) {
+                DEBUG_LOG_T("%s %u\n\r", dir.fileName().c_str(), dir.fileSize());
+            }        
+            storeCredentials();
+            SPIFFS.end();
         }
+        credentials = readCredentials();
+    }
 
-        if (cert && espClient.loadCertificate(cert)){ 
-            DEBUG_LOG_T("cert loaded!\n\r");
+    phaseBegin(PHASE_CERT);
+    if (credentials){
+        //TLS client decodes into its own structures, the record is not needed afterwards
+        const credentialHeaderDef* header = (const credentialHeaderDef*)credentials;
+        const uint8_t* cert = credentials + sizeof(credentialHeaderDef);
+        if (espClient.setCertificate(cert, header->certLength) 
+                && espClient.setPrivateKey(cert + header->certLength, header->keyLength)){
+            DEBUG_LOG_T("cert and private key loaded!\n\r");
         }
         else{
-            DEBUG_LOG_T("Failed to load cert from SPIFFS. Trying to load from flash...");
-            if (espClient.setCertificate_P(cert_der, cert_der_len)){
-                DEBUG_LOG_T("cert loaded\n\r");
-            }
-            else{
-                DEBUG_LOG_T("cert not loaded\n\r");
-            }
+            DEBUG_LOG_T("cert or private key not loaded!\n\r");
         }
-
-        // Load private key file
-        File private_key = SPIFFS.open(PRIVATE_KEY_FILE, "r"); 
-        if (!private_key){ 
-            DEBUG_LOG_T("Failed to open private key file!\n\r");
-        }
-
-        if (private_key && espClient.loadPrivateKey(private_key)){
-            DEBUG_LOG_T("private key loaded!\n\r"); 
+        delete[] credentials;
+    }
+    else{
+        DEBUG_LOG_T("No credentials in SPIFFS. Loading from firmware...");
+        if (espClient.setCertificate_P(cert_der, cert_der_len) && espClient.setPrivateKey_P(private_der, private_der_len)){
+            DEBUG_LOG_T("cert and private key loaded.\n\r");
         }
         else{
-            DEBUG_LOG_T("Failed to load private key from SPIFFS. Trying to load from flash...");
-            if (espClient.setPrivateKey_P(private_der, private_der_len)){
-                DEBUG_LOG_T("private key loaded.\n\r");
-            }
-            else{
-                DEBUG_LOG_T("private key not loaded.\n\r");
-           }
-        }           
-
-        SPIFFS.end();
-        DEBUG_LOG_T("Free heap: %u\n\r", ESP.getFreeHeap());
+            DEBUG_LOG_T("cert or private key not loaded.\n\r");
+        }
     }
+    phaseEnd(PHASE_CERT);
+    DEBUG_LOG_T("Free heap: %u\n\r", ESP.getFreeHeap());
+    trace(TRACE_HEAP, ESP.getFreeHeap());
     
-    float temp;
-    DS18B20.getAddress(DS18B20Address, 0);
-    DS18B20.setResolution(DS18B20Address,9);
-    DS18B20.requestTemperatures(); 
-    temp = DS18B20.getTempCByIndex(0); 
-    DEBUG_LOG_T("Temperature: %f\n\r", temp);
-    
-    String s;
-    StaticJsonBuffer<250> jsonBuffer; 
-    JsonObject& root = jsonBuffer.createObject();
-    root["sensor"] = AWS_thing_name;
-    root["temperature"] = temp;
-    root.printTo(s);
-    mqttConnectAndSend(AWS_content_topic, s.c_str());
+    uploading = true;
+    session.begin();
+    //conversion has completed during connect - reading is (almost) free now
+    takeReading();
+
+    uploadReadings();
 
     // update AWS shadow service if needed
+    boolean shadowDue = rtcMemAWS.sleepCycles == 0;
     if (rtcMemAWS.sleepCycles == 0){
-        DEBUG_LOG_T("Time to check for new FW and to update AWS shadow service.\n\r");
-        IAS.callHome();
-        String s;
-        StaticJsonBuffer<400> jsonBuffer; 
-        JsonObject& root = jsonBuffer.createObject();
-        JsonObject& state = root.createNestedObject("state");
-        JsonObject& state_reported = state.createNestedObject("reported");
-        state_reported["sensor"] = AWS_thing_name;
-        state_reported["topic"] = AWS_content_topic;
-        state_reported["battery"] = ESP.getVcc();
-        state_reported["rxlev"] = WiFi.RSSI();
-        state_reported["AppName"] = APPNAME;
-        state_reported["Version"] = VERSION;
-        state_reported["CompileDate"] = COMPDATE;
-        root.printTo(s);
-        if (mqttConnectAndSend(AWS_shadow, s.c_str()))
+        DEBUG_LOG_T("Time to update AWS shadow service.\n\r");
+        //the shadow may have been changed while the device was off
+        shadowFull = fullUpdate;
+        //answered right after the update if desired and reported state differ
+        char deltaTopic[sizeof(configCache.shadow) + 6];
+        snprintf(deltaTopic, sizeof(deltaTopic), "%s/delta", AWS_shadow);
+        if (session.connected())
+            mqtt.subscribe(deltaTopic);
+        JsonWriter json(msgBuffer, sizeof(msgBuffer));
+        buildShadowMsg(json);
+        if (session.publish(AWS_shadow, json)){
+            trace(TRACE_SHADOW_SENT, shadowFull);
             //restart shadow update cycle only if succesfully updated
-            rtcMemAWS.sleepCycles = AWS_SHADOW_UPDATE_INTERVALS-1;
+            rtcMemAWS.sleepCycles = max(AWS_SHADOW_UPDATE_INTERVALS(sampleInterval), 1) - 1;
+            phaseProfileReset(&rtcMemProfile);
+            memset(rtcMemAWS.budgetHits, 0, sizeof(rtcMemAWS.budgetHits));
+            shadowNext.updates = shadowFull ? 0 : shadowState.updates + 1;
+            writeShadowState();
+            clockSync();
+        }
     }
-    else
+    else {
         rtcMemAWS.sleepCycles--;
-
-    writeRTCMemAWS();
-    printRTCMemAWS();
-    
-    Serial.println(("Going to deep sleep..."));
-
-    // Connect GPIO16 to RST to allow ESP to wake up from deepSleep
-    ESP.deepSleep(1e6L * 60 * REPORT_INTERVAL); 
-    
+        //battery and RSSI go to the shadow as soon as they move, not once a day
+        shadowFull = false;
+        JsonWriter json(msgBuffer, sizeof(msgBuffer));
+        if (shadowKnown && session.connected() && buildVitalsMsg(json) && session.publish(AWS_shadow, json))
+            writeShadowState();
+    }
+    //after power on the skew is measured as soon as possible, not a day later
+    if (!shadowDue && rtcMemAWS.sleepSkew == SKEW_UNKNOWN && rtcMemAWS.wallOffset 
+            && (uint16_t)(rtcMemSamples.clock / 60 - rtcMemAWS.syncMinute) >= SKEW_MIN_MINUTES)
+        clockSync();
+
+    //connection held up to the end - a message the broker did not take is not a link problem
+    boolean linkUp = session.connected();
+    uploadDone(linkUp);
+    //end() takes what the broker has sent, a late delta included. A streaming wake keeps
+    //the session, its loop() takes them
+    if (!streamPeriod)
+        session.end();
+    deltaApply();
+    if (shadowDue && (fullUpdate || updateRequested))
+        checkForUpdate();
+
+    if (streamPeriod && linkUp && streamBegin())
+        return;
+    session.end();
+    goToSleep();
 }
 
 void loop() {
-    // put your main code here, to run repeatedly:
+    //only a streaming wake gets here, all others end in deep sleep in setup()
+    if (streaming)
+        streamLoop();
 }
\ No newline at end of file
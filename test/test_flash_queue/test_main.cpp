@@ -0,0 +1,244 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <FlashQueue.h>
+extern "C" {
+    #include <spi_flash.h>
+}
+
+// host tests of the offline queue on the NativeSim NOR flash model
+//   pio test -e native -f test_flash_queue
+
+#define QUEUE_BEGIN     0x3EC000
+#define QUEUE_SEGMENTS  3
+
+static flashQueueDef queue;
+static sampleDef samples[3 * FLASH_QUEUE_ENTRIES];
+static size_t tornBytes;        // power lost after that many bytes of the next write, 0 - off
+
+static bool flashRead(uint32_t offset, void* data, size_t size) {
+    return ESP.flashRead(offset, (uint32_t*)data, size);
+}
+
+static bool flashWrite(uint32_t offset, const void* data, size_t size) {
+    if (tornBytes) {
+        size_t n = tornBytes < size ? tornBytes : size;
+        tornBytes = 0;
+        ESP.flashWrite(offset, (uint32_t*)data, n);
+        return false;
+    }
+    return ESP.flashWrite(offset, (uint32_t*)data, size);
+}
+
+static bool flashErase(uint32_t offset) {
+    return ESP.flashEraseSector(offset / SPI_FLASH_SEC_SIZE);
+}
+
+static const flashQueueIoDef io = { flashRead, flashWrite, flashErase, QUEUE_BEGIN, QUEUE_SEGMENTS };
+
+static sampleDef sample(uint32_t time) {
+    sampleDef s;
+    memset(&s, 0, sizeof(s));
+    s.time = time;
+    s.temp = 2000 + time % 1000;
+    return s;
+}
+
+// appends readings first..first+n-1, in batches like upload wakes do
+static void append(uint32_t first, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++)
+        samples[i] = sample(first + i);
+    for (uint32_t i = 0; i < n; i += 12)
+        TEST_ASSERT_TRUE(flashQueueAppend(&queue, &io, samples + i, n - i < 12 ? n - i : 12));
+}
+
+// takes max entries off the tail, they must be first, first+1, ...
+static uint16_t replay(uint32_t first, uint16_t max) {
+    uint16_t span;
+    uint16_t n = flashQueuePeek(&queue, &io, 0, samples, max, &span);
+    for (uint16_t i = 0; i < n; i++) {
+        TEST_ASSERT_EQUAL(first + i, samples[i].time);
+        TEST_ASSERT_EQUAL(sample(first + i).temp, samples[i].temp);
+    }
+    TEST_ASSERT_TRUE(flashQueueConsume(&queue, &io, span));
+    return n;
+}
+
+// cursors rebuilt from flash as after power loss must match those kept in RTC memory
+static void remount(void) {
+    flashQueueDef kept = queue;
+    flashQueueMount(&queue, &io);
+    TEST_ASSERT_EQUAL(kept.headSeq, queue.headSeq);
+    TEST_ASSERT_EQUAL(kept.headIndex, queue.headIndex);
+    TEST_ASSERT_EQUAL(kept.count, queue.count);
+    if (kept.count) {
+        TEST_ASSERT_EQUAL(kept.tailSeq, queue.tailSeq);
+        TEST_ASSERT_EQUAL(kept.tailIndex, queue.tailIndex);
+    }
+}
+
+void setUp(void) {
+    sim = (simStateDef*)calloc(1, sizeof(simStateDef));
+    memset(sim->flash, 0xFF, SIM_FLASH_SIZE);
+    tornBytes = 0;
+    flashQueueMount(&queue, &io);
+}
+
+void tearDown(void) {
+    free(sim);
+    sim = NULL;
+}
+
+void test_empty(void) {
+    uint16_t span;
+    TEST_ASSERT_EQUAL(0, queue.count);
+    TEST_ASSERT_EQUAL(0, flashQueuePeek(&queue, &io, 0, samples, 10, &span));
+    TEST_ASSERT_EQUAL(0, span);
+    TEST_ASSERT_EQUAL(0, flashQueueNewest(&queue, &io));
+    //garbage that is not a segment header
+    memset(sim->flash + QUEUE_BEGIN, 0x5A, 64);
+    flashQueueMount(&queue, &io);
+    TEST_ASSERT_EQUAL(0, queue.count);
+}
+
+// readings come back oldest first across segments, a partly replayed log survives a remount
+void test_replay_order(void) {
+    const uint32_t total = FLASH_QUEUE_ENTRIES + FLASH_QUEUE_ENTRIES / 2;
+    append(1, total);
+    TEST_ASSERT_EQUAL(total, queue.count);
+    TEST_ASSERT_EQUAL(total, flashQueueNewest(&queue, &io));
+    remount();
+
+    uint32_t next = 1;
+    next += replay(next, 40);
+    TEST_ASSERT_EQUAL(41, next);
+    remount();
+    //a batch that reaches into the next segment
+    while (next + 40 <= FLASH_QUEUE_ENTRIES)
+        next += replay(next, 40);
+    next += replay(next, 40);
+    TEST_ASSERT_TRUE(next > FLASH_QUEUE_ENTRIES);
+    remount();
+    //new readings go behind the ones still queued
+    append(total + 1, 20);
+    while (queue.count)
+        next += replay(next, 50);
+    TEST_ASSERT_EQUAL(total + 21, next);
+    remount();
+    TEST_ASSERT_EQUAL(0, flashQueueNewest(&queue, &io));
+}
+
+// peek behind batches still in flight, nothing is consumed until they are acknowledged
+void test_peek_skip(void) {
+    append(1, 30);
+    uint16_t span;
+    TEST_ASSERT_EQUAL(10, flashQueuePeek(&queue, &io, 0, samples, 10, &span));
+    TEST_ASSERT_EQUAL(10, flashQueuePeek(&queue, &io, span, samples, 10, &span));
+    TEST_ASSERT_EQUAL(11, samples[0].time);
+    TEST_ASSERT_EQUAL(0, flashQueuePeek(&queue, &io, 30, samples, 10, &span));
+    TEST_ASSERT_EQUAL(30, queue.count);
+    TEST_ASSERT_TRUE(flashQueueConsume(&queue, &io, 20));
+    TEST_ASSERT_EQUAL(10, flashQueuePeek(&queue, &io, 0, samples, 20, &span));
+    TEST_ASSERT_EQUAL(21, samples[0].time);
+}
+
+// power lost in the middle of an append: the entries before it are kept, the torn one
+// is skipped on replay and the next append goes behind it
+void test_torn_entry(void) {
+    append(1, 10);
+    samples[0] = sample(11);
+    samples[1] = sample(12);
+    tornBytes = sizeof(sampleDef) + 4;
+    TEST_ASSERT_FALSE(flashQueueAppend(&queue, &io, samples, 2));
+
+    flashQueueMount(&queue, &io);
+    TEST_ASSERT_EQUAL(12, queue.count);
+    TEST_ASSERT_EQUAL(12, queue.headIndex);
+    append(13, 3);
+    uint16_t span;
+    uint16_t n = flashQueuePeek(&queue, &io, 0, samples, 20, &span);
+    TEST_ASSERT_EQUAL(14, n);
+    TEST_ASSERT_EQUAL(15, span);
+    for (uint16_t i = 0; i < n; i++)
+        TEST_ASSERT_EQUAL(i < 11 ? i + 1 : i + 2, samples[i].time);
+    TEST_ASSERT_TRUE(flashQueueConsume(&queue, &io, span));
+    remount();
+    TEST_ASSERT_EQUAL(0, queue.count);
+}
+
+// power lost between the erase of a new segment and its header: the segment does not count
+void test_torn_segment_header(void) {
+    append(1, FLASH_QUEUE_ENTRIES);
+    samples[0] = sample(FLASH_QUEUE_ENTRIES + 1);
+    tornBytes = 4;
+    TEST_ASSERT_FALSE(flashQueueAppend(&queue, &io, samples, 1));
+
+    flashQueueMount(&queue, &io);
+    TEST_ASSERT_EQUAL(FLASH_QUEUE_ENTRIES, queue.count);
+    TEST_ASSERT_EQUAL(FLASH_QUEUE_ENTRIES, flashQueueNewest(&queue, &io));
+    append(FLASH_QUEUE_ENTRIES + 1, 5);
+    TEST_ASSERT_EQUAL(FLASH_QUEUE_ENTRIES + 5, queue.count);
+    remount();
+    uint32_t next = 1;
+    while (queue.count)
+        next += replay(next, 64);
+    TEST_ASSERT_EQUAL(FLASH_QUEUE_ENTRIES + 6, next);
+}
+
+// a full log recycles its oldest segment, the entries lost there are counted as dropped
+void test_recycle_at_wrap(void) {
+    append(1, QUEUE_SEGMENTS * FLASH_QUEUE_ENTRIES);
+    TEST_ASSERT_EQUAL(QUEUE_SEGMENTS * FLASH_QUEUE_ENTRIES, queue.count);
+    TEST_ASSERT_EQUAL(0, queue.dropped);
+
+    append(QUEUE_SEGMENTS * FLASH_QUEUE_ENTRIES + 1, 10);
+    TEST_ASSERT_EQUAL(FLASH_QUEUE_ENTRIES, queue.dropped);
+    TEST_ASSERT_EQUAL((QUEUE_SEGMENTS - 1) * FLASH_QUEUE_ENTRIES + 10, queue.count);
+    TEST_ASSERT_EQUAL(QUEUE_SEGMENTS + 1, queue.headSeq);
+    remount();
+
+    //partly replayed tail segment: only what is left of it is dropped
+    uint32_t next = FLASH_QUEUE_ENTRIES + 1;
+    next += replay(next, 25);
+    queue.dropped = 0;
+    append(QUEUE_SEGMENTS * FLASH_QUEUE_ENTRIES + 11, FLASH_QUEUE_ENTRIES);
+    TEST_ASSERT_EQUAL(FLASH_QUEUE_ENTRIES - 25, queue.dropped);
+    remount();
+
+    //many times around the ring, the sequence numbers keep the order
+    for (int round = 0; round < 2 * QUEUE_SEGMENTS; round++)
+        append(100000 + round * 1000, FLASH_QUEUE_ENTRIES / 2);
+    remount();
+    TEST_ASSERT_EQUAL(100000 + (2 * QUEUE_SEGMENTS - 1) * 1000 + FLASH_QUEUE_ENTRIES / 2 - 1, flashQueueNewest(&queue, &io));
+    uint16_t span;
+    TEST_ASSERT_TRUE(flashQueuePeek(&queue, &io, 0, samples, 1, &span) == 1);
+    uint32_t oldest = samples[0].time;
+    TEST_ASSERT_EQUAL(queue.count, flashQueuePeek(&queue, &io, 0, samples, 3 * FLASH_QUEUE_ENTRIES, &span));
+    TEST_ASSERT_EQUAL(oldest, samples[0].time);
+    for (uint32_t i = 1; i < queue.count; i++)
+        TEST_ASSERT_TRUE(samples[i].time > samples[i - 1].time);
+}
+
+void test_crc(void) {
+    append(1, 5);
+    TEST_ASSERT_FALSE(flashQueueValid(&queue));
+    flashQueueSeal(&queue);
+    TEST_ASSERT_TRUE(flashQueueValid(&queue));
+    queue.count++;
+    TEST_ASSERT_FALSE(flashQueueValid(&queue));
+    queue.count--;
+    queue.headIndex = FLASH_QUEUE_ENTRIES + 1;
+    flashQueueSeal(&queue);
+    TEST_ASSERT_FALSE(flashQueueValid(&queue));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty);
+    RUN_TEST(test_replay_order);
+    RUN_TEST(test_peek_skip);
+    RUN_TEST(test_torn_entry);
+    RUN_TEST(test_torn_segment_header);
+    RUN_TEST(test_recycle_at_wrap);
+    RUN_TEST(test_crc);
+    return UNITY_END();
+}
@@ -0,0 +1,223 @@
+#include <unity.h>
+#include <string.h>
+#include <MqttWindow.h>
+
+// host tests of the QoS1 in-flight window and the PUBACK scanner
+//   pio test -e native -f test_mqtt_window
+
+static mqttWindowDef window;
+
+void setUp(void) {
+    memset(&window, 0, sizeof(window));
+    mqttWindowReset(&window, 4);
+}
+
+void tearDown(void) {
+}
+
+static size_t puback(uint8_t* out, uint16_t id) {
+    out[0] = 0x40;
+    out[1] = 2;
+    out[2] = id >> 8;
+    out[3] = id & 0xFF;
+    return 4;
+}
+
+static bool acked(uint16_t id) {
+    for (uint8_t i = 0; i < window.count; i++) {
+        const mqttInFlightDef* entry = &window.entries[(window.head + i) % MQTT_WINDOW_MAX];
+        if (entry->id == id)
+            return entry->acked;
+    }
+    return false;
+}
+
+void test_publish_header(void) {
+    uint8_t header[MQTT_PUBLISH_HEADER_MAX + 8];
+    size_t n = mqttPublishHeader(header, sizeof(header), "t/x", 10, 0x1234);
+    const uint8_t expected[] = { 0x32, 17, 0x00, 0x03, 't', '/', 'x', 0x12, 0x34 };
+    TEST_ASSERT_EQUAL(sizeof(expected), n);
+    TEST_ASSERT_EQUAL_MEMORY(expected, header, n);
+
+    //remaining length 2 + 3 + 2 + 200 = 207 takes two bytes
+    n = mqttPublishHeader(header, sizeof(header), "t/x", 200, 1);
+    TEST_ASSERT_EQUAL(10, n);
+    TEST_ASSERT_EQUAL(0xCF, header[1]);
+    TEST_ASSERT_EQUAL(0x01, header[2]);
+
+    TEST_ASSERT_EQUAL(0, mqttPublishHeader(header, 8, "t/x", 10, 1));
+}
+
+void test_ids(void) {
+    uint16_t a = mqttWindowOpen(&window, 1, 0, 0);
+    uint16_t b = mqttWindowOpen(&window, 1, 0, 0);
+    TEST_ASSERT_TRUE(a != 0);
+    TEST_ASSERT_EQUAL(a + 1, b);
+
+    //IDs go on across connections and skip 0
+    mqttWindowReset(&window, 4);
+    TEST_ASSERT_EQUAL(0, mqttWindowCount(&window));
+    window.lastId = 0xFFFE;
+    TEST_ASSERT_EQUAL(0xFFFF, mqttWindowOpen(&window, 1, 0, 0));
+    TEST_ASSERT_EQUAL(1, mqttWindowOpen(&window, 1, 0, 0));
+}
+
+void test_acked_in_order(void) {
+    uint16_t a = mqttWindowOpen(&window, 1, 12, 3);
+    uint16_t b = mqttWindowOpen(&window, 2, 5, 0);
+    mqttWindowSet(&window, 2, 4, 1);
+    uint8_t data[4];
+    mqttInFlightDef done;
+
+    //acknowledged out of order: the second one waits for the first
+    mqttWindowScan(&window, data, puback(data, b));
+    TEST_ASSERT_FALSE(mqttWindowPop(&window, &done));
+    mqttWindowScan(&window, data, puback(data, a));
+    TEST_ASSERT_TRUE(mqttWindowPop(&window, &done));
+    TEST_ASSERT_EQUAL(a, done.id);
+    TEST_ASSERT_EQUAL(1, done.kind);
+    TEST_ASSERT_EQUAL(12, done.count);
+    TEST_ASSERT_EQUAL(3, done.extra);
+    TEST_ASSERT_TRUE(mqttWindowPop(&window, &done));
+    TEST_ASSERT_EQUAL(b, done.id);
+    TEST_ASSERT_EQUAL(4, done.count);
+    TEST_ASSERT_EQUAL(1, done.extra);
+    TEST_ASSERT_FALSE(mqttWindowPop(&window, &done));
+    TEST_ASSERT_EQUAL(0, mqttWindowCount(&window));
+}
+
+// TCP may hand over a PUBACK in pieces, cut at every position
+void test_puback_split(void) {
+    uint8_t data[4];
+    for (size_t cut = 1; cut < 4; cut++) {
+        mqttWindowReset(&window, 4);
+        uint16_t id = mqttWindowOpen(&window, 1, 1, 0);
+        puback(data, id);
+        mqttWindowScan(&window, data, cut);
+        TEST_ASSERT_FALSE(acked(id));
+        mqttWindowScan(&window, data + cut, 4 - cut);
+        TEST_ASSERT_TRUE(acked(id));
+    }
+
+    //one byte per read
+    mqttWindowReset(&window, 4);
+    uint16_t id = mqttWindowOpen(&window, 1, 1, 0);
+    puback(data, id);
+    for (size_t i = 0; i < 4; i++)
+        mqttWindowScan(&window, data + i, 1);
+    TEST_ASSERT_TRUE(acked(id));
+}
+
+// several PUBACKs in one read, among other packets from the broker
+void test_pubacks_in_one_read(void) {
+    uint16_t id[4];
+    for (int i = 0; i < 4; i++)
+        id[i] = mqttWindowOpen(&window, 1, i, 0);
+    uint8_t data[64];
+    size_t n = 0;
+    n += puback(data + n, id[0]);
+    //PUBLISH from the broker (shadow delta) whose payload looks like a PUBACK
+    const uint8_t publish[] = { 0x30, 8, 0x00, 0x01, 'd', 0x40, 0x02, 0x00,
+        (uint8_t)(id[2] >> 8), (uint8_t)(id[2] & 0xFF) };
+    memcpy(data + n, publish, sizeof(publish));
+    n += sizeof(publish);
+    n += puback(data + n, id[1]);
+    //SUBACK
+    const uint8_t suback[] = { 0x90, 3, 0x00, 0x07, 0x00 };
+    memcpy(data + n, suback, sizeof(suback));
+    n += sizeof(suback);
+    n += puback(data + n, id[3]);
+    mqttWindowScan(&window, data, n);
+
+    TEST_ASSERT_TRUE(acked(id[0]));
+    TEST_ASSERT_TRUE(acked(id[1]));
+    TEST_ASSERT_FALSE(acked(id[2]));
+    TEST_ASSERT_TRUE(acked(id[3]));
+    mqttInFlightDef done;
+    TEST_ASSERT_TRUE(mqttWindowPop(&window, &done));
+    TEST_ASSERT_TRUE(mqttWindowPop(&window, &done));
+    TEST_ASSERT_FALSE(mqttWindowPop(&window, &done));
+    TEST_ASSERT_EQUAL(2, mqttWindowCount(&window));
+}
+
+// a PUBACK for a message from before the reconnect, or one never sent, changes nothing
+void test_unknown_id(void) {
+    uint16_t id = mqttWindowOpen(&window, 1, 1, 0);
+    uint8_t data[8];
+    size_t n = puback(data, id + 1);
+    n += puback(data + n, 0);
+    mqttWindowScan(&window, data, n);
+    TEST_ASSERT_FALSE(acked(id));
+    mqttInFlightDef done;
+    TEST_ASSERT_FALSE(mqttWindowPop(&window, &done));
+    TEST_ASSERT_EQUAL(1, mqttWindowCount(&window));
+
+    //the scanner is still in step
+    mqttWindowScan(&window, data, puback(data, id));
+    TEST_ASSERT_TRUE(mqttWindowPop(&window, &done));
+}
+
+void test_full_window(void) {
+    mqttWindowReset(&window, 2);
+    uint16_t a = mqttWindowOpen(&window, 1, 1, 0);
+    TEST_ASSERT_TRUE(mqttWindowOpen(&window, 1, 2, 0) != 0);
+    TEST_ASSERT_EQUAL(0, mqttWindowOpen(&window, 1, 3, 0));
+    TEST_ASSERT_EQUAL(2, mqttWindowCount(&window));
+
+    //acknowledged but not taken out yet, still in the window
+    uint8_t data[4];
+    mqttWindowScan(&window, data, puback(data, a));
+    TEST_ASSERT_EQUAL(0, mqttWindowOpen(&window, 1, 3, 0));
+    mqttInFlightDef done;
+    TEST_ASSERT_TRUE(mqttWindowPop(&window, &done));
+    TEST_ASSERT_TRUE(mqttWindowOpen(&window, 1, 3, 0) != 0);
+
+    //the largest window wraps around its entries
+    mqttWindowReset(&window, 255);
+    TEST_ASSERT_EQUAL(MQTT_WINDOW_MAX, window.size);
+    for (int round = 0; round < 3; round++) {
+        uint16_t first = 0;
+        for (int i = 0; i < MQTT_WINDOW_MAX; i++) {
+            uint16_t id = mqttWindowOpen(&window, 1, i, 0);
+            TEST_ASSERT_TRUE(id != 0);
+            if (i == 0)
+                first = id;
+        }
+        TEST_ASSERT_EQUAL(0, mqttWindowOpen(&window, 1, 0, 0));
+        for (int i = 0; i < MQTT_WINDOW_MAX; i++)
+            mqttWindowScan(&window, data, puback(data, first + i));
+        for (int i = 0; i < MQTT_WINDOW_MAX; i++) {
+            TEST_ASSERT_TRUE(mqttWindowPop(&window, &done));
+            TEST_ASSERT_EQUAL(i, done.count);
+        }
+    }
+
+    //QoS0: nothing goes into the window
+    mqttWindowReset(&window, 0);
+    TEST_ASSERT_EQUAL(0, mqttWindowOpen(&window, 1, 1, 0));
+}
+
+// a new connection starts a new stream, a packet cut off by the old one is forgotten
+void test_reset_mid_packet(void) {
+    uint16_t id = mqttWindowOpen(&window, 1, 1, 0);
+    uint8_t data[4];
+    puback(data, id);
+    mqttWindowScan(&window, data, 2);
+    mqttWindowReset(&window, 4);
+    id = mqttWindowOpen(&window, 1, 1, 0);
+    mqttWindowScan(&window, data, puback(data, id));
+    TEST_ASSERT_TRUE(acked(id));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_publish_header);
+    RUN_TEST(test_ids);
+    RUN_TEST(test_acked_in_order);
+    RUN_TEST(test_puback_split);
+    RUN_TEST(test_pubacks_in_one_read);
+    RUN_TEST(test_unknown_id);
+    RUN_TEST(test_full_window);
+    RUN_TEST(test_reset_mid_packet);
+    return UNITY_END();
+}
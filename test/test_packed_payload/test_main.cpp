@@ -0,0 +1,220 @@
+#include <unity.h>
+#include <string.h>
+#include <PackedPayload.h>
+
+// host tests of the packed content messages, encoder against decoder
+//   pio test -e native -f test_packed_payload
+
+static uint8_t buffer[1024];
+static packedMessageDef msg;
+static const uint8_t roms[3][PACKED_ROM_SIZE] = {
+    { 0x28, 0xFF, 0x4C, 0x6A, 0x70, 0x16, 0x30, 0x9A },
+    { 0x28, 0xFF, 0x4C, 0x6A, 0x70, 0x16, 0x31, 0x2D },
+    { 0x28, 0xFF, 0x4C, 0x6A, 0x70, 0x16, 0x32, 0xC4 },
+};
+
+void setUp(void) {
+    memset(buffer, 0, sizeof(buffer));
+}
+
+void tearDown(void) {
+}
+
+static sampleDef sample(uint32_t time, int16_t temp, uint8_t sensor) {
+    sampleDef s = { time, temp, sensor, 0 };
+    return s;
+}
+
+void test_readings_round_trip(void) {
+    //every 300 s, one late wake, temperatures going up and down
+    sampleDef samples[] = {
+        sample(1000, 2150, 0), sample(1300, 2175, 0), sample(1600, 2140, 0),
+        sample(1917, 2140, 0), sample(2200, 2210, 0),
+    };
+    PackedWriter packed(buffer, sizeof(buffer));
+    packedReadings(packed, "TempMon-00C0FFEE", roms, 1, samples, 5, 2260, 3);
+    TEST_ASSERT_TRUE(packed.ok());
+
+    TEST_ASSERT_TRUE(packedDecode(packed.data(), packed.length(), &msg));
+    TEST_ASSERT_EQUAL(PACKED_READINGS, msg.type);
+    TEST_ASSERT_EQUAL_STRING("TempMon-00C0FFEE", msg.name);
+    TEST_ASSERT_EQUAL(1, msg.sensors);
+    TEST_ASSERT_EQUAL(3, msg.dropped);
+    TEST_ASSERT_EQUAL(5, msg.count);
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL(0, msg.readings[i].sensor);
+        TEST_ASSERT_EQUAL(2260 - samples[i].time, msg.readings[i].age);
+        TEST_ASSERT_EQUAL(samples[i].temp, msg.readings[i].temp);
+    }
+}
+
+// readings come back grouped by sensor, in order within the group
+void test_readings_sensors(void) {
+    sampleDef samples[] = {
+        sample(100, 2150, 0), sample(100, 1980, 2), sample(400, 2160, 0), sample(400, 1975, 2),
+    };
+    PackedWriter packed(buffer, sizeof(buffer));
+    packedReadings(packed, "t", roms, 3, samples, 4, 500, 0);
+    TEST_ASSERT_TRUE(packed.ok());
+
+    TEST_ASSERT_TRUE(packedDecode(packed.data(), packed.length(), &msg));
+    TEST_ASSERT_EQUAL(3, msg.sensors);
+    TEST_ASSERT_EQUAL_MEMORY(roms, msg.rom, sizeof(roms));
+    TEST_ASSERT_EQUAL(4, msg.count);
+    const int order[] = { 0, 2, 1, 3 };
+    for (int i = 0; i < 4; i++) {
+        const sampleDef* s = &samples[order[i]];
+        TEST_ASSERT_EQUAL(s->sensor, msg.readings[i].sensor);
+        TEST_ASSERT_EQUAL(500 - s->time, msg.readings[i].age);
+        TEST_ASSERT_EQUAL(s->temp, msg.readings[i].temp);
+    }
+}
+
+// zigzag: negative temperatures, negative differences and irregular age steps
+void test_zigzag_negatives(void) {
+    sampleDef samples[] = {
+        sample(0, -5500, 0), sample(60, -1, 0), sample(61, 0, 0), sample(300, -32768, 0),
+        sample(301, 32767, 0), sample(302, -2, 0),
+    };
+    PackedWriter packed(buffer, sizeof(buffer));
+    packedReadings(packed, "t", roms, 1, samples, 6, 302, 0);
+    TEST_ASSERT_TRUE(packed.ok());
+
+    TEST_ASSERT_TRUE(packedDecode(packed.data(), packed.length(), &msg));
+    TEST_ASSERT_EQUAL(6, msg.count);
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL(302 - samples[i].time, msg.readings[i].age);
+        TEST_ASSERT_EQUAL(samples[i].temp, msg.readings[i].temp);
+    }
+}
+
+void test_varint_bytes(void) {
+    //zigzag: 0 -1 1 -2 -> 0 1 2 3, 63 is the last one in a byte, -65 needs two
+    const int32_t value[] = { 0, -1, 1, -2, 63, -64, 64, -65 };
+    const size_t bytes[] = { 1, 1, 1, 1, 1, 1, 2, 2 };
+    for (int i = 0; i < 8; i++) {
+        PackedWriter packed(buffer, sizeof(buffer));
+        packed.putSigned(value[i]);
+        TEST_ASSERT_EQUAL(bytes[i], packed.length());
+    }
+    PackedWriter packed(buffer, sizeof(buffer));
+    packed.putVarint(300);
+    TEST_ASSERT_EQUAL(2, packed.length());
+    TEST_ASSERT_EQUAL(0xAC, buffer[0]);
+    TEST_ASSERT_EQUAL(0x02, buffer[1]);
+}
+
+// ages, drops and periods that take several LEB128 bytes
+void test_multi_byte_varints(void) {
+    sampleDef samples[] = { sample(1, 2150, 0), sample(20000, 2150, 0), sample(3000000, 2151, 0) };
+    PackedWriter packed(buffer, sizeof(buffer));
+    packedReadings(packed, "t", roms, 1, samples, 3, 0x7FFFFFFF, 0x0FFFFFFF);
+    TEST_ASSERT_TRUE(packed.ok());
+    TEST_ASSERT_TRUE(packedDecode(packed.data(), packed.length(), &msg));
+    TEST_ASSERT_EQUAL(0x0FFFFFFF, msg.dropped);
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(0x7FFFFFFF - samples[i].time, msg.readings[i].age);
+        TEST_ASSERT_EQUAL(samples[i].temp, msg.readings[i].temp);
+    }
+}
+
+void test_window_round_trip(void) {
+    windowDef window;
+    windowReset(&window);
+    const int16_t x[] = { -120, -80, -95, -130, -60 };
+    for (int i = 0; i < 5; i++) {
+        windowAdd(&window, 0, x[i]);
+        windowAdd(&window, 1, 2100 + 10 * i);
+    }
+    PackedWriter packed(buffer, sizeof(buffer));
+    packedWindow(packed, "freezer", roms, 2, &window, 3600);
+    TEST_ASSERT_TRUE(packed.ok());
+
+    TEST_ASSERT_TRUE(packedDecode(packed.data(), packed.length(), &msg));
+    TEST_ASSERT_EQUAL(PACKED_WINDOW, msg.type);
+    TEST_ASSERT_EQUAL_STRING("freezer", msg.name);
+    TEST_ASSERT_EQUAL(3600, msg.period);
+    TEST_ASSERT_EQUAL(2, msg.count);
+    for (uint8_t s = 0; s < 2; s++) {
+        const packedStatDef* stat = &msg.stats[s];
+        TEST_ASSERT_EQUAL(s, stat->sensor);
+        TEST_ASSERT_EQUAL(5, stat->n);
+        TEST_ASSERT_EQUAL(windowMean(&window, s), stat->mean);
+        TEST_ASSERT_EQUAL(window.stat[s].min, stat->min);
+        TEST_ASSERT_EQUAL(window.stat[s].max, stat->max);
+        TEST_ASSERT_EQUAL(windowStddev(&window, s), stat->sd);
+    }
+    TEST_ASSERT_EQUAL(-97, msg.stats[0].mean);
+    TEST_ASSERT_EQUAL(-130, msg.stats[0].min);
+}
+
+// every message cut short is rejected, so is one with bytes after the end
+void test_truncated_rejected(void) {
+    sampleDef samples[] = { sample(100, -2150, 0), sample(400, 1980, 1), sample(700, 30000, 0) };
+    PackedWriter packed(buffer, sizeof(buffer));
+    packedReadings(packed, "TempMon-00C0FFEE", roms, 2, samples, 3, 100000, 200);
+    TEST_ASSERT_TRUE(packed.ok());
+    size_t length = packed.length();
+    TEST_ASSERT_TRUE(packedDecode(buffer, length, &msg));
+    for (size_t n = 0; n < length; n++)
+        TEST_ASSERT_FALSE(packedDecode(buffer, n, &msg));
+    TEST_ASSERT_FALSE(packedDecode(buffer, length + 1, &msg));
+
+    windowDef window;
+    windowReset(&window);
+    windowAdd(&window, 0, -300);
+    packed.reset();
+    packedWindow(packed, "t", roms, 1, &window, 300);
+    length = packed.length();
+    TEST_ASSERT_TRUE(packedDecode(buffer, length, &msg));
+    for (size_t n = 0; n < length; n++)
+        TEST_ASSERT_FALSE(packedDecode(buffer, n, &msg));
+}
+
+void test_not_packed_rejected(void) {
+    const char json[] = "{\"sensor\":\"t\",\"temperature\":21.5}";
+    TEST_ASSERT_FALSE(packedDecode((const uint8_t*)json, sizeof(json) - 1, &msg));
+    const uint8_t type[] = { PACKED_MAGIC, 7, 0, 1, 0, 0 };
+    TEST_ASSERT_FALSE(packedDecode(type, sizeof(type), &msg));
+
+    //sensor index past the table: magic, type, name "t", 2 sensors and their ROM IDs,
+    //period, groups, then the index of the first group
+    windowDef window;
+    windowReset(&window);
+    windowAdd(&window, 0, 2000);
+    PackedWriter packed(buffer, sizeof(buffer));
+    packedWindow(packed, "t", roms, 2, &window, 60);
+    const size_t index = 1 + 1 + 2 + 1 + 2 * PACKED_ROM_SIZE + 1 + 1;
+    TEST_ASSERT_EQUAL(0, buffer[index]);
+    buffer[index] = 1;
+    TEST_ASSERT_TRUE(packedDecode(packed.data(), packed.length(), &msg));
+    buffer[index] = 2;
+    TEST_ASSERT_FALSE(packedDecode(packed.data(), packed.length(), &msg));
+}
+
+// a writer that runs out of room says so, nothing is written past its size
+void test_writer_overflow(void) {
+    sampleDef samples[40];
+    for (int i = 0; i < 40; i++)
+        samples[i] = sample(i * 300, 2000 + i * 37, 0);
+    buffer[32] = 0x5A;
+    PackedWriter packed(buffer, 32);
+    packedReadings(packed, "TempMon-00C0FFEE", roms, 1, samples, 40, 12000, 0);
+    TEST_ASSERT_FALSE(packed.ok());
+    TEST_ASSERT_TRUE(packed.length() <= 32);
+    TEST_ASSERT_EQUAL(0x5A, buffer[32]);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_readings_round_trip);
+    RUN_TEST(test_readings_sensors);
+    RUN_TEST(test_zigzag_negatives);
+    RUN_TEST(test_varint_bytes);
+    RUN_TEST(test_multi_byte_varints);
+    RUN_TEST(test_window_round_trip);
+    RUN_TEST(test_truncated_rejected);
+    RUN_TEST(test_not_packed_rejected);
+    RUN_TEST(test_writer_overflow);
+    return UNITY_END();
+}
@@ -0,0 +1,116 @@
+#include <unity.h>
+#include <string.h>
+#include <SampleRing.h>
+
+// host tests of the RTC memory sample ring
+//   pio test -e native -f test_sample_ring
+
+static sampleRingDef ring;
+
+void setUp(void) {
+    sampleRingReset(&ring);
+}
+
+void tearDown(void) {
+}
+
+void test_reset_is_valid_and_empty(void) {
+    TEST_ASSERT_TRUE(sampleRingValid(&ring));
+    TEST_ASSERT_EQUAL(0, ring.count);
+    TEST_ASSERT_EQUAL(0, ring.dropped);
+}
+
+void test_push_keeps_order(void) {
+    for (int i = 0; i < 5; i++)
+        sampleRingPush(&ring, 100 + i, 2000 + i, i % 2);
+    TEST_ASSERT_EQUAL(5, ring.count);
+    for (int i = 0; i < 5; i++) {
+        const sampleDef* sample = sampleRingAt(&ring, i);
+        TEST_ASSERT_EQUAL(100 + i, sample->time);
+        TEST_ASSERT_EQUAL(2000 + i, sample->temp);
+        TEST_ASSERT_EQUAL(i % 2, sample->sensor);
+    }
+}
+
+// a full ring overwrites the oldest samples and counts them as dropped
+void test_wrap_at_capacity(void) {
+    const int pushed = SAMPLE_RING_CAPACITY + 5;
+    for (int i = 0; i < pushed; i++)
+        sampleRingPush(&ring, i, -i, 0);
+    TEST_ASSERT_EQUAL(SAMPLE_RING_CAPACITY, ring.count);
+    TEST_ASSERT_EQUAL(pushed - SAMPLE_RING_CAPACITY, ring.dropped);
+    for (int i = 0; i < SAMPLE_RING_CAPACITY; i++)
+        TEST_ASSERT_EQUAL(pushed - SAMPLE_RING_CAPACITY + i, sampleRingAt(&ring, i)->time);
+    sampleRingSeal(&ring);
+    TEST_ASSERT_TRUE(sampleRingValid(&ring));
+}
+
+// dropping across the end of the array, then filling up again
+void test_drop_after_wrap(void) {
+    for (int i = 0; i < SAMPLE_RING_CAPACITY + 3; i++)
+        sampleRingPush(&ring, i, 0, 0);
+    sampleRingDrop(&ring, 10);
+    TEST_ASSERT_EQUAL(SAMPLE_RING_CAPACITY - 10, ring.count);
+    TEST_ASSERT_EQUAL(13, sampleRingAt(&ring, 0)->time);
+    for (int i = 0; i < 10; i++)
+        sampleRingPush(&ring, 100 + i, 0, 0);
+    TEST_ASSERT_EQUAL(SAMPLE_RING_CAPACITY, ring.count);
+    TEST_ASSERT_EQUAL(3, ring.dropped);
+    TEST_ASSERT_EQUAL(13, sampleRingAt(&ring, 0)->time);
+    sampleRingPush(&ring, 110, 0, 0);
+    TEST_ASSERT_EQUAL(4, ring.dropped);
+    TEST_ASSERT_EQUAL(14, sampleRingAt(&ring, 0)->time);
+    TEST_ASSERT_EQUAL(110, sampleRingAt(&ring, SAMPLE_RING_CAPACITY - 1)->time);
+    TEST_ASSERT_NULL(sampleRingAt(&ring, SAMPLE_RING_CAPACITY));
+
+    sampleRingDrop(&ring, SAMPLE_RING_CAPACITY + 1);
+    TEST_ASSERT_EQUAL(0, ring.count);
+}
+
+void test_bad_crc_rejected(void) {
+    sampleRingPush(&ring, 1, 2150, 0);
+    sampleRingSeal(&ring);
+    TEST_ASSERT_TRUE(sampleRingValid(&ring));
+
+    ring.samples[0].temp ^= 0x0100;
+    TEST_ASSERT_FALSE(sampleRingValid(&ring));
+    ring.samples[0].temp ^= 0x0100;
+    TEST_ASSERT_TRUE(sampleRingValid(&ring));
+
+    //a change not sealed, as after a reset in the middle of a write
+    sampleRingPush(&ring, 2, 2160, 0);
+    TEST_ASSERT_FALSE(sampleRingValid(&ring));
+}
+
+// the ring has no magic: RTC memory holding something else (power-up content, another
+// struct, eboot's OTA command) has to fail the CRC or the range check
+void test_foreign_data_rejected(void) {
+    memset(&ring, 0, sizeof(ring));
+    TEST_ASSERT_FALSE(sampleRingValid(&ring));
+    memset(&ring, 0xFF, sizeof(ring));
+    TEST_ASSERT_FALSE(sampleRingValid(&ring));
+    for (size_t i = 0; i < sizeof(ring); i++)
+        ((uint8_t*)&ring)[i] = i * 37 + 11;
+    TEST_ASSERT_FALSE(sampleRingValid(&ring));
+
+    //indexes out of range are rejected even with a matching CRC
+    sampleRingReset(&ring);
+    ring.head = SAMPLE_RING_CAPACITY;
+    sampleRingSeal(&ring);
+    TEST_ASSERT_FALSE(sampleRingValid(&ring));
+    sampleRingReset(&ring);
+    ring.count = SAMPLE_RING_CAPACITY + 1;
+    sampleRingSeal(&ring);
+    TEST_ASSERT_FALSE(sampleRingValid(&ring));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_reset_is_valid_and_empty);
+    RUN_TEST(test_push_keeps_order);
+    RUN_TEST(test_wrap_at_capacity);
+    RUN_TEST(test_drop_after_wrap);
+    RUN_TEST(test_bad_crc_rejected);
+    RUN_TEST(test_foreign_data_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,174 @@
+#include <unity.h>
+#include <string.h>
+#include <UploadBackoff.h>
+
+// host tests of the upload backoff scheduler
+//   pio test -e native -f test_upload_backoff
+
+#define WEAK_RSSI   -80
+#define MAX_HOLD    24
+
+static backoffDef backoff;
+
+void setUp(void) {
+    backoffReset(&backoff);
+}
+
+void tearDown(void) {
+}
+
+static void fail(int8_t rssi) {
+    backoffUpdate(&backoff, false, rssi, WEAK_RSSI, MAX_HOLD);
+}
+
+// wakes skipped before backoffHold lets the next attempt through
+static int skipped(void) {
+    int n = 0;
+    while (backoffHold(&backoff))
+        n++;
+    return n;
+}
+
+void test_reset(void) {
+    TEST_ASSERT_TRUE(backoffValid(&backoff));
+    TEST_ASSERT_EQUAL(0, backoff.failures);
+    TEST_ASSERT_FALSE(backoffHold(&backoff));
+    TEST_ASSERT_EQUAL(0, backoffRssi(&backoff));
+}
+
+// first failure is retried right away, then 1, 3, 7, 15 wakes are skipped, up to maxHold
+void test_growth_and_cap(void) {
+    const int expected[] = { 0, 1, 3, 7, 15, MAX_HOLD, MAX_HOLD };
+    for (int i = 0; i < 7; i++) {
+        fail(-60);
+        TEST_ASSERT_EQUAL(i + 1, backoff.failures);
+        TEST_ASSERT_EQUAL(expected[i], backoff.hold);
+    }
+
+    //no overflow of the shift after many failures, nor of the counter
+    for (int i = 0; i < 40; i++)
+        fail(-60);
+    TEST_ASSERT_EQUAL(MAX_HOLD, backoff.hold);
+    backoff.failures = UINT16_MAX;
+    backoffUpdate(&backoff, false, -60, WEAK_RSSI, UINT16_MAX);
+    TEST_ASSERT_EQUAL(UINT16_MAX, backoff.failures);
+    TEST_ASSERT_EQUAL(UINT16_MAX, backoff.hold);
+}
+
+void test_hold_countdown(void) {
+    fail(-60);
+    fail(-60);
+    fail(-60);
+    TEST_ASSERT_EQUAL(3, skipped());
+    //the attempt after the hold fails again: the hold grows
+    fail(-60);
+    TEST_ASSERT_EQUAL(7, skipped());
+    TEST_ASSERT_FALSE(backoffHold(&backoff));
+}
+
+// a mean RSSI below the weak threshold adds one step
+void test_weak_link(void) {
+    const int expected[] = { 1, 3, 7, 15 };
+    for (int i = 0; i < 4; i++) {
+        fail(-88);
+        TEST_ASSERT_EQUAL(expected[i], backoff.hold);
+    }
+
+    //the threshold itself is not weak
+    backoffReset(&backoff);
+    fail(WEAK_RSSI);
+    TEST_ASSERT_EQUAL(0, backoff.hold);
+    //-81 and -80 average to -80 (integer division)
+    fail(WEAK_RSSI - 1);
+    TEST_ASSERT_EQUAL(WEAK_RSSI, backoffRssi(&backoff));
+    TEST_ASSERT_EQUAL(1, backoff.hold);
+    fail(WEAK_RSSI - 5);
+    TEST_ASSERT_EQUAL(7, backoff.hold);
+}
+
+void test_success_resets(void) {
+    for (int i = 0; i < 5; i++)
+        fail(-60);
+    TEST_ASSERT_TRUE(backoff.hold > 0);
+    backoffUpdate(&backoff, true, -62, WEAK_RSSI, MAX_HOLD);
+    TEST_ASSERT_EQUAL(0, backoff.failures);
+    TEST_ASSERT_EQUAL(0, backoff.hold);
+    TEST_ASSERT_FALSE(backoffHold(&backoff));
+    //the RSSI history is kept
+    TEST_ASSERT_EQUAL(-62, backoff.rssi[0]);
+    TEST_ASSERT_EQUAL(-60, backoff.rssi[1]);
+
+    fail(-60);
+    TEST_ASSERT_EQUAL(0, backoff.hold);
+}
+
+// 0 means the AP was not reached, it does not go into the history
+void test_rssi_zero_not_recorded(void) {
+    fail(-70);
+    fail(0);
+    fail(0);
+    TEST_ASSERT_EQUAL(-70, backoff.rssi[0]);
+    TEST_ASSERT_EQUAL(0, backoff.rssi[1]);
+    TEST_ASSERT_EQUAL(-70, backoffRssi(&backoff));
+
+    //no history at all: not a weak link
+    backoffReset(&backoff);
+    fail(0);
+    fail(0);
+    TEST_ASSERT_EQUAL(0, backoffRssi(&backoff));
+    TEST_ASSERT_EQUAL(1, backoff.hold);
+}
+
+// the mean covers the newest 8 values
+void test_rssi_history(void) {
+    for (int i = 0; i < 4; i++)
+        backoffUpdate(&backoff, true, -90, WEAK_RSSI, MAX_HOLD);
+    TEST_ASSERT_EQUAL(-90, backoffRssi(&backoff));
+    for (int i = 0; i < 4; i++)
+        backoffUpdate(&backoff, true, -70, WEAK_RSSI, MAX_HOLD);
+    TEST_ASSERT_EQUAL(-80, backoffRssi(&backoff));
+    for (int i = 0; i < 4; i++)
+        backoffUpdate(&backoff, true, -70, WEAK_RSSI, MAX_HOLD);
+    TEST_ASSERT_EQUAL(-70, backoffRssi(&backoff));
+    TEST_ASSERT_EQUAL(-70, backoff.rssi[BACKOFF_RSSI_HISTORY - 1]);
+
+    //a weak history turns strong: the next failure no longer gets the extra step
+    backoffReset(&backoff);
+    for (int i = 0; i < BACKOFF_RSSI_HISTORY; i++)
+        backoffUpdate(&backoff, true, -95, WEAK_RSSI, MAX_HOLD);
+    fail(-50);
+    TEST_ASSERT_EQUAL(-89, backoffRssi(&backoff));
+    TEST_ASSERT_EQUAL(1, backoff.hold);
+    backoffReset(&backoff);
+    for (int i = 0; i < BACKOFF_RSSI_HISTORY; i++)
+        backoffUpdate(&backoff, true, -55, WEAK_RSSI, MAX_HOLD);
+    fail(-95);
+    TEST_ASSERT_EQUAL(0, backoff.hold);
+}
+
+void test_crc(void) {
+    fail(-60);
+    TEST_ASSERT_FALSE(backoffValid(&backoff));
+    backoffSeal(&backoff);
+    TEST_ASSERT_TRUE(backoffValid(&backoff));
+    backoff.hold++;
+    TEST_ASSERT_FALSE(backoffValid(&backoff));
+
+    memset(&backoff, 0, sizeof(backoff));
+    TEST_ASSERT_FALSE(backoffValid(&backoff));
+    memset(&backoff, 0xFF, sizeof(backoff));
+    TEST_ASSERT_FALSE(backoffValid(&backoff));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_reset);
+    RUN_TEST(test_growth_and_cap);
+    RUN_TEST(test_hold_countdown);
+    RUN_TEST(test_weak_link);
+    RUN_TEST(test_success_resets);
+    RUN_TEST(test_rssi_zero_not_recorded);
+    RUN_TEST(test_rssi_history);
+    RUN_TEST(test_crc);
+    return UNITY_END();
+}
@@ -0,0 +1,175 @@
+#include <unity.h>
+#include <math.h>
+#include <WindowStats.h>
+
+// host tests of the fixed point Welford statistics against a double reference
+//   pio test -e native -f test_window_stats
+
+static windowDef window;
+
+void setUp(void) {
+    windowReset(&window);
+}
+
+void tearDown(void) {
+}
+
+// adds x[] to the series and checks the result against mean and variance in double
+static void checkSeries(uint8_t series, const int16_t* x, int n) {
+    double sum = 0;
+    int16_t min = x[0], max = x[0];
+    for (int i = 0; i < n; i++) {
+        windowAdd(&window, series, x[i]);
+        sum += x[i];
+        if (x[i] < min)
+            min = x[i];
+        if (x[i] > max)
+            max = x[i];
+    }
+    double mean = sum / n;
+    double m2 = 0;
+    for (int i = 0; i < n; i++)
+        m2 += (x[i] - mean) * (x[i] - mean);
+    double variance = n > 1 ? m2 / (n - 1) : 0;
+
+    TEST_ASSERT_EQUAL(n, window.count[series]);
+    TEST_ASSERT_EQUAL(min, window.stat[series].min);
+    TEST_ASSERT_EQUAL(max, window.stat[series].max);
+    //the running mean keeps 8 fraction bits, rounding may go the other way at .5
+    TEST_ASSERT_DOUBLE_WITHIN(0.5 + 0.02, mean, windowMean(&window, series));
+    TEST_ASSERT_DOUBLE_WITHIN(1 + variance * 0.002, variance, windowVariance(&window, series));
+    TEST_ASSERT_DOUBLE_WITHIN(0.5 + 0.01, sqrt(variance), windowStddev(&window, series));
+}
+
+// room temperature in centi deg C with some noise, repeatable
+static void noisy(int16_t* x, int n, int16_t base, int16_t spread) {
+    uint32_t seed = 12345;
+    for (int i = 0; i < n; i++) {
+        seed = seed * 1103515245 + 12345;
+        x[i] = base + (int16_t)((seed >> 16) % (2 * spread + 1)) - spread;
+    }
+}
+
+void test_empty(void) {
+    TEST_ASSERT_EQUAL(0, windowSamples(&window));
+    TEST_ASSERT_EQUAL(0, windowMean(&window, 0));
+    TEST_ASSERT_EQUAL(0, windowVariance(&window, 0));
+    TEST_ASSERT_EQUAL(0, windowStddev(&window, 0));
+}
+
+void test_single_reading(void) {
+    windowAdd(&window, 0, 2153);
+    TEST_ASSERT_EQUAL(1, windowSamples(&window));
+    TEST_ASSERT_EQUAL(2153, windowMean(&window, 0));
+    TEST_ASSERT_EQUAL(2153, window.stat[0].min);
+    TEST_ASSERT_EQUAL(2153, window.stat[0].max);
+    TEST_ASSERT_EQUAL(0, windowVariance(&window, 0));
+    TEST_ASSERT_EQUAL(0, windowStddev(&window, 0));
+
+    windowAdd(&window, 1, -1207);
+    TEST_ASSERT_EQUAL(-1207, windowMean(&window, 1));
+    TEST_ASSERT_EQUAL(0, windowStddev(&window, 1));
+}
+
+void test_two_readings(void) {
+    const int16_t x[] = { 2100, 2200 };
+    checkSeries(0, x, 2);
+    TEST_ASSERT_EQUAL(2150, windowMean(&window, 0));
+    TEST_ASSERT_EQUAL(5000, windowVariance(&window, 0));
+    TEST_ASSERT_EQUAL(71, windowStddev(&window, 0));
+}
+
+void test_constant_input(void) {
+    for (int i = 0; i < 500; i++)
+        windowAdd(&window, 0, 1875);
+    TEST_ASSERT_EQUAL(1875, windowMean(&window, 0));
+    TEST_ASSERT_EQUAL(0, windowVariance(&window, 0));
+    TEST_ASSERT_EQUAL(0, windowStddev(&window, 0));
+
+    for (int i = 0; i < 500; i++)
+        windowAdd(&window, 1, -2500);
+    TEST_ASSERT_EQUAL(-2500, windowMean(&window, 1));
+    TEST_ASSERT_EQUAL(0, windowVariance(&window, 1));
+}
+
+void test_room_temperature(void) {
+    int16_t x[288];
+    noisy(x, 12, 2150, 40);
+    checkSeries(0, x, 12);
+    noisy(x, 288, 2150, 300);
+    checkSeries(1, x, 288);
+}
+
+void test_negative_temperatures(void) {
+    int16_t x[100];
+    noisy(x, 100, -1800, 250);
+    checkSeries(0, x, 100);
+
+    //freezer door opened: a step from -18 C to -5 C
+    for (int i = 0; i < 100; i++)
+        x[i] = i < 70 ? -1800 : -500;
+    checkSeries(1, x, 100);
+}
+
+void test_across_zero(void) {
+    int16_t x[60];
+    for (int i = 0; i < 60; i++)
+        x[i] = -300 + i * 10;
+    checkSeries(0, x, 60);
+}
+
+// full DS18B20 range in one window, the sum of squares goes way past 16 bits
+void test_wide_range(void) {
+    int16_t x[12];
+    for (int i = 0; i < 12; i++)
+        x[i] = i % 2 ? 12500 : -5500;
+    checkSeries(0, x, 12);
+}
+
+// m2 saturates: the variance stays at the largest value it can tell, it does not wrap
+void test_saturated(void) {
+    for (int i = 0; i < 64; i++)
+        windowAdd(&window, 0, i % 2 ? 12500 : -5500);
+    TEST_ASSERT_EQUAL(UINT32_MAX, window.stat[0].m2);
+    TEST_ASSERT_EQUAL(3500, windowMean(&window, 0));
+    TEST_ASSERT_EQUAL((UINT32_MAX + 31ULL) / 63, windowVariance(&window, 0));
+    TEST_ASSERT_EQUAL(8257, windowStddev(&window, 0));
+}
+
+void test_series_apart(void) {
+    windowAdd(&window, 0, 2000);
+    windowAdd(&window, 0, 2000);
+    windowAdd(&window, 2, 3000);
+    TEST_ASSERT_EQUAL(2, windowSamples(&window));
+    TEST_ASSERT_EQUAL(2000, windowMean(&window, 0));
+    TEST_ASSERT_EQUAL(3000, windowMean(&window, 2));
+    TEST_ASSERT_EQUAL(0, window.count[1]);
+    //out of range series are ignored
+    windowAdd(&window, WINDOW_SERIES, 100);
+    TEST_ASSERT_EQUAL(0, windowMean(&window, WINDOW_SERIES));
+}
+
+void test_crc(void) {
+    windowAdd(&window, 0, 2000);
+    TEST_ASSERT_FALSE(windowValid(&window));
+    windowSeal(&window);
+    TEST_ASSERT_TRUE(windowValid(&window));
+    window.stat[0].m2++;
+    TEST_ASSERT_FALSE(windowValid(&window));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty);
+    RUN_TEST(test_single_reading);
+    RUN_TEST(test_two_readings);
+    RUN_TEST(test_constant_input);
+    RUN_TEST(test_room_temperature);
+    RUN_TEST(test_negative_temperatures);
+    RUN_TEST(test_across_zero);
+    RUN_TEST(test_wide_range);
+    RUN_TEST(test_saturated);
+    RUN_TEST(test_series_apart);
+    RUN_TEST(test_crc);
+    return UNITY_END();
+}